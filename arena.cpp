@@ -0,0 +1,46 @@
+#include "arena.hpp"
+
+Arena::Arena(const std::size_t chunkSize) noexcept : chunkSize(chunkSize) {
+}
+
+Arena::~Arena() {
+    for (const Chunk &chunk: chunks) {
+        ::operator delete(chunk.data);
+    }
+}
+
+char *Arena::grow(const std::size_t bytes, const std::size_t align) {
+    // chunks double, so a large parse needs O(log n) of them
+    std::size_t size = chunks.empty() ? chunkSize : chunks.back().size * 2;
+    while (size < bytes + align) {
+        size *= 2;
+    }
+    chunks.reserve(chunks.size() + 1);
+    chunks.push_back(Chunk{static_cast<char *>(::operator new(size)), size});
+    cursor = chunks.back().data;
+    limit = cursor + size;
+    return cursor + padding_for(cursor, align);
+}
+
+void Arena::reset() noexcept {
+    used = 0;
+    if (chunks.empty()) {
+        return;
+    }
+    // the last chunk is the largest
+    for (std::size_t i = 0; i + 1 < chunks.size(); ++i) {
+        ::operator delete(chunks[i].data);
+    }
+    chunks.front() = chunks.back();
+    chunks.resize(1);
+    cursor = chunks.front().data;
+    limit = cursor + chunks.front().size;
+}
+
+std::size_t Arena::capacity() const noexcept {
+    std::size_t total = 0;
+    for (const Chunk &chunk: chunks) {
+        total += chunk.size;
+    }
+    return total;
+}
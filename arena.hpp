@@ -0,0 +1,148 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+// system includes
+#include <cassert>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Bump allocator: hands out memory from large chunks in allocation order and
+// frees it all at once in reset(). Individual blocks are never freed.
+class Arena {
+public:
+    explicit Arena(std::size_t chunkSize = 64 * 1024) noexcept;
+
+    ~Arena();
+
+    Arena(const Arena &) = delete;
+
+    Arena &operator=(const Arena &) = delete;
+
+    void *allocate(std::size_t bytes, std::size_t align) {
+        const std::size_t room = static_cast<std::size_t>(limit - cursor);
+        const std::size_t padding = padding_for(cursor, align);
+        char *p;
+        if (padding <= room && bytes <= room - padding) {
+            p = cursor + padding;
+        } else {
+            p = grow(bytes, align);
+        }
+        cursor = p + bytes;
+        used += bytes;
+        return p;
+    }
+
+    // Release every block at once. The largest chunk is kept for reuse, so
+    // a caller that fills the arena to a similar size each time stops
+    // allocating from the heap after the first round.
+    void reset() noexcept;
+
+    // Bytes handed out since the last reset()
+    std::size_t bytes() const noexcept { return used; }
+
+    // Bytes of chunks held from the heap
+    std::size_t capacity() const noexcept;
+
+private:
+    struct Chunk {
+        char *data;
+        std::size_t size;
+    };
+
+    // Bytes to skip from 'p' to the next multiple of 'align', a power of two
+    static std::size_t padding_for(const char *p, std::size_t align) noexcept {
+        return (align - (reinterpret_cast<std::size_t>(p) & (align - 1))) & (align - 1);
+    }
+
+    char *grow(std::size_t bytes, std::size_t align);
+
+    std::vector<Chunk> chunks; // the current chunk is last
+    char *cursor = nullptr;
+    char *limit = nullptr;
+    std::size_t chunkSize;
+    std::size_t used = 0;
+};
+
+// Does 'value' own nothing outside 'arena', so skipping its destructor
+// leaks nothing? True for any type that owns no memory; types that do
+// overload it (see Expression).
+template<class T>
+bool arena_holds(const Arena *, const T &) noexcept {
+    return std::is_trivially_destructible<T>::value;
+}
+
+// Standard allocator over an Arena, or over the heap when it has none.
+//
+// Containers backed by an arena skip their elements' destructors as well as
+// the deallocation, so they can be dropped without visiting their elements;
+// such elements must own nothing outside the arena. Debug builds assert as
+// much, through arena_holds(), as elements go in and out. Copying a container
+// yields a heap-backed copy, while moving or swapping one carries its arena
+// along, so arena memory is never freed through the heap or vice versa.
+template<class T>
+class ArenaAllocator {
+public:
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    ArenaAllocator() noexcept : source(nullptr) {
+    }
+
+    explicit ArenaAllocator(Arena *arena) noexcept : source(arena) {
+    }
+
+    template<class U>
+    ArenaAllocator(const ArenaAllocator<U> &other) noexcept : source(other.arena()) {
+    }
+
+    T *allocate(std::size_t n) {
+        if (source) {
+            return static_cast<T *>(source->allocate(n * sizeof(T), alignof(T)));
+        }
+        return static_cast<T *>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T *p, std::size_t) noexcept {
+        if (!source) {
+            ::operator delete(p);
+        }
+    }
+
+    template<class U, class... Args>
+    void construct(U *p, Args &&... args) {
+        ::new(static_cast<void *>(p)) U(std::forward<Args>(args)...);
+        assert(!source || arena_holds(source, *p));
+    }
+
+    template<class U>
+    void destroy(U *p) noexcept {
+        if (!source) {
+            p->~U();
+        } else {
+            assert(arena_holds(source, *p));
+        }
+    }
+
+    ArenaAllocator select_on_container_copy_construction() const noexcept { return ArenaAllocator(); }
+
+    Arena *arena() const noexcept { return source; }
+
+private:
+    Arena *source;
+};
+
+template<class T, class U>
+bool operator==(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) noexcept {
+    return a.arena() == b.arena();
+}
+
+template<class T, class U>
+bool operator!=(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) noexcept {
+    return a.arena() != b.arena();
+}
+
+#endif
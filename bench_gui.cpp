@@ -0,0 +1,291 @@
+// Benchmarks for the pldraw canvas, runnable headless:
+//   QT_QPA_PLATFORM=offscreen bench_gui [--list | <benchmark>...]
+#include "bench_util.hpp"
+
+#include <QApplication>
+#include <QFrame>
+#include <QGraphicsScene>
+#include <QGraphicsView>
+#include <QImage>
+#include <QList>
+#include <QPainter>
+
+#include <cstddef>
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+#include "canvas_widget.hpp"
+#include "display_list_item.hpp"
+#include "qt_interpreter.hpp"
+#include "tile_renderer.hpp"
+
+// A program drawing 'count' lines in a fan
+static std::string lines_program(std::size_t count) {
+    std::ostringstream program;
+    program << "(";
+    for (std::size_t i = 0; i < count; ++i) {
+        program << "((0 0 point) (" << i % 1000 << " " << i / 1000 << " point) line) ";
+    }
+    program << "draw)";
+    return program.str();
+}
+
+// A program drawing 'count' short lines scattered over a 10,000 x 10,000
+// square by a fixed linear congruential walk
+static std::string scatter_program(std::size_t count) {
+    std::uint32_t seed = 1;
+    const auto next = [&seed]() {
+        seed = seed * 1664525u + 1013904223u;
+        return static_cast<int>((seed >> 8) % 10000);
+    };
+    std::ostringstream program;
+    program << "(";
+    for (std::size_t i = 0; i < count; ++i) {
+        const int x = next(), y = next();
+        program << "((" << x << " " << y << " point) (" << x + next() % 21 - 10 << " " << y + next() % 21 - 10
+                << " point) line) ";
+    }
+    program << "draw)";
+    return program.str();
+}
+
+// The DisplayListItem on 'scene', painting directly instead of from tiles,
+// or nullptr
+static DisplayListItem *packed_item(QGraphicsScene *scene) {
+    DisplayListItem *item = qgraphicsitem_cast<DisplayListItem *>(scene->items().value(0));
+    if (item != nullptr) {
+        item->setTileRenderer(nullptr);
+    }
+    return item;
+}
+
+// ---------------------------------------------------------------------------
+// scene_insert: one addGraphic per item vs one addGraphics per eval
+// ---------------------------------------------------------------------------
+
+// Evaluate 'program' into a fresh, shown canvas, adding its items one at a
+// time or in one batch, and report the time until the events it queued
+// (index updates, repaints) are processed
+static void time_insert(const std::string &label, const QString &program, bool batched) {
+    CanvasWidget canvas;
+    canvas.resize(800, 600);
+    canvas.show();
+    QApplication::processEvents();
+
+    QtInterpreter interp;
+    interp.setPackedThreshold(static_cast<std::size_t>(-1)); // an item per primitive
+    if (batched) {
+        QObject::connect(&interp, &QtInterpreter::drawGraphics, &canvas, &CanvasWidget::addGraphics);
+    } else {
+        QObject::connect(&interp, &QtInterpreter::drawGraphics, [&canvas](QList<QGraphicsItem *> items) {
+            for (QGraphicsItem *item: items) {
+                canvas.addGraphic(item);
+            }
+        });
+    }
+
+    Stopwatch watch;
+    interp.parseAndEvaluate(program);
+    QApplication::processEvents();
+    report("scene_insert", label, watch.millis(), "ms");
+}
+
+static void bench_scene_insert() {
+    const QString program = QString::fromStdString(lines_program(200000));
+    time_insert("200k lines, addGraphic per item", program, false);
+    time_insert("200k lines, addGraphics per eval", program, true);
+}
+
+// ---------------------------------------------------------------------------
+// packed_item: an item per primitive vs one DisplayListItem
+// ---------------------------------------------------------------------------
+
+// Evaluate 'program' into a fresh canvas, then render the scene into an
+// image twice; report the time to show it and to repaint it
+static void time_render(const std::string &label, const QString &program, std::size_t threshold) {
+    CanvasWidget canvas;
+    QtInterpreter interp;
+    interp.setPackedThreshold(threshold);
+    QObject::connect(&interp, &QtInterpreter::drawGraphics, &canvas, &CanvasWidget::addGraphics);
+
+    Stopwatch watch;
+    interp.parseAndEvaluate(program);
+    QGraphicsScene *scene = canvas.findChild<QGraphicsScene *>();
+    if (threshold <= 1) {
+        packed_item(scene); // painted directly: this compares painting alone
+    }
+    QImage image(800, 600, QImage::Format_ARGB32_Premultiplied);
+    QPainter painter(&image);
+    scene->render(&painter);
+    report("packed_item", label + " eval, insert and first render", watch.millis(), "ms");
+
+    watch.restart();
+    scene->render(&painter);
+    report("packed_item", label + " repaint", watch.millis(), "ms");
+
+    AllocStats before = alloc_stats();
+    scene->clear();
+    report("packed_item", label + " scene bytes per primitive",
+           static_cast<double>(before.live_bytes - alloc_stats().live_bytes) / 200000, "B");
+}
+
+static void bench_packed_item() {
+    const QString program = QString::fromStdString(lines_program(200000));
+    time_render("200k lines, item per primitive", program, static_cast<std::size_t>(-1));
+    time_render("200k lines, one DisplayListItem", program, 1);
+}
+
+// ---------------------------------------------------------------------------
+// viewport: zoom and pan over 1M lines in one DisplayListItem
+// ---------------------------------------------------------------------------
+
+static void bench_viewport() {
+    CanvasWidget canvas;
+    QtInterpreter interp;
+    QObject::connect(&interp, &QtInterpreter::drawGraphics, &canvas, &CanvasWidget::addGraphics);
+    interp.parseAndEvaluate(QString::fromStdString(lines_program(1000000)));
+    QGraphicsScene *scene = canvas.findChild<QGraphicsScene *>();
+    packed_item(scene);
+    const QRectF all = scene->itemsBoundingRect();
+
+    // render an 800 x 600 image of ever smaller views, panning across
+    QImage image(800, 600, QImage::Format_ARGB32_Premultiplied);
+    QPainter painter(&image);
+    for (qreal zoom = 1; zoom <= 256; zoom *= 4) {
+        const qreal w = all.width() / zoom, h = all.height() / zoom;
+        const int pans = 10;
+        Stopwatch watch;
+        for (int p = 0; p < pans; ++p) {
+            const QRectF view(all.left() + (all.width() - w) * p / pans, all.top() + (all.height() - h) * p / pans, w, h);
+            scene->render(&painter, QRectF(image.rect()), view);
+        }
+        report("viewport", "1M lines at " + std::to_string(static_cast<int>(zoom)) + "x zoom, per frame",
+               watch.millis() / pans, "ms");
+    }
+
+    // picking through the item's index
+    const int picks = 1000;
+    Stopwatch watch;
+    std::size_t found = 0;
+    for (int i = 0; i < picks; ++i) {
+        found += scene->itemAt(QPointF(i % 1000, i % 7), QTransform()) != nullptr;
+    }
+    report("viewport", "itemAt", watch.seconds() / picks * 1e6, "us");
+    report("viewport", "itemAt hits", static_cast<double>(found), "");
+}
+
+// ---------------------------------------------------------------------------
+// level_of_detail: zoomed out frame time as the line count grows
+// ---------------------------------------------------------------------------
+
+static void bench_level_of_detail() {
+    for (std::size_t count = 125000; count <= 2000000; count *= 4) {
+        CanvasWidget canvas;
+        QtInterpreter interp;
+        QObject::connect(&interp, &QtInterpreter::drawGraphics, &canvas, &CanvasWidget::addGraphics);
+        interp.parseAndEvaluate(QString::fromStdString(scatter_program(count)));
+        QGraphicsScene *scene = canvas.findChild<QGraphicsScene *>();
+        DisplayListItem *item = packed_item(scene);
+        if (item == nullptr) {
+            return;
+        }
+
+        // the whole drawing, then a quarter of it, in an 800 x 800 image
+        QImage image(800, 800, QImage::Format_ARGB32_Premultiplied);
+        QPainter painter(&image);
+        const QRectF all = item->boundingRect();
+        for (const bool detailed: {true, false}) {
+            item->setDetailed(detailed);
+            for (qreal zoom = 1; zoom <= 4; zoom *= 4) {
+                const int frames = 5;
+                Stopwatch watch;
+                for (int f = 0; f < frames; ++f) {
+                    scene->render(&painter, QRectF(image.rect()),
+                                  QRectF(all.topLeft(), all.size() / zoom));
+                }
+                report("level_of_detail", std::to_string(count / 1000) + "k lines at " +
+                       std::to_string(static_cast<int>(zoom)) + "x, " + (detailed ? "every draw" : "LOD") +
+                       ", per frame", watch.millis() / frames, "ms");
+            }
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// tile_pan: panning over 1M lines painted directly vs from cached tiles
+// ---------------------------------------------------------------------------
+
+// Pan the 800 x 600 viewport of 'view' at 'zoom' across the drawing on its
+// scene in 'steps' steps of a quarter view, left to right then back;
+// report the time per frame, and with tiles the time to paint the tiles
+// requested. Tiles serve only the viewport, so it is painted as on screen.
+static void pan(QGraphicsView *view, TileRenderer *tiles, qreal zoom, const std::string &label) {
+    const QRectF all = view->scene()->itemsBoundingRect();
+    const qreal w = 800 / zoom;
+    const int steps = 40;
+    view->setTransform(QTransform::fromScale(zoom, zoom));
+    QImage image(800, 600, QImage::Format_ARGB32_Premultiplied);
+    double frames = 0, catchUp = 0;
+    for (int i = 0; i < steps; ++i) {
+        const int step = i < steps / 2 ? i : steps - 1 - i;
+        view->centerOn(QPointF(all.left() + step * w / 4 + w / 2, all.center().y()));
+        Stopwatch watch;
+        image.fill(Qt::white);
+        view->viewport()->render(&image);
+        frames += watch.millis();
+        if (tiles != nullptr) {
+            watch.restart();
+            tiles->waitForIdle(); // as if the user paused for the tiles
+            catchUp += watch.millis();
+        }
+    }
+    report("tile_pan", label + ", per frame", frames / steps, "ms");
+    if (tiles != nullptr) {
+        report("tile_pan", label + ", painting requested tiles per frame", catchUp / steps, "ms");
+        report("tile_pan", label + ", cached", static_cast<double>(tiles->cachedBytes()) / (1 << 20), "MiB");
+    }
+}
+
+static void bench_tile_pan() {
+    CanvasWidget canvas;
+    QGraphicsView *view = canvas.findChild<QGraphicsView *>();
+    view->setFrameShape(QFrame::NoFrame);
+    view->setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+    view->setVerticalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+    canvas.resize(800, 600);
+    canvas.grab(); // lays the viewport out at 800 x 600
+    QtInterpreter interp;
+    QObject::connect(&interp, &QtInterpreter::drawGraphics, &canvas, &CanvasWidget::addGraphics);
+    interp.parseAndEvaluate(QString::fromStdString(scatter_program(1000000)));
+    QGraphicsScene *scene = canvas.findChild<QGraphicsScene *>();
+    TileRenderer *tiles = canvas.tileRenderer();
+    DisplayListItem *item = qgraphicsitem_cast<DisplayListItem *>(scene->items().value(0));
+    if (item == nullptr) {
+        return;
+    }
+    report("tile_pan", "worker threads", tiles->threads(), "");
+
+    // 1M lines over 10,000 units: 0.08x shows it all, 1x a 12th of it across
+    for (const qreal zoom: {0.08, 0.25, 1.0}) {
+        const std::string at = "1M lines at " + std::to_string(zoom).substr(0, 4) + "x";
+        item->setTileRenderer(nullptr);
+        pan(view, nullptr, zoom, at + ", painted directly");
+        item->setTileRenderer(tiles);
+        pan(view, tiles, zoom, at + ", tiles, first pass");
+        pan(view, tiles, zoom, at + ", tiles, cached");
+    }
+}
+
+static const NamedBenchmark benchmarks[] = {
+    {"scene_insert", "eval and scene insertion of 200k lines, one item at a time vs in one batch", &bench_scene_insert},
+    {"packed_item", "render time and scene memory of 200k lines, an item per primitive vs one packed item", &bench_packed_item},
+    {"viewport", "frame time rendering 1M lines packed in one item at zoom levels from 1x to 256x, and itemAt", &bench_viewport},
+    {"level_of_detail", "zoomed out frame time over 125k to 2M scattered lines, every draw painted vs LOD", &bench_level_of_detail},
+    {"tile_pan", "frame time panning over 1M lines, painted directly vs from tiles rasterized by a worker pool", &bench_tile_pan},
+};
+
+int main(int argc, char *argv[]) {
+    QApplication app(argc, argv);
+    return run_benchmarks(benchmarks, sizeof(benchmarks) / sizeof(benchmarks[0]), argc, argv);
+}
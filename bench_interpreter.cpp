@@ -0,0 +1,976 @@
+// Benchmarks for the postlisp interpreter core.
+// Usage: bench_interpreter [--list | <benchmark>...]
+#include "bench_util.hpp"
+
+#include <cstddef>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "expression.hpp"
+#include "geometry_transform.hpp"
+#include "interpreter.hpp"
+#include "interpreter_semantic_error.hpp"
+#include "level_of_detail.hpp"
+#include "spatial_index.hpp"
+#include "tokenizer.hpp"
+#include "test_config.hpp"
+
+static std::string read_file(const std::string &path) {
+    std::ifstream in(path);
+    std::ostringstream text;
+    text << in.rdbuf();
+    return text.str();
+}
+
+// tests/test_airplane.slp with its drawing section repeated 'copies' times.
+// The color defines stay in front, once, since symbols cannot be redefined.
+static std::string airplane_program(std::size_t copies) {
+    const std::string text = read_file(TEST_FILE_DIR + "/test_airplane.slp");
+    const std::string last_define = "(b 235 define)";
+    const std::size_t body_begin = text.find(last_define) + last_define.size();
+    const std::size_t body_end = text.rfind("begin");
+
+    std::string program = text.substr(0, body_begin);
+    const std::string body = text.substr(body_begin, body_end - body_begin);
+    program.reserve(program.size() + body.size() * copies + 8);
+    for (std::size_t i = 0; i < copies; ++i) {
+        program += body;
+    }
+    program += "begin)";
+    return program;
+}
+
+// Parse and evaluate 'program' once, reporting both phases
+static void time_program(const std::string &bench, const std::string &program) {
+    Interpreter interp;
+    std::istringstream in(program);
+
+    Stopwatch watch;
+    if (!interp.parse(in)) {
+        std::cerr << bench << ": parse error" << std::endl;
+        return;
+    }
+    report(bench, "parse", watch.millis(), "ms");
+
+    watch.restart();
+    interp.eval();
+    report(bench, "eval", watch.millis(), "ms");
+}
+
+// ---------------------------------------------------------------------------
+// atom_layout: bytes per AST node and deep copy cost
+// ---------------------------------------------------------------------------
+
+// Replica of the original Atom layout, which carried every payload at once
+namespace legacy {
+    struct Value {
+        Boolean bool_value;
+        Number num_value;
+        Symbol sym_value;
+
+        Point point_value;
+        Line line_value;
+        Arc arc_value;
+        Rect rect_value;
+        FillRect fill_rect_value;
+        Ellipse ellipse_value;
+    };
+
+    struct Atom {
+        Type type;
+        Value value;
+    };
+
+    struct Expression {
+        Atom head;
+        std::vector<Expression> tail;
+    };
+}
+
+// Build a list node with 'leaves' numeric children and report the heap bytes
+// per node it occupies and the time to deep copy it.
+template<typename Node>
+static void measure_numeric_tree(const std::string &label, std::size_t leaves) {
+    const AllocStats before = alloc_stats();
+    Node *root = new Node();
+    root->tail.resize(leaves);
+    for (std::size_t i = 0; i < leaves; ++i) {
+        root->tail[i].head.type = NumberType;
+        root->tail[i].head.value.num_value = static_cast<double>(i);
+    }
+    const AllocStats after = alloc_stats();
+
+    const double nodes = static_cast<double>(leaves + 1);
+    report("atom_layout", label + " heap bytes per node",
+           static_cast<double>(after.live_bytes - before.live_bytes) / nodes, "B");
+
+    Stopwatch watch;
+    Node copy(*root);
+    report("atom_layout", label + " deep copy", watch.millis(), "ms");
+
+    delete root;
+}
+
+static void bench_atom_layout() {
+    const std::size_t leaves = 1000000;
+
+    report("atom_layout", "legacy sizeof(Atom)", sizeof(legacy::Atom), "B");
+    report("atom_layout", "compact sizeof(Atom)", sizeof(Atom), "B");
+    report("atom_layout", "legacy sizeof(Expression)", sizeof(legacy::Expression), "B");
+    report("atom_layout", "compact sizeof(Expression)", sizeof(Expression), "B");
+
+    measure_numeric_tree<legacy::Expression>("legacy", leaves);
+    measure_numeric_tree<Expression>("compact", leaves);
+}
+
+// ---------------------------------------------------------------------------
+// airplane_eval: symbol-heavy drawing script scaled up 10,000x
+// ---------------------------------------------------------------------------
+
+static void bench_airplane_eval() {
+    const std::string program = airplane_program(10000);
+    report("airplane_eval", "program size", program.size() / 1e6, "MB");
+    time_program("airplane_eval", program);
+}
+
+// ---------------------------------------------------------------------------
+// tokenize: stream tokenizer vs buffer tokenizer throughput
+// ---------------------------------------------------------------------------
+
+static void bench_tokenize() {
+    const std::string program = airplane_program(10000);
+    const double megabytes = program.size() / 1e6;
+    report("tokenize", "program size", megabytes, "MB");
+
+    std::istringstream in(program);
+    Stopwatch watch;
+    const TokenSequenceType stream_tokens = tokenize(in);
+    report("tokenize", "istream throughput", megabytes / watch.seconds(), "MB/s");
+
+    watch.restart();
+    TokenBuffer buffer_tokens = tokenize(program);
+    report("tokenize", "buffer throughput", megabytes / watch.seconds(), "MB/s");
+
+    // again into the same TokenBuffer, as a REPL reusing its buffer would
+    watch.restart();
+    tokenize(program.data(), program.size(), buffer_tokens);
+    report("tokenize", "buffer throughput (reused)", megabytes / watch.seconds(), "MB/s");
+
+    if (stream_tokens.size() != buffer_tokens.size()) {
+        std::cerr << "tokenize: token counts differ" << std::endl;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// parse_nested: single-pass parser vs the original token-list parser
+// ---------------------------------------------------------------------------
+
+// Replica of the original parser: tokenize to a deque of strings, pre-scan
+// it for paren balance, then parse recursively copying every child
+namespace legacy {
+    static std::size_t count(const TokenSequenceType &tokens, const std::string &query) {
+        std::size_t cnt = 0;
+        for (const auto &t: tokens) {
+            if (t == query) {
+                ++cnt;
+            }
+        }
+        return cnt;
+    }
+
+    static bool parse_expression(TokenSequenceType::const_iterator &it, const TokenSequenceType::const_iterator &end,
+                                 ::Expression &exp) {
+        if (it == end) {
+            return false;
+        }
+        if (*it == "(") {
+            ++it;
+            std::vector<::Expression> items;
+            while (it != end && *it != ")") {
+                ::Expression sub;
+                if (!parse_expression(it, end, sub)) {
+                    return false;
+                }
+                items.push_back(sub);
+            }
+            if (it == end) {
+                return false;
+            }
+            ++it;
+            if (items.empty()) {
+                return false;
+            }
+            if (items.size() == 1) {
+                exp = items[0];
+                return true;
+            }
+            const ::Expression &last = items.back();
+            if (last.headType() != SymbolType || !last.tailIsEmpty()) {
+                return false;
+            }
+            exp = ::Expression(last.getHead());
+            exp.getTail().assign(items.begin(), items.end() - 1);
+            return true;
+        }
+        if (*it == ")") {
+            return false;
+        }
+        ::Atom atom;
+        if (!token_to_atom(*it, atom)) {
+            return false;
+        }
+        exp = ::Expression(atom);
+        ++it;
+        return true;
+    }
+
+    static bool parse(std::istream &in, ::Expression &ast) {
+        const TokenSequenceType tokens = tokenize(in);
+        if (tokens.empty() || count(tokens, "(") != count(tokens, ")")) {
+            return false;
+        }
+        auto it = tokens.cbegin();
+        ::Expression root;
+        if (!parse_expression(it, tokens.cend(), root) || it != tokens.cend()) {
+            return false;
+        }
+        ast = root;
+        return true;
+    }
+}
+
+// A complete binary tree of '+' over numeric leaves, 'depth' levels deep
+static void append_nested_sum(std::string &out, int depth) {
+    if (depth == 0) {
+        out += "1.25";
+        return;
+    }
+    out += "(";
+    append_nested_sum(out, depth - 1);
+    out += " ";
+    append_nested_sum(out, depth - 1);
+    out += " +)";
+}
+
+// Nested sums under one begin, about 'megabytes' MB of source
+static std::string nested_program(double megabytes) {
+    std::string tree;
+    append_nested_sum(tree, 12);
+    tree += "\n";
+
+    std::string program = "(\n";
+    while (program.size() + tree.size() < megabytes * 1e6) {
+        program += tree;
+    }
+    program += "begin)\n";
+    return program;
+}
+
+static void bench_parse_nested() {
+    const std::string program = nested_program(50);
+    report("parse_nested", "program size", program.size() / 1e6, "MB");
+
+    {
+        Expression ast;
+        std::istringstream in(program);
+        reset_peak_bytes();
+        const std::size_t base = alloc_stats().live_bytes;
+        Stopwatch watch;
+        if (!legacy::parse(in, ast)) {
+            std::cerr << "parse_nested: legacy parse error" << std::endl;
+        }
+        report("parse_nested", "legacy parse", watch.millis(), "ms");
+        report("parse_nested", "legacy peak heap", (alloc_stats().peak_bytes - base) / 1e6, "MB");
+    }
+
+    {
+        Interpreter interp;
+        reset_peak_bytes();
+        const std::size_t base = alloc_stats().live_bytes;
+        Stopwatch watch;
+        if (!interp.parse(program.data(), program.size())) {
+            std::cerr << "parse_nested: parse error at byte " << interp.parseErrorOffset() << std::endl;
+        }
+        report("parse_nested", "single-pass parse", watch.millis(), "ms");
+        report("parse_nested", "single-pass peak heap", (alloc_stats().peak_bytes - base) / 1e6, "MB");
+    }
+}
+
+// ---------------------------------------------------------------------------
+// vm: tree-walking evaluator vs bytecode VM
+// ---------------------------------------------------------------------------
+
+// Arithmetic, comparisons and conditionals over two globals, repeated
+static std::string arithmetic_program(std::size_t copies) {
+    const std::string body = "(((x 2 *) (y 3 /) +) ((x y <) (x y -) ((x y *) sqrt) if) *)\n";
+    std::string program = "((x 1.5 define) (y 2.5 define)\n";
+    program.reserve(program.size() + body.size() * copies + 8);
+    for (std::size_t i = 0; i < copies; ++i) {
+        program += body;
+    }
+    program += "begin)";
+    return program;
+}
+
+// Eval 'program' with both evaluators, each in a fresh interpreter
+static void compare_evaluators(const std::string &bench, const std::string &program) {
+    Interpreter tree;
+    tree.parse(program.data(), program.size());
+    Stopwatch watch;
+    tree.eval();
+    report(bench, "tree-walk eval", watch.millis(), "ms");
+
+    Interpreter vm;
+    vm.setEvalMode(BytecodeEval);
+    vm.parse(program.data(), program.size());
+    watch.restart();
+    vm.compile();
+    report(bench, "vm compile", watch.millis(), "ms");
+    watch.restart();
+    vm.eval();
+    report(bench, "vm eval", watch.millis(), "ms");
+}
+
+static void bench_vm() {
+    compare_evaluators("vm arithmetic", arithmetic_program(200000));
+    compare_evaluators("vm geometry", airplane_program(10000));
+}
+
+// ---------------------------------------------------------------------------
+// call_alloc: heap allocations per builtin call
+// ---------------------------------------------------------------------------
+
+static void count_call_allocations(const std::string &label, EvalMode mode) {
+    const std::size_t calls = 10000000;
+    const std::string program = "(1 2 +)";
+
+    Interpreter interp;
+    interp.setEvalMode(mode);
+    interp.parse(program.data(), program.size());
+    interp.eval(); // warm up the reusable stacks
+
+    const std::size_t before = alloc_stats().allocations;
+    Stopwatch watch;
+    for (std::size_t i = 0; i < calls; ++i) {
+        interp.eval();
+    }
+    const double elapsed = watch.seconds();
+    const std::size_t allocations = alloc_stats().allocations - before;
+
+    report("call_alloc", label + " allocations per call", static_cast<double>(allocations) / calls, "");
+    report("call_alloc", label + " time per call", elapsed / calls * 1e9, "ns");
+}
+
+static void bench_call_alloc() {
+    count_call_allocations("tree-walk", TreeWalkEval);
+    count_call_allocations("vm", BytecodeEval);
+}
+
+// ---------------------------------------------------------------------------
+// numeric_calls: argument checking cost in numeric builtins
+// ---------------------------------------------------------------------------
+
+static void bench_numeric_calls() {
+    const std::size_t runs = 2000000;
+    const std::string program =
+            "(((1.5 2.5 -) (3 4 /) (5 6 7 8 *) (1 2 3 4 5 6 7 8 +) +) ((2 3 <) (4 5 >=) and) (9 sqrt) begin)";
+
+    Interpreter interp;
+    interp.setEvalMode(BytecodeEval);
+    interp.parse(program.data(), program.size());
+    interp.eval();
+
+    Stopwatch watch;
+    for (std::size_t i = 0; i < runs; ++i) {
+        interp.eval();
+    }
+    report("numeric_calls", "time per builtin call", watch.seconds() / (runs * 10.0) * 1e9, "ns");
+}
+
+// ---------------------------------------------------------------------------
+// symbol_reads: reading bound geometric values, as tests/test_car.slp does
+// ---------------------------------------------------------------------------
+
+static void count_read_allocations(const std::string &label, EvalMode mode) {
+    const std::size_t runs = 200000;
+    const std::size_t reads_per_run = 20;
+    const std::string setup = "((front_wheel ((-50 10 point) (-50 0 point) (2 pi *) arc) define)"
+                              " (back_wheel ((50 10 point) (50 0 point) (2 pi *) arc) define) begin)";
+    std::string program = "(";
+    for (std::size_t i = 0; i < reads_per_run / 2; ++i) {
+        program += "front_wheel back_wheel ";
+    }
+    program += "begin)";
+
+    Interpreter interp;
+    interp.setEvalMode(mode);
+    interp.parse(setup.data(), setup.size());
+    interp.eval();
+    interp.parse(program.data(), program.size());
+    interp.eval(); // warm up the reusable stacks
+
+    const std::size_t before = alloc_stats().allocations;
+    Stopwatch watch;
+    for (std::size_t i = 0; i < runs; ++i) {
+        interp.eval();
+    }
+    const double elapsed = watch.seconds();
+    const std::size_t allocations = alloc_stats().allocations - before;
+
+    const double reads = static_cast<double>(runs * reads_per_run);
+    report("symbol_reads", label + " allocations per read", allocations / reads, "");
+    report("symbol_reads", label + " time per read", elapsed / reads * 1e9, "ns");
+}
+
+static void bench_symbol_reads() {
+    count_read_allocations("tree-walk", TreeWalkEval);
+    count_read_allocations("vm", BytecodeEval);
+}
+
+// ---------------------------------------------------------------------------
+// builtin_dispatch: environment reset and checked vs unchecked builtin calls
+// ---------------------------------------------------------------------------
+
+// ns per builtin call of 'program', after running 'setup' once
+static double time_per_call(const std::string &setup, const std::string &program, std::size_t calls_per_eval) {
+    const std::size_t runs = 2000000;
+    Interpreter interp;
+    interp.setEvalMode(BytecodeEval);
+    interp.parse(setup.data(), setup.size());
+    interp.eval();
+    interp.parse(program.data(), program.size());
+    interp.eval();
+
+    Stopwatch watch;
+    for (std::size_t i = 0; i < runs; ++i) {
+        interp.eval();
+    }
+    return watch.seconds() / (runs * static_cast<double>(calls_per_eval)) * 1e9;
+}
+
+static void bench_builtin_dispatch() {
+    const std::size_t resets = 1000000;
+    Environment env;
+    Stopwatch watch;
+    for (std::size_t i = 0; i < resets; ++i) {
+        env.reset();
+    }
+    report("builtin_dispatch", "Environment::reset()", watch.seconds() / resets * 1e9, "ns");
+
+    // literal arguments have types the compiler can prove; the same calls
+    // on a user-defined global cannot be proven and are checked at run time
+    const std::string setup = "(x 2 define)";
+    const std::string proven = "((2 1.5 -) (2 4 /) (2 7 8 *) (2 3 <) (2 sqrt) begin)";
+    const std::string unproven = "((x 1.5 -) (x 4 /) (x 7 8 *) (x 3 <) (x sqrt) begin)";
+    report("builtin_dispatch", "unchecked call (types proven)", time_per_call(setup, proven, 5), "ns");
+    report("builtin_dispatch", "checked call (types unknown)", time_per_call(setup, unproven, 5), "ns");
+}
+
+// ---------------------------------------------------------------------------
+// repl_recovery: recovering from an error in a session with many definitions
+// ---------------------------------------------------------------------------
+
+static void define_session(Interpreter &interp, std::size_t definitions) {
+    for (std::size_t i = 0; i < definitions; ++i) {
+        const std::string line = "(repl_var_" + std::to_string(i) + " " + std::to_string(i) + " define)";
+        interp.parse(line.data(), line.size());
+        interp.eval();
+    }
+}
+
+static void bench_repl_recovery() {
+    const std::size_t definitions = 10000;
+    const std::size_t errors = 20;
+
+    // a line that defines a symbol, then fails
+    const std::string failing = "((repl_partial 1 define) (1 True +) begin)";
+
+    // the old recovery: replace the interpreter, dropping every definition
+    double rebuild = 0;
+    for (std::size_t i = 0; i < errors; ++i) {
+        Interpreter interp;
+        define_session(interp, definitions);
+        Stopwatch watch;
+        interp = Interpreter();
+        rebuild += watch.seconds();
+    }
+    report("repl_recovery", "rebuild Interpreter (drops definitions)", rebuild / errors * 1e6, "us");
+
+    Interpreter interp;
+    define_session(interp, definitions);
+    interp.parse(failing.data(), failing.size());
+    double rollback = 0;
+    for (std::size_t i = 0; i < errors; ++i) {
+        const Interpreter::Checkpoint good = interp.checkpoint();
+        try {
+            interp.eval();
+        } catch (const InterpreterSemanticError &) {
+        }
+        Stopwatch watch;
+        interp.rollback(good);
+        rollback += watch.seconds();
+    }
+    report("repl_recovery", "roll back to last good line (keeps definitions)", rollback / errors * 1e6, "us");
+}
+
+// ---------------------------------------------------------------------------
+// fold: eval time before and after constant folding
+// ---------------------------------------------------------------------------
+
+// tests/test_car.slp with everything after the wheel defines repeated
+static std::string car_program(std::size_t copies) {
+    const std::string text = read_file(TEST_FILE_DIR + "/test_car.slp");
+    const std::size_t body_begin = text.find("(front_wheel back_wheel draw)");
+    const std::size_t body_end = text.rfind("begin");
+
+    std::string program = text.substr(0, body_begin);
+    const std::string body = text.substr(body_begin, body_end - body_begin);
+    program.reserve(program.size() + body.size() * copies + 8);
+    for (std::size_t i = 0; i < copies; ++i) {
+        program += body;
+    }
+    program += "begin)";
+    return program;
+}
+
+static void compare_folding(const std::string &bench, const std::string &program) {
+    Interpreter plain;
+    plain.parse(program.data(), program.size());
+    Stopwatch watch;
+    plain.eval();
+    report(bench, "eval", watch.millis(), "ms");
+
+    Interpreter folded;
+    folded.parse(program.data(), program.size());
+    watch.restart();
+    const FoldStats stats = folded.optimize();
+    report(bench, "fold", watch.millis(), "ms");
+    report(bench, "calls folded", static_cast<double>(stats.folded), "");
+    report(bench, "branches pruned", static_cast<double>(stats.pruned), "");
+    watch.restart();
+    folded.eval();
+    report(bench, "eval after fold", watch.millis(), "ms");
+}
+
+static void bench_fold() {
+    compare_folding("fold car", car_program(20000));
+    compare_folding("fold airplane", airplane_program(10000));
+}
+
+// ---------------------------------------------------------------------------
+// parse_arena: AST tails in a per-parse arena vs one heap block per list
+// ---------------------------------------------------------------------------
+
+// Reparse 'program' and report steady-state heap allocations and time per parse
+static void time_reparse(const std::string &label, const std::string &program, std::size_t parses) {
+    Interpreter interp;
+    interp.parse(program.data(), program.size());
+    interp.parse(program.data(), program.size()); // both arenas warm
+
+    const AllocStats before = alloc_stats();
+    Stopwatch watch;
+    for (std::size_t i = 0; i < parses; ++i) {
+        interp.parse(program.data(), program.size());
+    }
+    const double elapsed = watch.seconds();
+    const AllocStats after = alloc_stats();
+    report("parse_arena", label + " allocations per parse",
+           static_cast<double>(after.allocations - before.allocations) / parses, "");
+    report("parse_arena", label + " time per parse", elapsed / parses * 1e6, "us");
+}
+
+static void bench_parse_arena() {
+    const std::string program = airplane_program(10000);
+    Interpreter interp;
+    interp.parse(program.data(), program.size());
+    report("parse_arena", "arena bytes of the scaled airplane AST", interp.astBytes() / 1e6, "MB");
+
+    // a heap-backed copy has the layout every parse used to build
+    AllocStats before = alloc_stats();
+    Expression *heap = new Expression(interp.getAst());
+    report("parse_arena", "heap blocks of the same AST",
+           static_cast<double>(alloc_stats().allocations - before.allocations - 1), "");
+    Stopwatch watch;
+    delete heap;
+    report("parse_arena", "free the heap-backed AST", watch.millis(), "ms");
+
+    // the next parse releases the arena-backed one
+    const std::string line = "(1 2 +)";
+    watch.restart();
+    interp.parse(line.data(), line.size());
+    report("parse_arena", "release the arena AST (parse a one-line program)", watch.millis(), "ms");
+
+    time_reparse("airplane x100", airplane_program(100), 200);
+    time_reparse("one-line program", line, 1000000);
+}
+
+// ---------------------------------------------------------------------------
+// flat_ast: walking nested Expressions vs the flat, index-based AST
+// ---------------------------------------------------------------------------
+
+// Best of three evals of the parsed program in 'mode', with the cache
+// misses of that run; each run starts from the same environment
+static void time_walk(const std::string &bench, Interpreter &interp, EvalMode mode, const std::string &label,
+                      CacheMisses &misses) {
+    const Interpreter::Checkpoint start = interp.checkpoint();
+    interp.setEvalMode(mode);
+    double best = 0;
+    std::uint64_t bestMisses = 0;
+    for (int run = 0; run < 3; ++run) {
+        interp.rollback(start);
+        misses.start();
+        Stopwatch watch;
+        interp.eval();
+        const double elapsed = watch.millis();
+        const std::uint64_t count = misses.stop();
+        if (run == 0 || elapsed < best) {
+            best = elapsed;
+            bestMisses = count;
+        }
+    }
+    interp.rollback(start);
+    report(bench, label + " eval", best, "ms");
+    if (misses.available()) {
+        report(bench, label + " cache misses", static_cast<double>(bestMisses), "");
+    }
+}
+
+static void compare_flat(const std::string &bench, const std::string &program) {
+    Interpreter interp;
+    interp.parse(program.data(), program.size());
+    Stopwatch watch;
+    interp.flatten();
+    report(bench, "flatten", watch.millis(), "ms");
+    const FlatAst &flat = interp.getFlatAst();
+    report(bench, "nodes", static_cast<double>(flat.size()), "");
+    report(bench, "Expression bytes per node", static_cast<double>(interp.astBytes()) / flat.size(), "B");
+    report(bench, "flat bytes per node", static_cast<double>(flat.bytes()) / flat.size(), "B");
+
+    CacheMisses misses;
+    if (!misses.available()) {
+        std::cout << bench << ": cache misses unavailable, no hardware counters" << std::endl;
+    }
+    time_walk(bench, interp, TreeWalkEval, "tree", misses);
+    time_walk(bench, interp, FlatEval, "flat", misses);
+}
+
+static void bench_flat_ast() {
+    compare_flat("flat_ast airplane", airplane_program(10000));
+    compare_flat("flat_ast car", car_program(20000));
+}
+
+// ---------------------------------------------------------------------------
+// numeric_parse: token_to_atom with a stream per token vs the fast path
+// ---------------------------------------------------------------------------
+
+namespace legacy {
+    // The original numeric test in token_to_atom
+    static bool stream_number(const std::string &token, double &value) {
+        std::istringstream iss(token);
+        iss.setf(std::ios::fmtflags(0), std::ios::basefield);
+        return (iss >> value) && iss.rdbuf()->in_avail() == 0;
+    }
+}
+
+static void bench_numeric_parse() {
+    // the atom tokens of the scaled car program, mostly numbers
+    const std::string program = car_program(2000);
+    const TokenBuffer buffer = tokenize(program);
+    std::vector<std::string> tokens;
+    for (const Token &token: buffer) {
+        if (token.kind == AtomToken) {
+            tokens.push_back(token_text(program.data(), token));
+        }
+    }
+    report("numeric_parse", "atom tokens", static_cast<double>(tokens.size()), "");
+
+    std::size_t numbers = 0;
+    AllocStats before = alloc_stats();
+    Stopwatch watch;
+    for (const std::string &token: tokens) {
+        double value;
+        numbers += legacy::stream_number(token, value);
+    }
+    double elapsed = watch.seconds();
+    report("numeric_parse", "numeric tokens", static_cast<double>(numbers), "");
+    report("numeric_parse", "stream per token", elapsed / tokens.size() * 1e9, "ns/token");
+    report("numeric_parse", "stream allocations per token",
+           static_cast<double>(alloc_stats().allocations - before.allocations) / tokens.size(), "");
+
+    before = alloc_stats();
+    watch.restart();
+    for (const std::string &token: tokens) {
+        Atom atom;
+        token_to_atom(token, atom);
+    }
+    elapsed = watch.seconds();
+    report("numeric_parse", "token_to_atom", elapsed / tokens.size() * 1e9, "ns/token");
+    report("numeric_parse", "token_to_atom allocations per token",
+           static_cast<double>(alloc_stats().allocations - before.allocations) / tokens.size(), "");
+
+    const std::string car = car_program(20000);
+    Interpreter interp;
+    watch.restart();
+    interp.parse(car.data(), car.size());
+    report("numeric_parse", "parse car x20000", watch.millis(), "ms");
+}
+
+// ---------------------------------------------------------------------------
+// batch_polyline: a 100k-vertex path as per-segment lines vs one polyline
+// ---------------------------------------------------------------------------
+
+// A zigzag through 'vertices' points, drawn either as one line per segment
+// from point calls or as a single polyline call
+static std::string zigzag_program(std::size_t vertices, bool batched) {
+    std::ostringstream program;
+    program << "(";
+    if (batched) {
+        program << "(";
+        for (std::size_t i = 0; i < vertices; ++i) {
+            program << i << " " << (i % 2) * 10 << " ";
+        }
+        program << "polyline) draw";
+    } else {
+        for (std::size_t i = 0; i + 1 < vertices; ++i) {
+            program << "((" << i << " " << (i % 2) * 10 << " point) (" << i + 1 << " " << ((i + 1) % 2) * 10
+                    << " point) line) ";
+        }
+        program << "draw";
+    }
+    program << ")";
+    return program.str();
+}
+
+static void time_zigzag(const std::string &label, const std::string &program) {
+    Interpreter interp;
+    Stopwatch watch;
+    interp.parse(program.data(), program.size());
+    interp.eval();
+    report("batch_polyline", label + " parse and eval", watch.millis(), "ms");
+    report("batch_polyline", label + " pending draws", static_cast<double>(interp.getPendingDraws().size()), "");
+}
+
+static void bench_batch_polyline() {
+    const std::size_t vertices = 100000;
+    time_zigzag("line per segment", zigzag_program(vertices, false));
+    time_zigzag("one polyline", zigzag_program(vertices, true));
+}
+
+// ---------------------------------------------------------------------------
+// transform: points per second of the affine kernels
+// ---------------------------------------------------------------------------
+
+static void bench_transform() {
+    const std::size_t count = 1 << 20; // 16 MB of coordinates, past the caches
+    const std::size_t rounds = 50;
+    std::vector<Number> xs(count), ys(count), out_xs(count), out_ys(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        xs[i] = static_cast<double>(i % 1000);
+        ys[i] = static_cast<double>(i / 1000);
+    }
+    const Affine m = rotation(0.3);
+
+    const TransformKernel kernels[] = {ScalarKernel, Sse2Kernel, Avx2Kernel};
+    const char *const names[] = {"scalar", "sse2", "avx2"};
+    for (const TransformKernel kernel: kernels) {
+        if (!kernel_available(kernel)) {
+            std::cout << "transform: " << names[kernel] << " unavailable on this CPU" << std::endl;
+            continue;
+        }
+        transform_points(kernel, m, xs.data(), ys.data(), out_xs.data(), out_ys.data(), count); // warm
+        Stopwatch watch;
+        for (std::size_t r = 0; r < rounds; ++r) {
+            transform_points(kernel, m, xs.data(), ys.data(), out_xs.data(), out_ys.data(), count);
+        }
+        report("transform", std::string(names[kernel]) + " throughput", count * rounds / watch.seconds() / 1e6,
+               "Mpoints/s");
+    }
+
+    // the same through the interpreter, one rotate of a 100k-vertex batch
+    std::ostringstream program;
+    program << "(((";
+    for (std::size_t i = 0; i < 100000; ++i) {
+        program << i % 1000 << " " << i / 1000 << " ";
+    }
+    program << "points) 0.3 rotate) draw)";
+    const std::string text = program.str();
+    Interpreter interp;
+    interp.parse(text.data(), text.size());
+    Stopwatch watch;
+    interp.eval();
+    report("transform", "eval of a 100k-point batch and its rotation", watch.millis(), "ms");
+}
+
+// ---------------------------------------------------------------------------
+// display_list: bytes per drawn primitive, Expressions vs the display list
+// ---------------------------------------------------------------------------
+
+static void bench_display_list() {
+    const std::string program = airplane_program(1000);
+    Interpreter interp;
+    interp.parse(program.data(), program.size());
+    interp.eval();
+    const DisplayList &list = interp.getDisplayList();
+    const double draws = static_cast<double>(list.size());
+    report("display_list", "draws", draws, "");
+    report("display_list", "runs", static_cast<double>(list.runs().size()), "");
+
+    // the heap a std::vector<Expression> of the same draws occupies
+    AllocStats before = alloc_stats();
+    Stopwatch watch;
+    std::vector<Expression> *expressions = new std::vector<Expression>(list.expressions());
+    const double build = watch.millis();
+    report("display_list", "Expression bytes per draw",
+           static_cast<double>(alloc_stats().live_bytes - before.live_bytes) / draws, "B");
+    report("display_list", "display list bytes per draw", static_cast<double>(list.bytes()) / draws, "B");
+    report("display_list", "build the Expression view", build, "ms");
+    delete expressions;
+}
+
+// ---------------------------------------------------------------------------
+// spatial_index: viewport queries and hit tests over 1M lines
+// ---------------------------------------------------------------------------
+
+// 'count' short lines scattered over a 10,000 x 10,000 square by a fixed
+// linear congruential walk
+static void scatter_lines(DisplayList &list, std::size_t count) {
+    std::uint32_t seed = 1;
+    const auto next = [&seed]() {
+        seed = seed * 1664525u + 1013904223u;
+        return static_cast<double>(seed >> 8) / (1u << 24);
+    };
+    Atom atom{LineType, Value()};
+    for (std::size_t i = 0; i < count; ++i) {
+        const Point a{next() * 10000, next() * 10000};
+        atom.value.line_value = Line{a, Point{a.x + next() * 20 - 10, a.y + next() * 20 - 10}};
+        list.add(atom);
+    }
+}
+
+static void bench_spatial_index() {
+    DisplayList list;
+    scatter_lines(list, 1000000);
+
+    SpatialIndex index;
+    Stopwatch watch;
+    index.build(list, 2);
+    report("spatial_index", "build over 1M lines", watch.millis(), "ms");
+    report("spatial_index", "index bytes per line", static_cast<double>(index.bytes()) / list.size(), "B");
+
+    // zoom in by 4x a step, panning across the drawing at each zoom
+    std::vector<SpatialIndex::Draw> found;
+    for (double view = 10000; view >= 10000 / 256.; view /= 4) {
+        const int pans = 20;
+        std::size_t draws = 0;
+        watch.restart();
+        for (int p = 0; p < pans; ++p) {
+            const double x = (10000 - view) * p / pans, y = (10000 - view) * (pans - p) / pans;
+            index.query(Box{x, y, x + view, y + view}, found);
+            draws += found.size();
+        }
+        const std::string label = "view " + std::to_string(static_cast<int>(view)) + " wide";
+        report("spatial_index", label + " query", watch.millis() / pans, "ms");
+        report("spatial_index", label + " draws per query", static_cast<double>(draws) / pans, "");
+    }
+
+    // what painting without an index does: test every line against the view
+    watch.restart();
+    std::size_t scanned = 0;
+    const Box view{5000, 5000, 5000 + 10000 / 256., 5000 + 10000 / 256.};
+    for (SpatialIndex::Draw d = 0; d < index.size(); ++d) {
+        scanned += index.bounds(d).intersects(view);
+    }
+    report("spatial_index", "linear scan of a 39 wide view", watch.millis(), "ms");
+
+    const int picks = 10000;
+    std::size_t hits = 0;
+    watch.restart();
+    for (int i = 0; i < picks; ++i) {
+        index.hit_test(Point{i % 100 * 100., i / 100 * 100.}, 2, found);
+        hits += found.size();
+    }
+    report("spatial_index", "hit test", watch.seconds() / picks * 1e6, "us");
+    report("spatial_index", "hits per hit test", static_cast<double>(hits) / picks, "");
+    if (scanned == static_cast<std::size_t>(-1)) {
+        std::cout << scanned << std::endl; // keep the scan
+    }
+}
+
+// ---------------------------------------------------------------------------
+// level_of_detail: work per zoomed out frame as the line count grows
+// ---------------------------------------------------------------------------
+
+static void bench_level_of_detail() {
+    // an 800 pixel wide view of the whole 10,000 wide drawing, then of a
+    // quarter of it
+    for (std::size_t count = 125000; count <= 4000000; count *= 4) {
+        DisplayList list;
+        scatter_lines(list, count);
+        SpatialIndex index;
+        index.build(list, 2);
+        DensityPyramid pyramid;
+        Stopwatch watch;
+        pyramid.build(list, index, 4);
+        const std::string lines = std::to_string(count / 1000) + "k lines";
+        report("level_of_detail", lines + " pyramid build", watch.millis(), "ms");
+        report("level_of_detail", lines + " pyramid bytes per line", static_cast<double>(pyramid.bytes()) / count, "B");
+
+        std::vector<SpatialIndex::Draw> draws;
+        std::vector<std::uint32_t> image;
+        for (double view = 10000; view >= 2500; view /= 4) {
+            const Box area{0, 0, view, view};
+            const std::size_t level = pyramid.level_for(view / 800);
+            const int frames = 10;
+            std::size_t painted = 0;
+            watch.restart();
+            for (int f = 0; f < frames; ++f) {
+                std::size_t cx0, cy0, cx1, cy1;
+                if (level < pyramid.levels() && pyramid.cells_of(level, area, cx0, cy0, cx1, cy1)) {
+                    const std::size_t width = cx1 - cx0 + 1;
+                    image.resize(width * (cy1 - cy0 + 1));
+                    for (std::size_t cy = cy0; cy <= cy1; ++cy) {
+                        pyramid.argb(level, cy, cx0, cx1, &image[(cy - cy0) * width]);
+                    }
+                    pyramid.large_draws(level, area, draws);
+                } else {
+                    index.query(area, draws);
+                }
+                painted += draws.size();
+            }
+            const std::string label = lines + ", view " + std::to_string(static_cast<int>(view)) + " wide";
+            report("level_of_detail", label + " density frame", watch.millis() / frames, "ms");
+            report("level_of_detail", label + " draws painted whole", static_cast<double>(painted) / frames, "");
+            index.query(area, draws);
+            report("level_of_detail", label + " draws painted without LOD", static_cast<double>(draws.size()), "");
+        }
+    }
+}
+
+static const NamedBenchmark benchmarks[] = {
+    {"atom_layout", "bytes per AST node for the compact Atom vs the legacy layout", &bench_atom_layout},
+    {"airplane_eval", "parse and eval tests/test_airplane.slp scaled up 10,000x", &bench_airplane_eval},
+    {"tokenize", "MB/s of the istream and buffer tokenizers on the scaled airplane program", &bench_tokenize},
+    {"parse_nested", "parse time and peak heap on a 50 MB nested program, legacy vs single-pass", &bench_parse_nested},
+    {"vm", "eval time of the tree-walker vs the bytecode VM on arithmetic and geometry programs", &bench_vm},
+    {"call_alloc", "heap allocations and time per call evaluating (1 2 +) 10M times", &bench_call_alloc},
+    {"numeric_calls", "time per call of numeric builtins, where argument checks dominate", &bench_numeric_calls},
+    {"builtin_dispatch", "Environment::reset() and VM builtin calls with and without signature checks", &bench_builtin_dispatch},
+    {"repl_recovery", "REPL error recovery after 10,000 definitions: rebuild vs checkpoint rollback", &bench_repl_recovery},
+    {"symbol_reads", "allocations and time per read of a bound Arc, as in tests/test_car.slp", &bench_symbol_reads},
+    {"fold", "eval time of the scaled car and airplane programs before and after constant folding", &bench_fold},
+    {"parse_arena", "heap allocations and release time of the AST, one heap block per list vs a per-parse arena", &bench_parse_arena},
+    {"flat_ast", "eval time and cache misses walking nested Expressions vs the flat AST", &bench_flat_ast},
+    {"numeric_parse", "ns and allocations per token of token_to_atom, stream per token vs the fast numeric path", &bench_numeric_parse},
+    {"batch_polyline", "parse and eval of a 100k-vertex path, one line per segment vs one polyline call", &bench_batch_polyline},
+    {"transform", "points per second of the scalar, SSE2 and AVX2 affine transform kernels", &bench_transform},
+    {"display_list", "bytes per drawn primitive as Expressions vs the per-kind display list", &bench_display_list},
+    {"spatial_index", "viewport query and hit test times over 1M lines at zoom levels from 1x to 256x", &bench_spatial_index},
+    {"level_of_detail", "density pyramid build, and work per zoomed out frame from 125k to 2M lines", &bench_level_of_detail},
+};
+
+int main(int argc, char *argv[]) {
+    return run_benchmarks(benchmarks, sizeof(benchmarks) / sizeof(benchmarks[0]), argc, argv);
+}
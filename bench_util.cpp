@@ -0,0 +1,153 @@
+#include "bench_util.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Every allocation carries a small header holding its size so that frees can
+// be subtracted from the live byte count.
+static const std::size_t header_size = 16;
+
+static AllocStats stats = {0, 0, 0, 0};
+
+void *operator new(std::size_t size) {
+    void *block = std::malloc(size + header_size);
+    if (!block) {
+        throw std::bad_alloc();
+    }
+    *static_cast<std::size_t *>(block) = size;
+    ++stats.allocations;
+    stats.live_bytes += size;
+    stats.total_bytes += size;
+    if (stats.live_bytes > stats.peak_bytes) {
+        stats.peak_bytes = stats.live_bytes;
+    }
+    return static_cast<char *>(block) + header_size;
+}
+
+void *operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void *ptr) noexcept {
+    if (!ptr) {
+        return;
+    }
+    void *block = static_cast<char *>(ptr) - header_size;
+    stats.live_bytes -= *static_cast<std::size_t *>(block);
+    std::free(block);
+}
+
+void operator delete[](void *ptr) noexcept {
+    operator delete(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept {
+    operator delete(ptr);
+}
+
+void operator delete[](void *ptr, std::size_t) noexcept {
+    operator delete(ptr);
+}
+
+AllocStats alloc_stats() {
+    return stats;
+}
+
+void reset_peak_bytes() {
+    stats.peak_bytes = stats.live_bytes;
+}
+
+#if defined(__linux__)
+CacheMisses::CacheMisses() {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+}
+
+CacheMisses::~CacheMisses() {
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+void CacheMisses::start() {
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+std::uint64_t CacheMisses::stop() {
+    std::uint64_t count = 0;
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &count, sizeof(count)) != static_cast<ssize_t>(sizeof(count))) {
+            count = 0;
+        }
+    }
+    return count;
+}
+#else
+CacheMisses::CacheMisses() : fd(-1) {
+}
+
+CacheMisses::~CacheMisses() {
+}
+
+void CacheMisses::start() {
+}
+
+std::uint64_t CacheMisses::stop() {
+    return 0;
+}
+#endif
+
+void report(const std::string &bench, const std::string &label, double value, const std::string &unit) {
+    std::cout << bench << ": " << label << " = " << value << " " << unit << std::endl;
+}
+
+int run_benchmarks(const NamedBenchmark *table, std::size_t count, int argc, char *argv[]) {
+    if (argc == 2 && std::string(argv[1]) == "--list") {
+        for (std::size_t i = 0; i < count; ++i) {
+            std::cout << table[i].name << "\t" << table[i].description << std::endl;
+        }
+        return EXIT_SUCCESS;
+    }
+
+    for (int a = 1; a < argc; ++a) {
+        bool known = false;
+        for (std::size_t i = 0; i < count && !known; ++i) {
+            known = table[i].name == std::string(argv[a]);
+        }
+        if (!known) {
+            std::cerr << "Error: unknown benchmark " << argv[a] << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    for (std::size_t i = 0; i < count; ++i) {
+        bool selected = argc == 1;
+        for (int a = 1; a < argc && !selected; ++a) {
+            selected = table[i].name == std::string(argv[a]);
+        }
+        if (selected) {
+            table[i].run();
+        }
+    }
+    return EXIT_SUCCESS;
+}
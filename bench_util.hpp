@@ -0,0 +1,81 @@
+#ifndef BENCH_UTIL_HPP
+#define BENCH_UTIL_HPP
+
+// system includes
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Wall clock stopwatch, started on construction
+class Stopwatch {
+public:
+    Stopwatch() : start(Clock::now()) {
+    }
+
+    void restart() { start = Clock::now(); }
+
+    double seconds() const {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    double millis() const { return seconds() * 1e3; }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point start;
+};
+
+// Heap accounting collected by the replacement global operator new/delete
+// in bench_util.cpp. Counters are process-wide and not thread-safe.
+struct AllocStats {
+    std::size_t allocations;
+    std::size_t live_bytes;
+    std::size_t total_bytes;
+    std::size_t peak_bytes; // high-water mark of live_bytes
+};
+
+AllocStats alloc_stats();
+
+// Restart the high-water mark from the current live byte count
+void reset_peak_bytes();
+
+// Last-level cache misses of the calling thread, from the hardware counter
+// `perf stat -e cache-misses` reads, opened with perf_event_open on Linux.
+// Elsewhere, or where the kernel or a VM without a PMU refuses the
+// counter, available() is false and the count stays 0.
+class CacheMisses {
+public:
+    CacheMisses();
+
+    ~CacheMisses();
+
+    CacheMisses(const CacheMisses &) = delete;
+
+    CacheMisses &operator=(const CacheMisses &) = delete;
+
+    bool available() const { return fd >= 0; }
+
+    void start();
+
+    // Misses since start()
+    std::uint64_t stop();
+
+private:
+    int fd;
+};
+
+// Print one result line: "<bench>: <label> = <value> <unit>"
+void report(const std::string &bench, const std::string &label, double value, const std::string &unit);
+
+// Run the named benchmarks from a table; with no names run all of them.
+// "--list" prints the table.
+struct NamedBenchmark {
+    const char *name;
+    const char *description;
+    void (*run)();
+};
+
+int run_benchmarks(const NamedBenchmark *table, std::size_t count, int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,346 @@
+#include "builtins.hpp"
+#include "geometry_batch.hpp"
+#include "geometry_transform.hpp"
+#include "interpreter_semantic_error.hpp"
+
+#include <cmath>
+#include <limits>
+#include <string>
+
+#if defined(__GNUC__)
+#define COLD_PATH __attribute__((cold, noinline))
+#else
+#define COLD_PATH
+#endif
+
+// Argument checks take the operator name as a string literal; the error
+// message is only built on the failure path, which stays out of line.
+[[noreturn]] COLD_PATH static void argument_error(const char *op, const char *type) {
+    throw InterpreterSemanticError(std::string(op) + ": argument must be " + type);
+}
+
+// Arity and domain errors, likewise kept off the builtins' hot path
+[[noreturn]] COLD_PATH static void builtin_error(const std::string &message) {
+    throw InterpreterSemanticError(message);
+}
+
+// Name of an argument type in error messages
+static const char *type_name(const Type type) {
+    switch (type) {
+        case BooleanType:
+            return "Boolean";
+        case PointType:
+            return "Point";
+        case RectType:
+            return "Rect";
+        default:
+            return "Number";
+    }
+}
+
+static bool as_bool(const Atom &a, const char *op) {
+    if (a.type != BooleanType) {
+        argument_error(op, "Boolean");
+    }
+    return a.value.bool_value;
+}
+
+// Arguments reaching an implementation already have their declared types
+static double num(const Atom &a) { return a.value.num_value; }
+static Point point(const Atom &a) { return a.value.point_value; }
+static Rect rect(const Atom &a) { return a.value.rect_value; }
+
+static Expression make_num(double v) { return Expression(v); }
+static Expression make_bool(bool v) { return Expression(v); }
+
+// Equality tolerance for numbers
+static bool num_eq(double a, double b) {
+    constexpr double eps = std::numeric_limits<double>::epsilon();
+    return std::fabs(a - b) <= eps;
+}
+
+// Built-in procedures
+static Expression proc_add(const ArgSpan args) {
+    double s = 0.0;
+    for (const auto &a: args) {
+        s += num(a);
+    }
+    return make_num(s);
+}
+
+static Expression proc_mul(const ArgSpan args) {
+    double p = 1.0;
+    for (const auto &a: args) {
+        p *= num(a);
+    }
+    return make_num(p);
+}
+
+static Expression proc_sub(const ArgSpan args) {
+    if (args.size() == 1) {
+        return make_num(-num(args[0])); // unary negation
+    }
+    return make_num(num(args[0]) - num(args[1]));
+}
+
+static Expression proc_div(const ArgSpan args) {
+    if (num(args[1]) == 0.0) {
+        builtin_error("/: division by zero");
+    }
+    return make_num(num(args[0]) / num(args[1]));
+}
+
+static Expression proc_not(const ArgSpan args) {
+    return make_bool(!args[0].value.bool_value);
+}
+
+// and/or check their own arguments: once the result is decided the
+// remaining arguments are not type checked, as in the reference binary
+static Expression proc_and(const ArgSpan args) {
+    bool acc = true;
+    for (const auto &a: args) {
+        acc = acc && as_bool(a, "and");
+    }
+    return make_bool(acc);
+}
+
+static Expression proc_or(const ArgSpan args) {
+    bool acc = false;
+    for (const auto &a: args) {
+        acc = acc || as_bool(a, "or");
+    }
+    return make_bool(acc);
+}
+
+static Expression proc_lt(const ArgSpan args) {
+    return make_bool(num(args[0]) < num(args[1]));
+}
+
+static Expression proc_le(const ArgSpan args) {
+    return make_bool(num(args[0]) <= num(args[1]));
+}
+
+static Expression proc_gt(const ArgSpan args) {
+    return make_bool(num(args[0]) > num(args[1]));
+}
+
+static Expression proc_ge(const ArgSpan args) {
+    return make_bool(num(args[0]) >= num(args[1]));
+}
+
+static Expression proc_eq(const ArgSpan args) {
+    return make_bool(num_eq(num(args[0]), num(args[1])));
+}
+
+static Expression proc_sqrt(const ArgSpan args) {
+    const double x = num(args[0]);
+    if (x < 0.0) {
+        builtin_error("sqrt: domain error");
+    }
+    return make_num(std::sqrt(x));
+}
+
+static Expression proc_log2(const ArgSpan args) {
+    const double x = num(args[0]);
+    if (x <= 0.0) {
+        builtin_error("log2: domain error");
+    }
+    return make_num(std::log2(x));
+}
+
+static Expression proc_sin(const ArgSpan args) {
+    return make_num(std::sin(num(args[0])));
+}
+
+static Expression proc_cos(const ArgSpan args) {
+    return make_num(std::cos(num(args[0])));
+}
+
+static Expression proc_arctan(const ArgSpan args) {
+    return make_num(std::atan2(num(args[0]), num(args[1])));
+}
+
+// geometry
+static Expression proc_point(const ArgSpan args) {
+    return Expression(Point{num(args[0]), num(args[1])});
+}
+
+static Expression proc_line(const ArgSpan args) {
+    return Expression(Line{point(args[0]), point(args[1])});
+}
+
+static Expression proc_arc(const ArgSpan args) {
+    return Expression(Arc{point(args[0]), point(args[1]), num(args[2])});
+}
+
+static Expression proc_rect(const ArgSpan args) {
+    return Expression(Rect{point(args[0]), point(args[1])});
+}
+
+static Expression proc_fill_rect(const ArgSpan args) {
+    return Expression(FillRect{rect(args[0]), num(args[1]), num(args[2]), num(args[3])});
+}
+
+static Expression proc_ellipse(const ArgSpan args) {
+    return Expression(Ellipse{rect(args[0])});
+}
+
+// batches: x y coordinates packed into one Batch atom in a single call
+static Expression make_batch(const BatchKind kind, const ArgSpan args) {
+    return Expression(BatchTable::current().add(kind, args.begin(), args.size()));
+}
+
+static Expression proc_points(const ArgSpan args) {
+    if (args.size() % 2 != 0) {
+        builtin_error("points: requires x y pairs");
+    }
+    return make_batch(PointsBatch, args);
+}
+
+static Expression proc_polyline(const ArgSpan args) {
+    if (args.size() % 2 != 0) {
+        builtin_error("polyline: requires x y pairs");
+    }
+    return make_batch(PolylineBatch, args);
+}
+
+static Expression proc_lines(const ArgSpan args) {
+    if (args.size() % 4 != 0) {
+        builtin_error("lines: requires two x y pairs per segment");
+    }
+    return make_batch(LinesBatch, args);
+}
+
+static Expression proc_polygon(const ArgSpan args) {
+    if (args.size() % 2 != 0) {
+        builtin_error("polygon: requires x y pairs");
+    }
+    return make_batch(PolygonBatch, args);
+}
+
+// transforms of any drawable, the first argument, checked here
+static Expression transformed(const char *op, const Affine &m, const Atom &graphic) {
+    if (!is_transformable(graphic)) {
+        argument_error(op, "Graphic");
+    }
+    if (graphic.type == FillRectType && !keeps_axes(m)) {
+        builtin_error(std::string(op) + ": a fill_rect can only be scaled, translated or turned by quarter turns");
+    }
+    return Expression(transform_graphic(m, graphic));
+}
+
+static Expression proc_translate(const ArgSpan args) {
+    return transformed("translate", translation(num(args[1]), num(args[2])), args[0]);
+}
+
+static Expression proc_scale(const ArgSpan args) {
+    return transformed("scale", scaling(num(args[1]), num(args[2])), args[0]);
+}
+
+static Expression proc_rotate(const ArgSpan args) {
+    return transformed("rotate", rotation(num(args[1])), args[0]);
+}
+
+static Expression proc_transform(const ArgSpan args) {
+    const Affine m{num(args[1]), num(args[2]), num(args[3]), num(args[4]), num(args[5]), num(args[6])};
+    return transformed("transform", m, args[0]);
+}
+
+// The registry: one row per builtin procedure, in BuiltinSymbol order
+static const Builtin registry[] = {
+    // arithmetic
+    {SymAdd, "+", 1, VariadicArity, {NumberType}, NumberType, &proc_add},
+    {SymSub, "-", 1, 2, {NumberType, NumberType}, NumberType, &proc_sub},
+    {SymMul, "*", 1, VariadicArity, {NumberType}, NumberType, &proc_mul},
+    {SymDiv, "/", 2, 2, {NumberType, NumberType}, NumberType, &proc_div},
+
+    // logic
+    {SymNot, "not", 1, 1, {BooleanType}, BooleanType, &proc_not},
+    {SymAnd, "and", 1, VariadicArity, {NoneType}, BooleanType, &proc_and},
+    {SymOr, "or", 1, VariadicArity, {NoneType}, BooleanType, &proc_or},
+
+    // comparison
+    {SymLt, "<", 2, 2, {NumberType, NumberType}, BooleanType, &proc_lt},
+    {SymLe, "<=", 2, 2, {NumberType, NumberType}, BooleanType, &proc_le},
+    {SymGt, ">", 2, 2, {NumberType, NumberType}, BooleanType, &proc_gt},
+    {SymGe, ">=", 2, 2, {NumberType, NumberType}, BooleanType, &proc_ge},
+    {SymEq, "==", 2, 2, {NumberType, NumberType}, BooleanType, &proc_eq},
+
+    // math
+    {SymSqrt, "sqrt", 1, 1, {NumberType}, NumberType, &proc_sqrt},
+    {SymLog2, "log2", 1, 1, {NumberType}, NumberType, &proc_log2},
+    {SymSin, "sin", 1, 1, {NumberType}, NumberType, &proc_sin},
+    {SymCos, "cos", 1, 1, {NumberType}, NumberType, &proc_cos},
+    {SymArctan, "arctan", 2, 2, {NumberType, NumberType}, NumberType, &proc_arctan},
+
+    // geometry
+    {SymPoint, "point", 2, 2, {NumberType, NumberType}, PointType, &proc_point},
+    {SymLine, "line", 2, 2, {PointType, PointType}, LineType, &proc_line},
+    {SymArc, "arc", 3, 3, {PointType, PointType, NumberType}, ArcType, &proc_arc},
+    {SymRect, "rect", 2, 2, {PointType, PointType}, RectType, &proc_rect},
+    {SymFillRect, "fill_rect", 4, 4, {RectType, NumberType, NumberType, NumberType}, FillRectType, &proc_fill_rect},
+    {SymEllipse, "ellipse", 1, 1, {RectType}, EllipseType, &proc_ellipse},
+
+    // batches, taking x y coordinates: at least one point, two for a path
+    // or segment, three for a polygon
+    {SymPoints, "points", 2, VariadicArity, {NumberType}, BatchType, &proc_points},
+    {SymPolyline, "polyline", 4, VariadicArity, {NumberType}, BatchType, &proc_polyline},
+    {SymLines, "lines", 4, VariadicArity, {NumberType}, BatchType, &proc_lines},
+    {SymPolygon, "polygon", 6, VariadicArity, {NumberType}, BatchType, &proc_polygon},
+
+    // transforms, about the origin; the drawable comes first and may be of
+    // any graphic type, so its type is left to the implementation. rotate
+    // turns clockwise on screen. A fill_rect stays a fill_rect, so it can
+    // only be translated, scaled or turned by quarter turns: no batch
+    // keeps its colour, and rotating or shearing it is an error.
+    {SymTranslate, "translate", 3, 3, {NoneType, NumberType, NumberType}, NoneType, &proc_translate},
+    {SymScale, "scale", 3, 3, {NoneType, NumberType, NumberType}, NoneType, &proc_scale},
+    {SymRotate, "rotate", 2, 2, {NoneType, NumberType}, NoneType, &proc_rotate},
+    {SymTransform, "transform", 7, 7,
+     {NoneType, NumberType, NumberType, NumberType, NumberType, NumberType, NumberType}, NoneType, &proc_transform},
+};
+
+const Builtin *builtins_begin() noexcept { return registry; }
+
+const Builtin *builtins_end() noexcept { return registry + sizeof(registry) / sizeof(registry[0]); }
+
+[[noreturn]] COLD_PATH static void arity_error(const Builtin &builtin) {
+    if (builtin.max_args == VariadicArity && builtin.min_args == 1) {
+        builtin_error(std::string(builtin.name) + ": requires at least one argument");
+    }
+    if (builtin.max_args == VariadicArity) {
+        builtin_error(std::string(builtin.name) + ": requires at least " + std::to_string(builtin.min_args) +
+                      " arguments");
+    }
+    builtin_error(std::string(builtin.name) + ": wrong number of arguments");
+}
+
+Expression call_builtin(const Builtin &builtin, const ArgSpan args) {
+    if (args.size() < builtin.min_args || args.size() > builtin.max_args) {
+        arity_error(builtin);
+    }
+    for (std::size_t i = 0; i < args.size(); ++i) {
+        const Type expected = builtin.arg_type(i);
+        if (expected != NoneType && args[i].type != expected) {
+            argument_error(builtin.name, type_name(expected));
+        }
+    }
+    return builtin.impl(args);
+}
+
+Expression Builtin::operator()(const ArgSpan args) const {
+    return call_builtin(*this, args);
+}
+
+bool signature_accepts(const Builtin &builtin, const Type *types, const std::size_t count) noexcept {
+    if (count < builtin.min_args || count > builtin.max_args) {
+        return false;
+    }
+    for (std::size_t i = 0; i < count; ++i) {
+        const Type expected = builtin.arg_type(i);
+        if (expected != NoneType && types[i] != expected) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,51 @@
+#ifndef BUILTINS_HPP
+#define BUILTINS_HPP
+
+// system includes
+#include <cstddef>
+
+// module includes
+#include "expression.hpp"
+
+// Arity of a builtin with no upper bound on its argument count
+const std::size_t VariadicArity = static_cast<std::size_t>(-1);
+
+// Most fixed arguments any builtin takes (transform)
+const std::size_t MaxFixedArgs = 7;
+
+// Declarative description of a builtin procedure. call_builtin() checks a
+// call against it before running 'impl', so implementations can assume
+// their arguments have the declared count and types.
+struct Builtin {
+    BuiltinSymbol symbol;
+    const char *name;
+    std::size_t min_args;
+    std::size_t max_args; // VariadicArity: no upper bound
+
+    // Type of each argument; a variadic builtin gives one type for all of
+    // them. NoneType leaves the check to 'impl' (and, or short-circuit).
+    Type arg_types[MaxFixedArgs];
+
+    Type result;
+    Procedure impl;
+
+    Type arg_type(std::size_t i) const noexcept { return arg_types[max_args == VariadicArity ? 0 : i]; }
+
+    // checked call, see call_builtin()
+    Expression operator()(ArgSpan args) const;
+};
+
+// The registry, in BuiltinSymbol order
+const Builtin *builtins_begin() noexcept;
+const Builtin *builtins_end() noexcept;
+
+// Check 'args' against the signature of 'builtin' (throw
+// InterpreterSemanticError if they do not match), then run it
+Expression call_builtin(const Builtin &builtin, ArgSpan args);
+
+// Would arguments of these statically known types always pass the
+// signature check of 'builtin'? If so the check can be skipped and 'impl'
+// called directly.
+bool signature_accepts(const Builtin &builtin, const Type *types, std::size_t count) noexcept;
+
+#endif
@@ -0,0 +1,337 @@
+#include "bytecode.hpp"
+#include "interpreter_semantic_error.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+namespace {
+    // A list being compiled: the next child to compile, the jump
+    // instruction waiting to be pointed past the current if branch, and the
+    // type the then branch of an if left
+    struct Frame {
+        const Expression *exp;
+        std::size_t next;
+        std::size_t jump;
+        Type then_type;
+    };
+
+    // Emits code in evaluation order, keeping pending lists on an explicit
+    // stack like Interpreter::eval, so deep programs compile without
+    // recursion. Alongside the code it tracks the type of every operand the
+    // stack will hold (NoneType when it cannot be known statically), so a
+    // call whose arguments are proven to match the builtin's signature
+    // skips the runtime check.
+    class Compiler {
+    public:
+        Compiler(Program &program, const Environment &env) : program(program), env(env) {
+        }
+
+        void run(const Expression &root) {
+            enter(root);
+            while (!frames.empty()) {
+                Frame &frame = frames.back();
+                const Expression::Tail &tail = frame.exp->getTail();
+
+                switch (frame.exp->getHead().value.sym_value.id()) {
+                    case SymDefine:
+                        if (frame.next == 0) {
+                            frame.next = 2;
+                            enter(tail[1]);
+                        } else {
+                            emit(OpDefine, tail[0].getHead().value.sym_value.id()); // value stays
+                            frames.pop_back();
+                        }
+                        continue;
+
+                    case SymBegin:
+                        if (frame.next < tail.size()) {
+                            if (frame.next > 0) {
+                                emit(OpPop);
+                                types.pop_back();
+                            }
+                            enter(tail[frame.next++]);
+                        } else {
+                            frames.pop_back();
+                        }
+                        continue;
+
+                    case SymIf:
+                        switch (frame.next++) {
+                            case 0:
+                                enter(tail[0]);
+                                break;
+                            case 1:
+                                frame.jump = emit(OpJumpIfFalse);
+                                types.pop_back();
+                                enter(tail[1]);
+                                break;
+                            case 2: {
+                                const std::size_t jump = emit(OpJump);
+                                frame.then_type = types.back();
+                                types.pop_back();
+                                patch(frame.jump);
+                                frame.jump = jump;
+                                enter(tail[2]);
+                                break;
+                            }
+                            default:
+                                patch(frame.jump);
+                                if (types.back() != frame.then_type) {
+                                    types.back() = NoneType;
+                                }
+                                frames.pop_back();
+                                break;
+                        }
+                        continue;
+
+                    case SymDraw:
+                        if (frame.next > 0) {
+                            emit(OpDraw);
+                            types.pop_back();
+                        }
+                        if (frame.next < tail.size()) {
+                            enter(tail[frame.next++]);
+                        } else {
+                            emit(OpPushNone);
+                            types.push_back(NoneType);
+                            frames.pop_back();
+                        }
+                        continue;
+
+                    default:
+                        break;
+                }
+
+                // case 3.2: Regular Procedures
+                if (frame.next < tail.size()) {
+                    enter(tail[frame.next++]);
+                    continue;
+                }
+                const SymbolRef op = frame.exp->getHead().value.sym_value;
+                const Builtin *builtin = env.lookup_builtin(op);
+                const std::size_t base = types.size() - tail.size();
+                if (builtin) {
+                    const OpCode call = signature_accepts(*builtin, types.data() + base, tail.size()) ? OpCallUnchecked : OpCall;
+                    emit(call, procedure_index(builtin), static_cast<std::uint32_t>(tail.size()));
+                    types.resize(base);
+                    types.push_back(builtin->result);
+                } else {
+                    types.resize(base);
+                    fail("Unknown procedure: " + op.str());
+                }
+                frames.pop_back();
+            }
+        }
+
+    private:
+        Program &program;
+        const Environment &env;
+        std::vector<Frame> frames;
+        std::vector<Type> types;
+
+        std::size_t emit(OpCode op, std::uint32_t a = 0, std::uint32_t b = 0) {
+            program.code.push_back(Instruction{op, a, b});
+            return program.code.size() - 1;
+        }
+
+        // point the jump at 'index' to the next instruction
+        void patch(std::size_t index) {
+            program.code[index].a = static_cast<std::uint32_t>(program.code.size());
+        }
+
+        // the code after an OpFail never runs; its operand is unknown
+        void fail(const std::string &message) {
+            emit(OpFail, static_cast<std::uint32_t>(program.messages.size()));
+            program.messages.push_back(message);
+            types.push_back(NoneType);
+        }
+
+        std::uint32_t procedure_index(const Builtin *builtin) {
+            auto it = std::find(program.procedures.begin(), program.procedures.end(), builtin);
+            if (it == program.procedures.end()) {
+                it = program.procedures.insert(it, builtin);
+            }
+            return static_cast<std::uint32_t>(it - program.procedures.begin());
+        }
+
+        // Builtin constants can never be rebound, so their type is fixed;
+        // anything the program defines is only known at run time
+        Type global_type(const SymbolRef name) const {
+            if (name.id() >= BuiltinSymbolCount) {
+                return NoneType;
+            }
+            const Expression *value = env.lookup(name);
+            return value ? value->headType() : NoneType;
+        }
+
+        // Emit the code for an atom, or open a frame for a list, raising
+        // the errors Interpreter::eval raises before evaluating any child
+        void enter(const Expression &exp) {
+            // case 1: atom (no tail)
+            if (exp.tailIsEmpty()) {
+                const Atom &atom = exp.getHead();
+                if (atom.type == SymbolType) {
+                    emit(OpLoadGlobal, atom.value.sym_value.id());
+                    types.push_back(global_type(atom.value.sym_value));
+                    return;
+                }
+                types.push_back(atom.type);
+                if (atom.type == NumberType) {
+                    // numbers travel inside the instruction, not in the pool
+                    std::uint64_t bits;
+                    std::memcpy(&bits, &atom.value.num_value, sizeof(bits));
+                    emit(OpPushNumber, static_cast<std::uint32_t>(bits), static_cast<std::uint32_t>(bits >> 32));
+                } else if (atom.type == BooleanType) {
+                    emit(OpPushBool, atom.value.bool_value ? 1 : 0);
+                } else {
+                    emit(OpPushConst, static_cast<std::uint32_t>(program.constants.size()));
+                    program.constants.push_back(atom);
+                }
+                return;
+            }
+
+            // case 2: list (non-empty tail)
+            if (exp.headType() != SymbolType) {
+                fail("Malformed expression: non-symbol head in list");
+                return;
+            }
+
+            const Expression::Tail &tail = exp.getTail();
+            switch (exp.getHead().value.sym_value.id()) {
+                case SymDefine:
+                    if (tail.size() != 2) {
+                        fail("define: wrong number of arguments");
+                        return;
+                    }
+                    if (!(tail[0].tailIsEmpty() && tail[0].headType() == SymbolType)) {
+                        fail("define: first argument must be a symbol");
+                        return;
+                    }
+                    emit(OpCheckDefine, tail[0].getHead().value.sym_value.id());
+                    break;
+
+                case SymIf:
+                    if (tail.size() != 3) {
+                        fail("if: wrong number of arguments");
+                        return;
+                    }
+                    break;
+
+                default:
+                    break;
+            }
+            frames.push_back(Frame{&exp, 0, 0, NoneType});
+        }
+    };
+}
+
+Program compile(const Expression &exp, const Environment &env) {
+    Program program;
+    Compiler(program, env).run(exp);
+    return program;
+}
+
+Atom execute(const Program &program, Environment &env, DisplayList &draws, std::vector<Atom> &stack) {
+    stack.clear();
+
+    const Instruction *const code = program.code.data();
+    const std::size_t size = program.code.size();
+    std::size_t pc = 0;
+    while (pc < size) {
+        const Instruction &ins = code[pc++];
+        switch (ins.op) {
+            case OpPushNumber: {
+                const std::uint64_t bits = static_cast<std::uint64_t>(ins.b) << 32 | ins.a;
+                Atom atom{NumberType, Value()};
+                std::memcpy(&atom.value.num_value, &bits, sizeof(bits));
+                stack.push_back(atom);
+                break;
+            }
+
+            case OpPushBool: {
+                Atom atom{BooleanType, Value()};
+                atom.value.bool_value = ins.a != 0;
+                stack.push_back(atom);
+                break;
+            }
+
+            case OpPushConst:
+                stack.push_back(program.constants[ins.a]);
+                break;
+
+            case OpPushNone:
+                stack.push_back(Atom{NoneType, Value()});
+                break;
+
+            case OpLoadGlobal: {
+                const Expression *value = env.lookup(SymbolRef::fromId(ins.a));
+                if (!value) {
+                    throw InterpreterSemanticError("Undefined symbol: " + SymbolRef::fromId(ins.a).str());
+                }
+                stack.push_back(value->getHead());
+                break;
+            }
+
+            case OpCall: {
+                // the arguments are the top ins.b atoms, passed in place
+                const std::size_t base = stack.size() - ins.b;
+                const ArgSpan args(stack.data() + base, ins.b);
+                const Atom result = call_builtin(*program.procedures[ins.a], args).getHead();
+                stack.resize(base);
+                stack.push_back(result);
+                break;
+            }
+
+            case OpCallUnchecked: {
+                const std::size_t base = stack.size() - ins.b;
+                const ArgSpan args(stack.data() + base, ins.b);
+                const Atom result = program.procedures[ins.a]->impl(args).getHead();
+                stack.resize(base);
+                stack.push_back(result);
+                break;
+            }
+
+            case OpPop:
+                stack.pop_back();
+                break;
+
+            case OpJump:
+                pc = ins.a;
+                break;
+
+            case OpJumpIfFalse: {
+                const Atom cond = stack.back();
+                stack.pop_back();
+                if (cond.type != BooleanType) {
+                    throw InterpreterSemanticError("if: condition must be Boolean");
+                }
+                if (!cond.value.bool_value) {
+                    pc = ins.a;
+                }
+                break;
+            }
+
+            case OpCheckDefine: {
+                const SymbolRef name = SymbolRef::fromId(ins.a);
+                if (env.is_reserved(name)) {
+                    throw InterpreterSemanticError("define: cannot redefine built-in symbol: " + name.str());
+                }
+                break;
+            }
+
+            case OpDefine:
+                env.define(SymbolRef::fromId(ins.a), Expression(stack.back()));
+                break;
+
+            case OpDraw:
+                draws.add(stack.back());
+                stack.pop_back();
+                break;
+
+            case OpFail:
+                throw InterpreterSemanticError(program.messages[ins.a]);
+        }
+    }
+    return stack.back();
+}
@@ -0,0 +1,61 @@
+#ifndef BYTECODE_HPP
+#define BYTECODE_HPP
+
+// system includes
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// module includes
+#include "display_list.hpp"
+#include "environment.hpp"
+#include "expression.hpp"
+
+// Bytecode for the stack VM. Every instruction has up to two operands, 'a'
+// and 'b'; what they mean depends on the opcode.
+enum OpCode : std::uint8_t {
+    OpPushNumber,    // push the Number whose bits are a (low) and b (high)
+    OpPushBool,      // push the Boolean a != 0
+    OpPushConst,     // push constants[a]
+    OpPushNone,      // push the None atom
+    OpLoadGlobal,    // push the value bound to symbol id a
+    OpCall,          // pop b arguments, push procedures[a](arguments)
+    OpCallUnchecked, // as OpCall, arguments already proven to match the signature
+    OpPop,           // discard the top of the stack
+    OpJump,          // continue at instruction a
+    OpJumpIfFalse,   // pop a Boolean condition; if False continue at instruction a
+    OpCheckDefine,   // fail if symbol id a cannot be defined
+    OpDefine,        // bind symbol id a to the top of the stack (left in place)
+    OpDraw,          // pop a value; queue it for drawing if it is graphic
+    OpFail           // throw InterpreterSemanticError(messages[a])
+};
+
+struct Instruction {
+    OpCode op;
+    std::uint32_t a;
+    std::uint32_t b;
+};
+
+// A compiled expression: straight-line code plus the pools its operands
+// index. Running it leaves exactly one atom, the result, on the stack.
+struct Program {
+    std::vector<Instruction> code;
+    std::vector<Atom> constants;
+    std::vector<const Builtin *> procedures;
+    std::vector<std::string> messages;
+
+    bool empty() const noexcept { return code.empty(); }
+};
+
+// Lower 'exp' to bytecode. Procedures are resolved against 'env' now, since
+// define can never bind a procedure; errors the tree-walking evaluator would
+// raise are compiled to OpFail at the point where it would raise them, so
+// both evaluators fail the same way on the same input.
+Program compile(const Expression &exp, const Environment &env);
+
+// Execute 'program' against 'env', adding drawn values to 'draws'.
+// 'stack' is the operand stack, reused across runs. Throw
+// InterpreterSemanticError on semantic errors.
+Atom execute(const Program &program, Environment &env, DisplayList &draws, std::vector<Atom> &stack);
+
+#endif
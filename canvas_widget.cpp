@@ -1,15 +1,21 @@
 #include "canvas_widget.hpp"
+#include "display_list_item.hpp"
+#include "tile_renderer.hpp"
+#include <QGraphicsScene>
 #include <QGraphicsView>
 #include <QGraphicsItem>
 #include <QVBoxLayout>
 
 CanvasWidget::CanvasWidget(QWidget *parent) : QWidget(parent) {
 
+    tiles = new TileRenderer(this);
+
     scene = new QGraphicsScene(this);
 
-    QGraphicsView *view = new QGraphicsView(scene, this);
+    view = new QGraphicsView(scene, this);
     view->setHorizontalScrollBarPolicy(Qt::ScrollBarAsNeeded);
     view->setVerticalScrollBarPolicy(Qt::ScrollBarAsNeeded);
+    tiles->setViewport(view->viewport());
 
     QVBoxLayout *layout = new QVBoxLayout(this);
     layout->setContentsMargins(0, 0, 0, 0);
@@ -19,6 +25,36 @@ CanvasWidget::CanvasWidget(QWidget *parent) : QWidget(parent) {
 
 void CanvasWidget::addGraphic(QGraphicsItem *item) {
     if (item) {
+        attach(item);
         scene->addItem(item);
     }
 }
+
+void CanvasWidget::addGraphics(QList<QGraphicsItem *> items) {
+    if (items.isEmpty()) {
+        return;
+    }
+
+    // unindexed inserts are cheap; restoring the index method rebuilds it
+    // over all items in one pass
+    const QGraphicsScene::ItemIndexMethod index = scene->itemIndexMethod();
+    scene->setItemIndexMethod(QGraphicsScene::NoIndex);
+    view->setUpdatesEnabled(false);
+
+    for (QGraphicsItem *item: items) {
+        if (item) {
+            attach(item);
+            scene->addItem(item);
+        }
+    }
+
+    scene->setItemIndexMethod(index);
+    view->setUpdatesEnabled(true);
+    view->viewport()->update();
+}
+
+void CanvasWidget::attach(QGraphicsItem *item) {
+    if (item->type() == DisplayListItem::Type) {
+        static_cast<DisplayListItem *>(item)->setTileRenderer(tiles);
+    }
+}
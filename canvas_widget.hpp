@@ -3,11 +3,14 @@
 #ifndef CANVAS_WIDGET_HPP
 #define CANVAS_WIDGET_HPP
 
+#include <QList>
 #include <QWidget>
 
 
 class QGraphicsItem;
 class QGraphicsScene;
+class QGraphicsView;
+class TileRenderer;
 
 class CanvasWidget : public QWidget {
     Q_OBJECT
@@ -15,11 +18,24 @@ class CanvasWidget : public QWidget {
 public:
     CanvasWidget(QWidget *parent = nullptr);
 
+    // Paints the DisplayListItems added into the view, from tiles
+    // rasterized on worker threads; set its budget and threads here
+    TileRenderer *tileRenderer() const { return tiles; }
+
 public slots:
     void addGraphic(QGraphicsItem *item);
 
+    // Add all of 'items' with the scene index rebuilt and the view
+    // repainted once at the end, instead of once per item
+    void addGraphics(QList<QGraphicsItem *> items);
+
 private:
+    // hand packed items to 'tiles'
+    void attach(QGraphicsItem *item);
+
     QGraphicsScene *scene;
+    QGraphicsView *view;
+    TileRenderer *tiles;
 };
 
 #endif
@@ -0,0 +1,157 @@
+#include "display_list.hpp"
+#include "geometry_batch.hpp"
+
+#include <algorithm>
+
+template<class T>
+void DisplayList::push(const Type type, std::vector<T> &array, const T &value) {
+    const std::uint32_t index = static_cast<std::uint32_t>(array.size());
+    array.push_back(value);
+    if (!order.empty() && order.back().type == type) {
+        ++order.back().count; // the array of 'type' was also the last drawn to
+    } else {
+        order.push_back(Run{type, index, 1});
+    }
+    ++total;
+}
+
+bool DisplayList::add(const Atom &graphic) {
+    const Value &v = graphic.value;
+    switch (graphic.type) {
+        case PointType:
+            push(PointType, pointArray, v.point_value);
+            return true;
+        case LineType:
+            push(LineType, lineArray, v.line_value);
+            return true;
+        case ArcType:
+            push(ArcType, arcArray, v.arc_value);
+            return true;
+        case RectType:
+            push(RectType, rectArray, v.rect_value);
+            return true;
+        case FillRectType:
+            push(FillRectType, fillRectArray, v.fill_rect_value);
+            return true;
+        case EllipseType:
+            push(EllipseType, ellipseArray, v.ellipse_value);
+            return true;
+        case BatchType:
+            push(BatchType, batchArray, v.batch_value);
+            batchStorage.push_back(v.batch_value.storage ? v.batch_value.storage->shared_from_this()
+                                                         : std::shared_ptr<const BatchStorage>());
+            return true;
+        default:
+            return false;
+    }
+}
+
+void DisplayList::clear() {
+    order.clear();
+    total = 0;
+    pointArray.clear();
+    lineArray.clear();
+    arcArray.clear();
+    rectArray.clear();
+    fillRectArray.clear();
+    ellipseArray.clear();
+    batchArray.clear();
+    batchStorage.clear();
+}
+
+void DisplayList::truncate(const std::size_t draws) {
+    while (total > draws) {
+        Run &run = order.back();
+        const std::size_t keep = run.count - std::min<std::size_t>(run.count, total - draws);
+        total -= run.count - keep;
+        const std::size_t end = run.first + keep; // the runs of a kind tile its array in order
+        switch (run.type) {
+            case PointType:
+                pointArray.resize(end);
+                break;
+            case LineType:
+                lineArray.resize(end);
+                break;
+            case ArcType:
+                arcArray.resize(end);
+                break;
+            case RectType:
+                rectArray.resize(end);
+                break;
+            case FillRectType:
+                fillRectArray.resize(end);
+                break;
+            case EllipseType:
+                ellipseArray.resize(end);
+                break;
+            case BatchType:
+                batchArray.resize(end);
+                batchStorage.resize(end);
+                break;
+            default:
+                break;
+        }
+        if (keep == 0) {
+            order.pop_back();
+        } else {
+            run.count = static_cast<std::uint32_t>(keep);
+        }
+    }
+}
+
+std::size_t DisplayList::bytes() const noexcept {
+    return order.size() * sizeof(Run) + pointArray.size() * sizeof(Point) + lineArray.size() * sizeof(Line) +
+           arcArray.size() * sizeof(Arc) + rectArray.size() * sizeof(Rect) +
+           fillRectArray.size() * sizeof(FillRect) + ellipseArray.size() * sizeof(Ellipse) +
+           batchArray.size() * (sizeof(Batch) + sizeof(std::shared_ptr<const BatchStorage>));
+}
+
+Atom DisplayList::atom(const Type type, const std::uint32_t i) const noexcept {
+    Atom a{type, Value()};
+    switch (type) {
+        case PointType:
+            a.value.point_value = pointArray[i];
+            break;
+        case LineType:
+            a.value.line_value = lineArray[i];
+            break;
+        case ArcType:
+            a.value.arc_value = arcArray[i];
+            break;
+        case RectType:
+            a.value.rect_value = rectArray[i];
+            break;
+        case FillRectType:
+            a.value.fill_rect_value = fillRectArray[i];
+            break;
+        case EllipseType:
+            a.value.ellipse_value = ellipseArray[i];
+            break;
+        case BatchType:
+            a.value.batch_value = batchArray[i];
+            break;
+        default:
+            break;
+    }
+    return a;
+}
+
+std::vector<Expression> DisplayList::expressions() const {
+    std::vector<Expression> out;
+    append_expressions(0, out);
+    return out;
+}
+
+void DisplayList::append_expressions(std::size_t from, std::vector<Expression> &out) const {
+    out.reserve(out.size() + (total - std::min(from, total)));
+    for (const Run &run: order) {
+        if (from >= run.count) {
+            from -= run.count;
+            continue;
+        }
+        for (std::uint32_t i = run.first + static_cast<std::uint32_t>(from); i < run.first + run.count; ++i) {
+            out.emplace_back(atom(run.type, i));
+        }
+        from = 0;
+    }
+}
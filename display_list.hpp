@@ -0,0 +1,87 @@
+#ifndef DISPLAY_LIST_HPP
+#define DISPLAY_LIST_HPP
+
+// system includes
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// module includes
+#include "expression.hpp"
+
+// The graphics an eval() draws, as one contiguous array per primitive kind
+// plus the draw order. The order is kept as runs of consecutive draws of
+// one kind, so a drawing of many lines in a row costs one run, and a
+// renderer can hand each run's slice of its array over in bulk.
+//
+// A drawn primitive costs its payload alone, 16 bytes for a Point and 32
+// for a Line against the 96 of an Expression in a vector; a drawing of
+// mostly FillRects, 56 bytes each, such as the airplane, saves far less
+// (41 bytes per draw on average). A drawn Batch also shares its vertices'
+// storage, so the list and its copies can be painted after the
+// Interpreter that drew them releases its batches.
+class DisplayList {
+public:
+    // Draws [first, first + count) of the array of 'type'
+    struct Run {
+        Type type;
+        std::uint32_t first;
+        std::uint32_t count;
+    };
+
+    // Append 'graphic' if it is drawable (see is_graphic_atom); return
+    // whether it was
+    bool add(const Atom &graphic);
+
+    void clear();
+
+    // Drop every draw after the first 'draws'
+    void truncate(std::size_t draws);
+
+    bool empty() const noexcept { return order.empty(); }
+
+    // Number of draws
+    std::size_t size() const noexcept { return total; }
+
+    // Bytes of the arrays' contents
+    std::size_t bytes() const noexcept;
+
+    // Draw order
+    const std::vector<Run> &runs() const noexcept { return order; }
+
+    const std::vector<Point> &points() const noexcept { return pointArray; }
+    const std::vector<Line> &lines() const noexcept { return lineArray; }
+    const std::vector<Arc> &arcs() const noexcept { return arcArray; }
+    const std::vector<Rect> &rects() const noexcept { return rectArray; }
+    const std::vector<FillRect> &fill_rects() const noexcept { return fillRectArray; }
+    const std::vector<Ellipse> &ellipses() const noexcept { return ellipseArray; }
+    const std::vector<Batch> &batches() const noexcept { return batchArray; }
+
+    // The i-th element of the array of 'type' as an Atom
+    Atom atom(Type type, std::uint32_t i) const noexcept;
+
+    // Every draw as an Expression, in draw order
+    std::vector<Expression> expressions() const;
+
+    // Append the draws from the 'from'-th on to 'out' as Expressions
+    void append_expressions(std::size_t from, std::vector<Expression> &out) const;
+
+private:
+    template<class T>
+    void push(Type type, std::vector<T> &array, const T &value);
+
+    std::vector<Run> order;
+    std::size_t total = 0;
+
+    std::vector<Point> pointArray;
+    std::vector<Line> lineArray;
+    std::vector<Arc> arcArray;
+    std::vector<Rect> rectArray;
+    std::vector<FillRect> fillRectArray;
+    std::vector<Ellipse> ellipseArray;
+    std::vector<Batch> batchArray;
+    std::vector<std::shared_ptr<const BatchStorage> > batchStorage; // per batchArray element
+};
+
+#endif
@@ -0,0 +1,300 @@
+#include "display_list_item.hpp"
+
+#include <QBrush>
+#include <QColor>
+#include <QImage>
+#include <QLineF>
+#include <QPainter>
+#include <QPen>
+#include <QPointF>
+#include <QStyleOptionGraphicsItem>
+#include <QVector>
+
+#include <cmath>
+
+// Radius points are drawn with; it also covers the pens of outlines
+static const qreal PointRadius = 2;
+
+static QRectF normalized(const Rect &r) {
+    return QRectF(QPointF(r.point1.x, r.point1.y), QPointF(r.point2.x, r.point2.y)).normalized();
+}
+
+static QRectF to_rect(const Box &box) {
+    return QRectF(QPointF(box.x0, box.y0), QPointF(box.x1, box.y1));
+}
+
+static QPointF to_point(const Point &p) {
+    return QPointF(p.x, p.y);
+}
+
+// Paints draws fed to it in draw order, with the pens and brushes of the
+// per-primitive items in qt_interpreter.cpp. Consecutive points, lines and
+// rects are collected and painted in one call; a draw of another type
+// flushes them first, so the order is kept. Arcs are painted as polylines
+// and paths are decimated, both to within about a 'pixel'.
+class RunPainter {
+public:
+    RunPainter(QPainter *painter, const DisplayList &list, qreal pixel)
+        : painter(painter), list(list), pixel(pixel) {
+        dot.setWidthF(2 * PointRadius);
+        dot.setCapStyle(Qt::RoundCap);
+        arcPen.setWidthF(1.0);
+        arcPen.setCapStyle(Qt::RoundCap);
+        arcPen.setJoinStyle(Qt::RoundJoin);
+        painter->setBrush(Qt::NoBrush);
+    }
+
+    ~RunPainter() { flush(); }
+
+    // the element 'i' of the array of 'type'
+    void add(const Type type, const std::uint32_t i) {
+        if (type != pending) {
+            flush();
+            pending = type;
+        }
+        switch (type) {
+            case PointType:
+                points.append(QPointF(list.points()[i].x, list.points()[i].y));
+                break;
+            case LineType: {
+                const Line &l = list.lines()[i];
+                lines.append(QLineF(l.start.x, l.start.y, l.end.x, l.end.y));
+                break;
+            }
+            case RectType:
+                rects.append(normalized(list.rects()[i]));
+                break;
+            case ArcType:
+                paint(list.arcs()[i]);
+                break;
+            case FillRectType: {
+                const FillRect &fr = list.fill_rects()[i];
+                painter->fillRect(normalized(fr.rect), QColor(int(fr.r), int(fr.g), int(fr.b)));
+                break;
+            }
+            case EllipseType:
+                painter->setPen(outline);
+                painter->drawEllipse(normalized(list.ellipses()[i].rect));
+                break;
+            case BatchType:
+                paint(list.batches()[i]);
+                break;
+            default:
+                break;
+        }
+    }
+
+    void flush() {
+        if (!points.isEmpty()) {
+            painter->setPen(dot);
+            painter->drawPoints(points.constData(), points.size());
+            points.clear();
+        }
+        if (!lines.isEmpty()) {
+            painter->setPen(outline);
+            painter->drawLines(lines.constData(), lines.size());
+            lines.clear();
+        }
+        if (!rects.isEmpty()) {
+            painter->setPen(outline);
+            painter->drawRects(rects.constData(), rects.size());
+            rects.clear();
+        }
+    }
+
+private:
+    // as many segments as its radius on screen needs
+    void paint(const Arc &arc) {
+        const qreal r = std::hypot(arc.start.x - arc.center.x, arc.start.y - arc.center.y);
+        path.clear();
+        tessellate_arc(arc, arc_segments(r / pixel, arc.angle), path);
+        to_vertices();
+        painter->setPen(arcPen);
+        painter->drawPolyline(vertices.constData(), vertices.size());
+    }
+
+    void paint(const Batch &batch) {
+        path.clear();
+        if (batch.kind == LinesBatch) {
+            for (std::uint32_t i = 0; i < batch.count; ++i) {
+                path.push_back(batch.vertex(i));
+            }
+        } else {
+            decimate(batch.xs, batch.ys, batch.count, pixel, path);
+        }
+        to_vertices();
+        painter->setPen(batch.kind == PointsBatch ? dot : outline);
+        switch (batch.kind) {
+            case PointsBatch:
+                painter->drawPoints(vertices.constData(), vertices.size());
+                break;
+            case PolylineBatch:
+                painter->drawPolyline(vertices.constData(), vertices.size());
+                break;
+            case LinesBatch:
+                painter->drawLines(vertices.constData(), vertices.size() / 2);
+                break;
+            case PolygonBatch:
+                painter->drawPolygon(vertices.constData(), vertices.size());
+                break;
+        }
+    }
+
+    void to_vertices() {
+        vertices.resize(static_cast<int>(path.size()));
+        for (std::size_t i = 0; i < path.size(); ++i) {
+            vertices[static_cast<int>(i)] = to_point(path[i]);
+        }
+    }
+
+    QPainter *painter;
+    const DisplayList &list;
+    const qreal pixel;
+    Type pending = NoneType;
+
+    const QPen outline{Qt::black};
+    QPen dot{Qt::black};
+    QPen arcPen{Qt::black};
+
+    QVector<QPointF> points;
+    QVector<QLineF> lines;
+    QVector<QRectF> rects;
+    std::vector<Point> path;
+    QVector<QPointF> vertices;
+};
+
+// Feed 'draws', in draw order, to 'runs'
+static void paint_draws(RunPainter &runs, const DisplayList &list, const std::vector<SpatialIndex::Draw> &draws) {
+    std::size_t run = 0;
+    std::uint32_t runEnd = list.runs().empty() ? 0 : list.runs()[0].count; // draws before the next run
+    for (const SpatialIndex::Draw d: draws) {
+        while (d >= runEnd) {
+            runEnd += list.runs()[++run].count;
+        }
+        const DisplayList::Run &r = list.runs()[run];
+        runs.add(r.type, r.first + r.count - (runEnd - d));
+    }
+}
+
+// The cells of 'level' of 'pyramid' over 'area' as one image
+static void paint_density(QPainter *painter, const DensityPyramid &pyramid, const std::size_t level, const Box &area,
+                          QImage &density) {
+    std::size_t cx0, cy0, cx1, cy1;
+    if (!pyramid.cells_of(level, area, cx0, cy0, cx1, cy1)) {
+        return;
+    }
+    const int width = static_cast<int>(cx1 - cx0 + 1), height = static_cast<int>(cy1 - cy0 + 1);
+    if (density.width() != width || density.height() != height) {
+        density = QImage(width, height, QImage::Format_ARGB32_Premultiplied);
+    }
+    for (int row = 0; row < height; ++row) {
+        pyramid.argb(level, cy0 + static_cast<std::size_t>(row), cx0, cx1,
+                     reinterpret_cast<std::uint32_t *>(density.scanLine(row)));
+    }
+    const Box first = pyramid.cell_box(level, cx0, cy0), last = pyramid.cell_box(level, cx1, cy1);
+    painter->drawImage(to_rect(Box{first.x0, first.y0, last.x1, last.y1}), density);
+}
+
+// Paint the draws of 'drawing' that show in 'exposed'. It only reads
+// 'drawing', so tile workers call it too, each with its own scratch.
+static void paint_drawing(const DisplayListItem::Drawing &drawing, QPainter *painter, const QRectF &exposed,
+                          const bool detailed, std::vector<SpatialIndex::Draw> &visible, QImage &density) {
+    const DisplayList &list = drawing.list;
+    const Box area{exposed.left(), exposed.top(), exposed.right(), exposed.bottom()};
+    const qreal scale = QStyleOptionGraphicsItem::levelOfDetailFromTransform(painter->worldTransform());
+    const qreal pixel = scale > 0 ? 1 / scale : 1;
+    const DensityPyramid &pyramid = drawing.pyramid;
+    const std::size_t level = detailed ? pyramid.levels() : pyramid.level_for(pixel);
+    if (level < pyramid.levels()) {
+        // too many draws per pixel to paint one by one: their density,
+        // then what is too large for its cells
+        paint_density(painter, pyramid, level, area, density);
+        pyramid.large_draws(level, area, visible);
+        RunPainter runs(painter, list, pixel);
+        paint_draws(runs, list, visible);
+        return;
+    }
+
+    RunPainter runs(painter, list, pixel);
+    if (drawing.index.empty() || exposed.contains(to_rect(drawing.index.bounds()))) {
+        for (const DisplayList::Run &run: list.runs()) {
+            for (std::uint32_t i = run.first; i < run.first + run.count; ++i) {
+                runs.add(run.type, i);
+            }
+        }
+        return;
+    }
+
+    // only the draws that can show in the exposed region
+    drawing.index.query(area, visible);
+    paint_draws(runs, list, visible);
+}
+
+DisplayListItem::DisplayListItem(const DisplayList &drawn, QGraphicsItem *parent) : QGraphicsItem(parent) {
+    // built in place: the index and pyramid point into the list
+    const std::shared_ptr<Drawing> built = std::make_shared<Drawing>();
+    built->list = drawn;
+    built->index.build(built->list, PointRadius);
+    built->pyramid.build(built->list, built->index, 2 * PointRadius);
+    drawing = built;
+    box = drawing->index.empty() ? QRectF() : to_rect(drawing->index.bounds());
+    setFlag(ItemUsesExtendedStyleOption); // for option->exposedRect
+}
+
+DisplayListItem::~DisplayListItem() {
+    if (tiles) {
+        tiles->removeLayer(layer);
+    }
+}
+
+QRectF DisplayListItem::boundingRect() const {
+    return box;
+}
+
+bool DisplayListItem::contains(const QPointF &point) const {
+    if (!box.contains(point)) {
+        return false;
+    }
+    drawing->index.hit_test(Point{point.x(), point.y()}, PointRadius, hits);
+    return !hits.empty();
+}
+
+void DisplayListItem::primitivesAt(const QPointF &point, std::vector<SpatialIndex::Draw> &draws) const {
+    drawing->index.hit_test(Point{point.x(), point.y()}, PointRadius, draws);
+}
+
+void DisplayListItem::setDetailed(const bool on) {
+    detailed = on;
+    addLayer();
+    update();
+}
+
+void DisplayListItem::setTileRenderer(TileRenderer *renderer) {
+    if (tiles) {
+        tiles->removeLayer(layer);
+    }
+    tiles = renderer;
+    addLayer();
+    update();
+}
+
+void DisplayListItem::addLayer() {
+    if (!tiles) {
+        return;
+    }
+    tiles->removeLayer(layer);
+    const std::shared_ptr<const Drawing> shared = drawing;
+    const bool all = detailed;
+    layer = tiles->addLayer(this, [shared, all](QPainter *painter, const QRectF &area) {
+        std::vector<SpatialIndex::Draw> visible;
+        QImage density;
+        paint_drawing(*shared, painter, area, all, visible, density);
+    });
+}
+
+void DisplayListItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget) {
+    if (tiles && tiles->paint(layer, painter, option->exposedRect, widget)) {
+        return;
+    }
+    paint_drawing(*drawing, painter, option->exposedRect, detailed, visible, density);
+}
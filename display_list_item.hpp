@@ -0,0 +1,95 @@
+#ifndef DISPLAY_LIST_ITEM_HPP
+#define DISPLAY_LIST_ITEM_HPP
+
+#include <QGraphicsItem>
+#include <QImage>
+#include <QPointer>
+#include <QRectF>
+
+#include <memory>
+#include <vector>
+
+#include "display_list.hpp"
+#include "level_of_detail.hpp"
+#include "spatial_index.hpp"
+#include "tile_renderer.hpp"
+
+// One scene item for a whole display list. It keeps its own copy of the
+// packed arrays and paints them run by run, in draw order, with a batched
+// QPainter call per run where one exists (drawPoints, drawLines,
+// drawRects). The scene indexes one bounding box instead of one per
+// primitive, so it scales to drawings of millions of primitives; its own
+// SpatialIndex limits painting to the exposed region and answers picking.
+//
+// Zoomed out to more than about a draw per pixel, it paints the density
+// of the draws smaller than a pixel from a DensityPyramid, one image per
+// frame, and only the larger draws one by one, so the frame time follows
+// the pixels shown rather than the draws. Arcs are tessellated and paths
+// decimated to the pixel size at every zoom.
+//
+// With a TileRenderer set, the view's viewport is painted from tiles its
+// worker threads rasterize, so panning blits images instead of painting
+// draws; any other painter gets the draws.
+class DisplayListItem : public QGraphicsItem {
+public:
+    enum { Type = UserType + 1 };
+
+    explicit DisplayListItem(const DisplayList &drawn, QGraphicsItem *parent = nullptr);
+
+    ~DisplayListItem() override;
+
+    int type() const override { return Type; }
+
+    // Precomputed from the primitives' bounds
+    QRectF boundingRect() const override;
+
+    // Is some primitive under 'point'? Used by QGraphicsScene::itemAt
+    bool contains(const QPointF &point) const override;
+
+    // Set 'draws' to the primitives under 'point', topmost last; see
+    // SpatialIndex::hit_test
+    void primitivesAt(const QPointF &point, std::vector<SpatialIndex::Draw> &draws) const;
+
+    void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget) override;
+
+    const DisplayList &displayList() const noexcept { return drawing->list; }
+
+    const SpatialIndex &spatialIndex() const noexcept { return drawing->index; }
+
+    // Paint every draw, whatever the zoom, instead of densities when
+    // zoomed out; off by default
+    void setDetailed(bool on);
+
+    bool isDetailed() const noexcept { return detailed; }
+
+    // Paint from the tiles of 'renderer', or directly if null
+    void setTileRenderer(TileRenderer *renderer);
+
+    TileRenderer *tileRenderer() const { return tiles; }
+
+    // What the item paints. Tile workers share it, so it never changes
+    // once built.
+    struct Drawing {
+        DisplayList list;
+        SpatialIndex index; // over 'list'
+        DensityPyramid pyramid; // over 'list' and 'index'
+    };
+
+private:
+    // (re)register with 'tiles' as a layer
+    void addLayer();
+
+    std::shared_ptr<const Drawing> drawing;
+    QRectF box;
+    bool detailed = false;
+
+    QPointer<TileRenderer> tiles;
+    TileRenderer::Layer layer = 0;
+
+    // scratch for queries
+    mutable std::vector<SpatialIndex::Draw> hits;
+    std::vector<SpatialIndex::Draw> visible;
+    QImage density;
+};
+
+#endif
@@ -2,10 +2,12 @@
 #define ENVIRONMENT_HPP
 
 // system includes
-#include <unordered_map>
+#include <cstddef>
 #include <utility>
+#include <vector>
 
 // module includes
+#include "builtins.hpp"
 #include "expression.hpp"
 
 class Environment {
@@ -14,36 +16,99 @@ public:
 
     void reset();
 
-    void define(const Symbol &name, const Expression &value);
+    // A point in the environment's history to roll back to. Taking one is
+    // O(1); rolling back undoes the definitions made since, newest first,
+    // so it costs O(definitions since the checkpoint) however large the
+    // environment is. Definitions are journaled only once a checkpoint has
+    // been taken, so an environment never checkpointed keeps no history.
+    // Once checkpointed, every define() adds an entry that stays until a
+    // commit() drops it: callers commit as soon as no older checkpoint can
+    // be needed, e.g. after each eval that succeeded, which bounds the
+    // journal, and the cost of a rollback, by one eval's definitions.
+    struct Checkpoint {
+        std::size_t journal; // definitions journaled before it, commits included
+    };
+
+    Checkpoint checkpoint() noexcept {
+        journaling = true;
+        return Checkpoint{committed + journal.size()};
+    }
+
+    // 'to' must not be older than the last commit()
+    void rollback(Checkpoint to);
+
+    // Forget the history before 'to', which can no longer be rolled back
+    // past; with 'to' the latest checkpoint, this empties the journal
+    void commit(Checkpoint to);
+
+    // 'value' is taken by value so temporaries are moved into the slot
+    void define(SymbolRef name, Expression value);
+
+    bool is_symbol_bound(SymbolRef name) const;
+
+    // The bound value itself, valid until the next define() or reset()
+    const Expression &get_symbol(SymbolRef name) const;
+
+    bool is_procedure(SymbolRef name) const;
 
-    bool is_symbol_bound(const Symbol &name) const;
+    bool is_reserved(SymbolRef name) const;
 
-    Expression get_symbol(const Symbol &name) const;
+    const Builtin &get_procedure(SymbolRef name) const;
 
-    bool is_procedure(const Symbol &name) const;
+    // Value bound to 'name', or nullptr if it has none
+    const Expression *lookup(const SymbolRef name) const noexcept {
+        const EnvResult *slot = find(name);
+        return slot && slot->type == ExpressionType ? &slot->exp : nullptr;
+    }
 
-    bool is_reserved(const Symbol &name) const;
+    // Builtin procedure named 'name', or nullptr if there is none
+    const Builtin *lookup_builtin(const SymbolRef name) const noexcept {
+        const EnvResult *slot = find(name);
+        return slot && slot->type == ProcedureType ? slot->builtin : nullptr;
+    }
 
-    Procedure get_procedure(const Symbol &name) const;
+    // Append the storage of every Batch bound to a symbol, or held by the
+    // journal to be restored by a rollback
+    void bound_batches(std::vector<const BatchStorage *> &out) const;
 
 private:
-    enum EnvResultType { ExpressionType, ProcedureType };
+    enum EnvResultType { UnboundType, ExpressionType, ProcedureType };
 
     struct EnvResult {
         EnvResultType type{};
         Expression exp;
-        Procedure proc{};
+        const Builtin *builtin{};
 
         EnvResult() = default;
 
         EnvResult(const EnvResultType eType, Expression eExp) : type(eType), exp(std::move(eExp)) {
         }
 
-        EnvResult(const EnvResultType eType, const Procedure eProc) : type(eType), exp(Expression()), proc(eProc) {
+        EnvResult(const EnvResultType eType, const Builtin *eBuiltin) : type(eType), exp(Expression()), builtin(eBuiltin) {
         }
     };
 
-    std::unordered_map<Symbol, EnvResult> envmap;
+    // One slot per interned symbol, indexed by SymbolId: symbols are
+    // resolved to their slot when they are interned at parse time, so a
+    // lookup is a single indexed load. Ids past the end are unbound.
+    // Not named 'slots': Qt defines that as a macro, and the GUI
+    // includes this header.
+    std::vector<EnvResult> bindings;
+
+    // Undo log: each define records the slot it wrote and what it held,
+    // from the first checkpoint() on; 'committed' entries were dropped
+    // from its front
+    std::vector<std::pair<SymbolId, EnvResult>> journal;
+    std::size_t committed = 0;
+    bool journaling = false;
+
+    const EnvResult *find(const SymbolRef name) const noexcept {
+        return name.id() < bindings.size() ? &bindings[name.id()] : nullptr;
+    }
+
+    // The builtin bindings every environment starts from, built once so
+    // reset() is a plain copy
+    static const std::vector<EnvResult> &initial_bindings();
 };
 
 #endif
@@ -1,10 +1,13 @@
 #include "expression.hpp"
 
 #include <cmath>
+#include <cstdint>
 #include <limits>
+#include <locale>
 #include <cctype>
 #include <sstream>
 #include <tuple>
+#include <utility>
 
 bool tol_eq(const double a, const double b) {
     constexpr double eps = std::numeric_limits<double>::epsilon();
@@ -12,6 +15,18 @@ bool tol_eq(const double a, const double b) {
     return diff <= eps;
 }
 
+bool operator==(const SymbolRef &lhs, const Symbol &rhs) {
+    return lhs.str() == rhs;
+}
+
+bool operator==(const SymbolRef &lhs, const char *rhs) {
+    return lhs.str() == rhs;
+}
+
+std::ostream &operator<<(std::ostream &out, const SymbolRef &sym) {
+    return out << sym.str();
+}
+
 std::ostream &print_point(std::ostream &out, const Point &p) {
     out << "(" << p.x << "," << p.y << ")";
     return out;
@@ -95,9 +110,74 @@ Expression::Expression(const Ellipse &ellipse) {
     head.value.ellipse_value = ellipse;
 }
 
+Expression::Expression(const Batch &batch) {
+    head.type = BatchType;
+    head.value.batch_value = batch;
+}
 
+
+Expression::~Expression() {
+    if (tail.get_allocator().arena()) {
+        return; // the arena frees it, and its tails never reach the heap
+    }
+    bool nested = false;
+    for (const auto &child: tail) {
+        if (!child.tail.empty()) {
+            nested = true;
+            break;
+        }
+    }
+    if (!nested) {
+        return; // only atoms below: default destruction is shallow
+    }
+
+    Tail pending;
+    pending.swap(tail);
+    while (!pending.empty()) {
+        Tail children;
+        children.swap(pending.back().tail);
+        pending.pop_back(); // now an atom
+        if (children.get_allocator().arena()) {
+            continue;
+        }
+        for (auto &child: children) {
+            if (!child.tail.empty()) {
+                pending.push_back(std::move(child));
+            }
+        }
+    }
+}
+
+static bool heads_equal(const Atom &lhs, const Atom &rhs) noexcept;
+
+// Compares whole trees with an explicit stack, not recursively
 bool Expression::operator==(const Expression &exp) const noexcept {
-    if (head.type != exp.head.type) {
+    if (tail.empty() && exp.tail.empty()) {
+        return heads_equal(head, exp.head);
+    }
+
+    std::vector<std::pair<const Expression *, const Expression *> > pending;
+    pending.emplace_back(this, &exp);
+    while (!pending.empty()) {
+        const Expression &a = *pending.back().first;
+        const Expression &b = *pending.back().second;
+        pending.pop_back();
+
+        if (!heads_equal(a.head, b.head)) {
+            return false;
+        }
+        if (a.tail.size() != b.tail.size()) {
+            return false;
+        }
+        for (std::size_t i = a.tail.size(); i-- > 0;) {
+            pending.emplace_back(&a.tail[i], &b.tail[i]);
+        }
+    }
+    return true;
+}
+
+static bool heads_equal(const Atom &head, const Atom &other) noexcept {
+    if (head.type != other.type) {
         return false;
     }
 
@@ -106,32 +186,32 @@ bool Expression::operator==(const Expression &exp) const noexcept {
             break;
 
         case BooleanType:
-            if (head.value.bool_value != exp.head.value.bool_value) {
+            if (head.value.bool_value != other.value.bool_value) {
                 return false;
             }
             break;
 
         case NumberType: {
-            if (!tol_eq(head.value.num_value, exp.head.value.num_value)) {
+            if (!tol_eq(head.value.num_value, other.value.num_value)) {
                 return false;
             }
             break;
         }
 
         case SymbolType:
-            if (head.value.sym_value != exp.head.value.sym_value) {
+            if (head.value.sym_value != other.value.sym_value) {
                 return false;
             }
             break;
 
         case PointType: {
-            const Point &a = head.value.point_value, &b = exp.head.value.point_value;
+            const Point &a = head.value.point_value, &b = other.value.point_value;
             if (!tol_eq(a.x, b.x) || !tol_eq(a.y, b.y)) return false;
             break;
         }
 
         case LineType: {
-            const Line &a = head.value.line_value, &b = exp.head.value.line_value;
+            const Line &a = head.value.line_value, &b = other.value.line_value;
             if (!tol_eq(a.start.x, b.start.x) || !tol_eq(a.start.y, b.start.y) ||
                 !tol_eq(a.end.x, b.end.x) || !tol_eq(a.end.y, b.end.y))
                 return false;
@@ -139,7 +219,7 @@ bool Expression::operator==(const Expression &exp) const noexcept {
         }
 
         case ArcType: {
-            const Arc &a = head.value.arc_value, &b = exp.head.value.arc_value;
+            const Arc &a = head.value.arc_value, &b = other.value.arc_value;
             if (!tol_eq(a.center.x, b.center.x) || !tol_eq(a.center.y, b.center.y) ||
                 !tol_eq(a.start.x, b.start.x) || !tol_eq(a.start.y, b.start.y) ||
                 !tol_eq(a.angle, b.angle))
@@ -148,7 +228,7 @@ bool Expression::operator==(const Expression &exp) const noexcept {
         }
 
         case RectType: {
-            const Rect &a = head.value.rect_value, &b = exp.head.value.rect_value;
+            const Rect &a = head.value.rect_value, &b = other.value.rect_value;
             if (!tol_eq(a.point1.x, b.point1.x) || !tol_eq(a.point1.y, b.point1.y) ||
                 !tol_eq(a.point2.x, b.point2.x) || !tol_eq(a.point2.y, b.point2.y))
                 return false;
@@ -156,7 +236,7 @@ bool Expression::operator==(const Expression &exp) const noexcept {
         }
 
         case FillRectType: {
-            const FillRect &a = head.value.fill_rect_value, &b = exp.head.value.fill_rect_value;
+            const FillRect &a = head.value.fill_rect_value, &b = other.value.fill_rect_value;
             const Rect &ar = a.rect, &br = b.rect;
             if (!tol_eq(ar.point1.x, br.point1.x) || !tol_eq(ar.point1.y, br.point1.y) ||
                 !tol_eq(ar.point2.x, br.point2.x) || !tol_eq(ar.point2.y, br.point2.y) ||
@@ -166,19 +246,27 @@ bool Expression::operator==(const Expression &exp) const noexcept {
         }
 
         case EllipseType: {
-            const Rect &a = head.value.ellipse_value.rect, &b = exp.head.value.ellipse_value.rect;
+            const Rect &a = head.value.ellipse_value.rect, &b = other.value.ellipse_value.rect;
             if (!tol_eq(a.point1.x, b.point1.x) || !tol_eq(a.point1.y, b.point1.y) ||
                 !tol_eq(a.point2.x, b.point2.x) || !tol_eq(a.point2.y, b.point2.y))
                 return false;
             break;
         }
-    }
 
-    // TODO: check if this is even required
-    if (tail.size() != exp.tail.size()) return false;
-    for (std::size_t i = 0; i < tail.size(); ++i) {
-        if (!(tail[i] == exp.tail[i])) return false;
+        case BatchType: {
+            const Batch &a = head.value.batch_value, &b = other.value.batch_value;
+            if (a.kind != b.kind || a.count != b.count) {
+                return false;
+            }
+            for (std::uint32_t i = 0; i < a.count; ++i) {
+                if (!tol_eq(a.xs[i], b.xs[i]) || !tol_eq(a.ys[i], b.ys[i])) {
+                    return false;
+                }
+            }
+            break;
+        }
     }
+
     return true;
 }
 
@@ -234,10 +322,192 @@ std::ostream &operator<<(std::ostream &out, const Expression &exp) {
             print_rect(out, h.value.ellipse_value.rect);
             out << ")";
             break;
+
+        case BatchType: {
+            // (polyline (0,0) (1,1) (2,0))
+            static const char *const kinds[] = {"points", "polyline", "lines", "polygon"};
+            const Batch &batch = h.value.batch_value;
+            out << "(" << kinds[batch.kind];
+            for (std::uint32_t i = 0; i < batch.count; ++i) {
+                out << " ";
+                print_point(out, batch.vertex(i));
+            }
+            out << ")";
+            break;
+        }
     }
     return out;
 }
 
+void write_atom(std::ostream &out, const Atom &atom) {
+    switch (atom.type) {
+        case BooleanType:
+            out << (atom.value.bool_value ? "True" : "False");
+            break;
+        case NumberType:
+            out << atom.value.num_value;
+            break;
+        case SymbolType:
+            out << atom.value.sym_value;
+            break;
+        default:
+            out << Expression(atom);
+            break;
+    }
+}
+
+void write_source(std::ostream &out, const Expression &exp) {
+    // iterative, like the destructor: deep ASTs must not overflow the stack
+    std::vector<std::pair<const Expression *, std::size_t>> pending;
+    pending.emplace_back(&exp, 0);
+    while (!pending.empty()) {
+        const Expression &e = *pending.back().first;
+        std::size_t &next = pending.back().second;
+        if (e.tailIsEmpty()) {
+            write_atom(out, e.getHead());
+            pending.pop_back();
+            continue;
+        }
+        if (next < e.tailSize()) {
+            out << (next == 0 ? "(" : " ");
+            pending.emplace_back(&e.getTail()[next++], 0);
+            continue;
+        }
+        out << " ";
+        write_atom(out, e.getHead());
+        out << ")";
+        pending.pop_back();
+    }
+}
+
+bool is_graphic_atom(const Expression &e) {
+    return e.tailIsEmpty() && (
+               e.headType() == PointType ||
+               e.headType() == LineType ||
+               e.headType() == ArcType ||
+               e.headType() == RectType ||
+               e.headType() == FillRectType ||
+               e.headType() == EllipseType ||
+               e.headType() == BatchType
+           );
+}
+
+// Powers of ten that doubles hold exactly
+static const double exact_powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static bool is_digit(const char c) {
+    return c >= '0' && c <= '9';
+}
+
+// isspace() in the "C" locale
+static bool is_space(const char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+// The original recognizer: read a double with a stream and require that it
+// consumed the whole token. Now only used for the values parse_number()
+// cannot round exactly itself.
+static bool stream_number(const std::string &token, double &value) {
+    std::istringstream iss(token);
+    iss.imbue(std::locale::classic());
+    iss.setf(std::ios::fmtflags(0), std::ios::basefield);
+    return (iss >> value) && iss.rdbuf()->in_avail() == 0;
+}
+
+// Accepts exactly the tokens stream_number() accepts, with the same value,
+// without building a stream: optional leading whitespace, then
+//   [+-]? digits* ('.' digits*)? ([eE] [+-]? digits+)?
+// with at least one mantissa digit and a finite value. Independent of the
+// global locale. A mantissa of up to 15 significant digits scaled by at
+// most 10^22 is rounded exactly by one multiplication or division, which
+// covers the literals in practice; anything longer goes to stream_number().
+static bool parse_number(const std::string &token, double &value) {
+    const char *p = token.data();
+    const char *const end = p + token.size();
+    while (p != end && is_space(*p)) {
+        ++p;
+    }
+
+    bool negative = false;
+    if (p != end && (*p == '+' || *p == '-')) {
+        negative = *p == '-';
+        ++p;
+    }
+
+    std::uint64_t mantissa = 0;
+    int significant = 0;
+    int scale = 0; // power of ten the mantissa is to be multiplied by
+    bool digits = false;
+    for (; p != end && is_digit(*p); ++p) {
+        digits = true;
+        if (mantissa != 0 || *p != '0') {
+            if (significant < 19) {
+                mantissa = mantissa * 10 + static_cast<unsigned>(*p - '0');
+            } else {
+                ++scale; // dropped; stream_number() will round
+            }
+            ++significant;
+        }
+    }
+    if (p != end && *p == '.') {
+        for (++p; p != end && is_digit(*p); ++p) {
+            digits = true;
+            if (mantissa != 0 || *p != '0') {
+                if (significant < 19) {
+                    mantissa = mantissa * 10 + static_cast<unsigned>(*p - '0');
+                    --scale;
+                }
+                ++significant;
+            } else {
+                --scale;
+            }
+        }
+    }
+    if (!digits) {
+        return false;
+    }
+
+    int exponent = 0;
+    if (p != end && (*p == 'e' || *p == 'E')) {
+        ++p;
+        bool negativeExponent = false;
+        if (p != end && (*p == '+' || *p == '-')) {
+            negativeExponent = *p == '-';
+            ++p;
+        }
+        if (p == end || !is_digit(*p)) {
+            return false;
+        }
+        for (; p != end && is_digit(*p); ++p) {
+            if (exponent < 100000) { // far past any finite double either way
+                exponent = exponent * 10 + (*p - '0');
+            }
+        }
+        if (negativeExponent) {
+            exponent = -exponent;
+        }
+    }
+    if (p != end) {
+        return false;
+    }
+
+    if (mantissa == 0) {
+        value = negative ? -0.0 : 0.0;
+        return true;
+    }
+    const long power = static_cast<long>(scale) + exponent;
+    if (significant <= 15 && power >= -22 && power <= 22) {
+        const double m = static_cast<double>(mantissa);
+        const double v = power < 0 ? m / exact_powers_of_ten[-power] : m * exact_powers_of_ten[power];
+        value = negative ? -v : v;
+        return true;
+    }
+    return stream_number(token, value);
+}
+
 bool token_to_atom(const std::string &token, Atom &atom) {
     if (token == "True") {
         atom.type = BooleanType;
@@ -259,10 +529,8 @@ bool token_to_atom(const std::string &token, Atom &atom) {
     }
 
     // Number
-    std::istringstream iss(token);
-    iss.setf(std::ios::fmtflags(0), std::ios::basefield);
     double temp;
-    if ((iss >> temp) && iss.rdbuf()->in_avail() == 0) {
+    if (parse_number(token, temp)) {
         atom.type = NumberType;
         atom.value.num_value = temp;
         return true;
@@ -2,16 +2,24 @@
 #define TYPES_HPP
 
 // system includes
+#include <cstddef>
+#include <cstdint>
 #include <tuple>
 #include <ostream>
 #include <string>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
+// module includes
+#include "arena.hpp"
+#include "symbol_table.hpp"
+
 
 enum Type {
     NoneType, BooleanType, NumberType, SymbolType,
-    PointType, LineType, ArcType, RectType, FillRectType, EllipseType
+    PointType, LineType, ArcType, RectType, FillRectType, EllipseType,
+    BatchType
 };
 
 // Base Types
@@ -19,6 +27,47 @@ typedef bool Boolean;
 typedef double Number;
 typedef std::string Symbol;
 
+// Handle to an interned Symbol. The text lives out of line in the global
+// SymbolTable, so a handle is a small integer id, equal symbols have equal
+// ids, and an Atom holding a symbol stays trivially copyable.
+class SymbolRef {
+public:
+    SymbolRef() noexcept : sym_id(SymEmpty) {
+    }
+
+    SymbolRef(BuiltinSymbol id) noexcept : sym_id(id) {
+    }
+
+    // not explicit: a Symbol can be assigned to sym_value directly
+    SymbolRef(const Symbol &sym) : sym_id(SymbolTable::global().intern(sym)) {
+    }
+
+    static SymbolRef fromId(SymbolId id) noexcept {
+        SymbolRef sym;
+        sym.sym_id = id;
+        return sym;
+    }
+
+    SymbolId id() const noexcept { return sym_id; }
+
+    const Symbol &str() const { return SymbolTable::global().name(sym_id); }
+
+    operator const Symbol &() const { return str(); }
+
+    bool operator==(const SymbolRef &other) const noexcept { return sym_id == other.sym_id; }
+    bool operator!=(const SymbolRef &other) const noexcept { return sym_id != other.sym_id; }
+
+private:
+    SymbolId sym_id;
+};
+
+bool operator==(const SymbolRef &lhs, const Symbol &rhs);
+bool operator==(const SymbolRef &lhs, const char *rhs);
+inline bool operator!=(const SymbolRef &lhs, const Symbol &rhs) { return !(lhs == rhs); }
+inline bool operator!=(const SymbolRef &lhs, const char *rhs) { return !(lhs == rhs); }
+
+std::ostream &operator<<(std::ostream &out, const SymbolRef &sym);
+
 // Geometric Types
 struct Point {
     Number x;
@@ -53,10 +102,42 @@ struct Ellipse {
     Rect rect; // the smallest rectangle that can contain the Ellipse
 };
 
-struct Value {
+// How the vertices of a Batch are drawn
+enum BatchKind : std::uint32_t {
+    PointsBatch,   // each vertex as a point
+    PolylineBatch, // an open path through the vertices
+    LinesBatch,    // a segment per pair of vertices
+    PolygonBatch   // a closed path through the vertices
+};
+
+struct BatchStorage;
+
+// Many vertices made by one call of points, polyline, lines or polygon and
+// drawn as one graphic. The vertices are packed out of line in the
+// evaluating Interpreter's BatchTable (see geometry_batch.hpp), so a Batch
+// is a small handle and an Atom holding one stays trivially copyable.
+// Coordinates are stored as structure of arrays, all x then all y, for the
+// transform kernels.
+struct Batch {
+    BatchKind kind;
+    std::uint32_t count;
+    const Number *xs;
+    const Number *ys;
+    const BatchStorage *storage; // the block holding xs and ys
+
+    Point vertex(std::uint32_t i) const noexcept { return Point{xs[i], ys[i]}; }
+};
+
+// Payload of an Atom; Atom::type says which member is active. The union is
+// as large as its largest geometric member (FillRect) and a fresh Value is
+// all zero bytes.
+union Value {
+    Value() noexcept : fill_rect_value() {
+    }
+
     Boolean bool_value;
     Number num_value;
-    Symbol sym_value;
+    SymbolRef sym_value;
 
     Point point_value;
     Line line_value;
@@ -64,6 +145,7 @@ struct Value {
     Rect rect_value;
     FillRect fill_rect_value;
     Ellipse ellipse_value;
+    Batch batch_value;
 };
 
 
@@ -72,13 +154,39 @@ struct Atom {
     Value value;
 };
 
+static_assert(std::is_trivially_copyable<Atom>::value, "Atom must stay trivially copyable");
+static_assert(sizeof(Value) == sizeof(FillRect), "Value must be sized to its largest payload");
+
 
 class Expression {
 public:
+    // Children of a list. A parsed AST keeps them in the interpreter's
+    // arena; anything built otherwise keeps them on the heap.
+    //
+    // An arena tail never runs its children's destructors, so a child's
+    // own tail must be empty or in the same arena: a heap tail moved into
+    // an arena tree would leak. The parser builds every tail in one arena,
+    // and the optimizer only moves nodes within the tree or puts atoms in;
+    // arena_holds() below checks it in debug builds.
+    typedef std::vector<Expression, ArenaAllocator<Expression> > Tail;
+
     // Default construct an Expression of type None
     Expression() : head{NoneType} {
     };
 
+    // Destroys nested tails from a work list rather than recursively, so
+    // arbitrarily deep trees cannot exhaust the native stack. A tail in an
+    // arena is left to the arena, which releases the whole tree at once.
+    ~Expression();
+
+    Expression(const Expression &) = default;
+
+    Expression(Expression &&) = default;
+
+    Expression &operator=(const Expression &) = default;
+
+    Expression &operator=(Expression &&) = default;
+
     // Construct an Expression with a single Boolean atom with value
     explicit Expression(bool tf);
 
@@ -118,6 +226,8 @@ public:
 
     explicit Expression(const Ellipse &ellipse);
 
+    explicit Expression(const Batch &batch);
+
     bool isList() const noexcept { return !tail.empty(); }
     Type headType() const noexcept { return head.type; }
     Value headValue() const noexcept { return head.value; }
@@ -125,21 +235,72 @@ public:
     const Atom &getHead() const noexcept { return head; }
     bool tailIsEmpty() const noexcept { return tail.empty(); }
     size_t tailSize() const noexcept { return tail.size(); }
-    std::vector<Expression> &getTail() noexcept { return tail; }
-    const std::vector<Expression> &getTail() const noexcept { return tail; }
+    Tail &getTail() noexcept { return tail; }
+    const Tail &getTail() const noexcept { return tail; }
 
     bool operator==(const Expression &exp) const noexcept;
 
     friend std::ostream &operator<<(std::ostream &out, const Expression &e);
 
     Atom head;
-    std::vector<Expression> tail;
+    Tail tail;
 };
 
+// An Expression in 'arena' leaks nothing when its destructor is skipped if
+// its tail holds no memory or holds it in 'arena' too; see Expression::Tail
+inline bool arena_holds(const Arena *arena, const Expression &exp) noexcept {
+    return exp.tail.capacity() == 0 || exp.tail.get_allocator().arena() == arena;
+}
+
+
+// Arguments of a procedure call: a read-only view of 'count' Atoms that
+// live on the interpreter's reusable value stack, so a call allocates
+// nothing. Only valid for the duration of the call.
+class ArgSpan {
+public:
+    ArgSpan(const Atom *first, std::size_t count) noexcept : first(first), count(count) {
+    }
+
+    // view of a whole vector, for calling a Procedure directly
+    ArgSpan(const std::vector<Atom> &args) noexcept : first(args.data()), count(args.size()) {
+    }
+
+    std::size_t size() const noexcept { return count; }
+    bool empty() const noexcept { return count == 0; }
+    const Atom &operator[](std::size_t i) const noexcept { return first[i]; }
+    const Atom *begin() const noexcept { return first; }
+    const Atom *end() const noexcept { return first + count; }
+
+private:
+    const Atom *first;
+    std::size_t count;
+};
 
 // A Procedure is a C++ function pointer taking
-// a vector of Atoms as arguments
-typedef Expression (*Procedure)(const std::vector<Atom> &args);
+// a span of Atoms as arguments
+typedef Expression (*Procedure)(ArgSpan args);
+
+// The original calling convention, taking a vector of Atoms
+typedef Expression (*VectorProcedure)(const std::vector<Atom> &args);
+
+// Adapts a VectorProcedure to the Procedure convention by copying the
+// arguments into a vector on each call, e.g. vector_procedure<&my_proc>
+template<VectorProcedure proc>
+Expression vector_procedure(ArgSpan args) {
+    return proc(std::vector<Atom>(args.begin(), args.end()));
+}
+
+// Is 'e' a single drawable atom (Point, Line, Arc, Rect, FillRect, Ellipse
+// or Batch)?
+bool is_graphic_atom(const Expression &e);
+
+// Write 'exp' out as postlisp source, lists in postfix order, e.g.
+// "((1 2 +) 3 *)"; geometric atoms, which have no literal syntax, are
+// written as operator<< prints them
+void write_source(std::ostream &out, const Expression &exp);
+
+// Write one atom as write_source() writes it
+void write_atom(std::ostream &out, const Atom &atom);
 
 // map a token to an Atom
 bool token_to_atom(const std::string &token, Atom &atom);
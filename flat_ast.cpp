@@ -0,0 +1,130 @@
+#include "flat_ast.hpp"
+
+#include <iterator>
+#include <utility>
+
+const FlatAst::Index FlatAst::Root;
+
+void FlatAst::build(const Expression &root) {
+    clear();
+
+    // payload 0 is the None payload; a symbol's payload is made once
+    values.push_back(Value());
+    const Index NoPayload = static_cast<Index>(-1);
+    std::vector<Index> symbolPayloads;
+
+    // nodes whose slots are allocated but not yet filled in
+    std::vector<std::pair<const Expression *, Index> > pending;
+
+    kinds.resize(1);
+    payloads.resize(1);
+    firsts.resize(1);
+    counts.resize(1);
+    pending.emplace_back(&root, Root);
+    while (!pending.empty()) {
+        const Expression &exp = *pending.back().first;
+        const Index node = pending.back().second;
+        pending.pop_back();
+
+        const Atom &head = exp.getHead();
+        kinds[node] = static_cast<std::uint8_t>(head.type);
+        if (head.type == NoneType) {
+            payloads[node] = 0;
+        } else if (head.type == SymbolType) {
+            const SymbolId id = head.value.sym_value.id();
+            if (id >= symbolPayloads.size()) {
+                symbolPayloads.resize(id + 1, NoPayload);
+            }
+            if (symbolPayloads[id] == NoPayload) {
+                symbolPayloads[id] = static_cast<Index>(values.size());
+                values.push_back(head.value);
+            }
+            payloads[node] = symbolPayloads[id];
+        } else {
+            payloads[node] = static_cast<Index>(values.size());
+            values.push_back(head.value);
+        }
+
+        const Index count = static_cast<Index>(exp.tailSize());
+        const Index first = count ? static_cast<Index>(kinds.size()) : 0;
+        firsts[node] = first;
+        counts[node] = count;
+        if (count == 0) {
+            continue;
+        }
+
+        // the children's slots, filled in as they come off the stack; the
+        // leftmost is pushed last so its subtree is laid out first
+        kinds.resize(first + count);
+        payloads.resize(first + count);
+        firsts.resize(first + count);
+        counts.resize(first + count);
+        const Expression::Tail &tail = exp.getTail();
+        for (Index i = count; i-- > 0;) {
+            pending.emplace_back(&tail[i], first + i);
+        }
+    }
+}
+
+void FlatAst::clear() {
+    kinds.clear();
+    payloads.clear();
+    firsts.clear();
+    counts.clear();
+    values.clear();
+}
+
+std::size_t FlatAst::bytes() const noexcept {
+    return kinds.size() * (sizeof(std::uint8_t) + 3 * sizeof(Index)) + values.size() * sizeof(Value);
+}
+
+Expression FlatAst::expression(const Index node) const {
+    // post-order on explicit stacks: a list is assembled once its children are
+    std::vector<std::pair<Index, Index> > pending; // node, next child
+    std::vector<Expression> done;
+    pending.emplace_back(node, 0);
+    while (!pending.empty()) {
+        const Index n = pending.back().first;
+        Index &next = pending.back().second;
+        if (next < counts[n]) {
+            pending.emplace_back(firsts[n] + next++, 0);
+            continue;
+        }
+        pending.pop_back();
+        Expression exp(atom(n));
+        if (counts[n] != 0) {
+            const auto children = done.end() - counts[n];
+            exp.getTail().assign(std::make_move_iterator(children), std::make_move_iterator(done.end()));
+            done.erase(children, done.end());
+        }
+        done.push_back(std::move(exp));
+    }
+    return std::move(done.back());
+}
+
+std::ostream &operator<<(std::ostream &out, const FlatAst &ast) {
+    if (ast.empty()) {
+        return out;
+    }
+    std::vector<std::pair<FlatAst::Index, FlatAst::Index> > pending; // node, next child
+    pending.emplace_back(FlatAst::Root, 0);
+    while (!pending.empty()) {
+        const FlatAst::Index node = pending.back().first;
+        FlatAst::Index &next = pending.back().second;
+        if (!ast.is_list(node)) {
+            write_atom(out, ast.atom(node));
+            pending.pop_back();
+            continue;
+        }
+        if (next < ast.count(node)) {
+            out << (next == 0 ? "(" : " ");
+            pending.emplace_back(ast.first(node) + next++, 0);
+            continue;
+        }
+        out << " ";
+        write_atom(out, ast.atom(node));
+        out << ")";
+        pending.pop_back();
+    }
+    return out;
+}
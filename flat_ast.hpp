@@ -0,0 +1,69 @@
+#ifndef FLAT_AST_HPP
+#define FLAT_AST_HPP
+
+// system includes
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+// module includes
+#include "expression.hpp"
+
+// An AST in a few flat arrays instead of nested Expressions: for each node
+// its kind, the index of its payload, and the range of its children. The
+// children of a list are adjacent, and the lists' ranges follow one another
+// depth first, so walking the tree reads the arrays mostly in order.
+//
+// A node costs 13 bytes plus its payload, which is shared by every node
+// with the same symbol, against the 96 of an Expression, and nothing is
+// reached through a pointer. Expression stays the form the parser and
+// optimizer build; FlatAst is built from it for evaluation.
+class FlatAst {
+public:
+    typedef std::uint32_t Index;
+
+    // The root, when the AST is not empty
+    static const Index Root = 0;
+
+    // Flatten 'root', on an explicit stack
+    void build(const Expression &root);
+
+    void clear();
+
+    bool empty() const noexcept { return kinds.empty(); }
+
+    std::size_t size() const noexcept { return kinds.size(); }
+
+    // Bytes of the arrays' contents
+    std::size_t bytes() const noexcept;
+
+    // A list's kind is SymbolType, its payload the operator
+    Type kind(const Index node) const noexcept { return static_cast<Type>(kinds[node]); }
+
+    const Value &payload(const Index node) const noexcept { return values[payloads[node]]; }
+
+    Atom atom(const Index node) const noexcept { return Atom{kind(node), payload(node)}; }
+
+    bool is_list(const Index node) const noexcept { return counts[node] != 0; }
+
+    // Children of a list are first(node) .. first(node) + count(node) - 1
+    Index first(const Index node) const noexcept { return firsts[node]; }
+
+    Index count(const Index node) const noexcept { return counts[node]; }
+
+    // Rebuild 'node' and its subtree as an Expression, e.g. for tests
+    Expression expression(Index node = Root) const;
+
+private:
+    std::vector<std::uint8_t> kinds;
+    std::vector<Index> payloads; // into values
+    std::vector<Index> firsts;
+    std::vector<Index> counts;
+    std::vector<Value> values;
+};
+
+// Write 'ast' out as postlisp source, as write_source() writes the
+// Expression it was built from
+std::ostream &operator<<(std::ostream &out, const FlatAst &ast);
+
+#endif
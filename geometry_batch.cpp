@@ -0,0 +1,49 @@
+#include "geometry_batch.hpp"
+
+#include <algorithm>
+#include <utility>
+
+BatchTable *BatchTable::active = nullptr;
+
+BatchTable &BatchTable::global() {
+    static BatchTable table;
+    return table;
+}
+
+Batch BatchTable::add(const BatchKind kind, const Atom *coords, const std::size_t count) {
+    Number *xs, *ys;
+    const Batch batch = add(kind, count / 2, xs, ys);
+    for (std::uint32_t i = 0; i < batch.count; ++i) {
+        xs[i] = coords[2 * i].value.num_value;
+        ys[i] = coords[2 * i + 1].value.num_value;
+    }
+    return batch;
+}
+
+Batch BatchTable::add(const BatchKind kind, const std::size_t vertices, Number *&xs, Number *&ys) {
+    // one block per batch: all x, then all y
+    std::shared_ptr<BatchStorage> storage = std::make_shared<BatchStorage>(vertices);
+    xs = storage->coords.get();
+    ys = storage->coords.get() + vertices;
+    const Batch batch{kind, static_cast<std::uint32_t>(vertices), xs, ys, storage.get()};
+    batches.push_back(std::move(storage));
+    total += vertices;
+    return batch;
+}
+
+void BatchTable::release_unkept(const std::size_t first, const std::vector<const BatchStorage *> &kept) {
+    std::size_t end = first;
+    for (std::size_t i = first; i < batches.size(); ++i) {
+        if (std::binary_search(kept.begin(), kept.end(), batches[i].get())) {
+            std::swap(batches[end++], batches[i]);
+        }
+    }
+    truncate(end);
+}
+
+void BatchTable::truncate(const std::size_t size) {
+    while (batches.size() > size) {
+        total -= batches.back()->vertices;
+        batches.pop_back();
+    }
+}
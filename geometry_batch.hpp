@@ -0,0 +1,91 @@
+#ifndef GEOMETRY_BATCH_HPP
+#define GEOMETRY_BATCH_HPP
+
+// system includes
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// module includes
+#include "expression.hpp"
+
+// The packed vertices of one Batch: all x, then all y. Shared so whatever
+// keeps a batch's draws (a DisplayList and its copies) keeps the vertices
+// alive after the table that made them lets go.
+struct BatchStorage : std::enable_shared_from_this<BatchStorage> {
+    explicit BatchStorage(std::size_t vertices) : vertices(vertices), coords(new Number[2 * vertices]) {}
+
+    std::size_t vertices;
+    std::unique_ptr<Number[]> coords;
+};
+
+// The vertices Batch handles point at, owned by the Interpreter whose eval
+// or constant folding made them; the handles stay valid wherever their
+// Atoms are copied (the environment, pending draws, bytecode constants)
+// until the table releases the batch, in truncate() or as it is
+// destroyed. Vertices never move once added. Not thread-safe: batches are
+// added while evaluating, which happens on one thread.
+class BatchTable {
+public:
+    BatchTable() = default;
+
+    BatchTable(const BatchTable &) = delete;
+
+    BatchTable &operator=(const BatchTable &) = delete;
+
+    BatchTable(BatchTable &&) = default;
+
+    BatchTable &operator=(BatchTable &&) = default;
+
+    // Holds batches made outside any Interpreter, e.g. by calling builtins
+    // directly; like interned symbols, they are never freed
+    static BatchTable &global();
+
+    // The table of the innermost Use alive, or global(); builtins add
+    // their batches here
+    static BatchTable &current() noexcept { return active ? *active : global(); }
+
+    // Makes a table current() for the scope of the Use
+    class Use {
+    public:
+        explicit Use(BatchTable &table) noexcept : previous(active) { active = &table; }
+
+        ~Use() { active = previous; }
+
+        Use(const Use &) = delete;
+
+        Use &operator=(const Use &) = delete;
+
+    private:
+        BatchTable *previous;
+    };
+
+    // A batch of 'kind' whose vertices are the x y pairs of the Number
+    // atoms coords[0, count); 'count' is even
+    Batch add(BatchKind kind, const Atom *coords, std::size_t count);
+
+    // A batch of 'kind' with room for 'vertices' vertices, whose coordinates
+    // the caller writes through 'xs' and 'ys' before using the Batch
+    Batch add(BatchKind kind, std::size_t vertices, Number *&xs, Number *&ys);
+
+    // Release every batch after the first 'batches'; their handles dangle
+    // unless a DisplayList still shares their storage
+    void truncate(std::size_t batches);
+
+    // Release the batches after the first 'first' whose storage is not in
+    // 'kept', sorted; those kept keep their order
+    void release_unkept(std::size_t first, const std::vector<const BatchStorage *> &kept);
+
+    std::size_t size() const noexcept { return batches.size(); }
+
+    // Vertices held by all batches
+    std::size_t vertices() const noexcept { return total; }
+
+private:
+    static BatchTable *active;
+
+    std::vector<std::shared_ptr<BatchStorage> > batches;
+    std::size_t total = 0;
+};
+
+#endif
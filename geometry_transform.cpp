@@ -0,0 +1,266 @@
+#include "geometry_transform.hpp"
+#include "geometry_batch.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+// SSE2 is part of x86-64, so it needs no runtime check. AVX2 is built
+// with a per-function target attribute, so the rest of the tree keeps the
+// default flags, and it is chosen at runtime only on CPUs that have it.
+#if defined(__SSE2__) || defined(_M_X64)
+#define TRANSFORM_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TRANSFORM_AVX2 1
+#define AVX2_TARGET __attribute__((target("avx2")))
+#include <immintrin.h>
+#endif
+
+Affine translation(const Number dx, const Number dy) {
+    return Affine{1, 0, 0, 1, dx, dy};
+}
+
+Affine scaling(const Number sx, const Number sy) {
+    return Affine{sx, 0, 0, sy, 0, 0};
+}
+
+Affine rotation(const Number angle) {
+    const Number c = std::cos(angle), s = std::sin(angle);
+    return Affine{c, -s, s, c, 0, 0};
+}
+
+// points [begin, count) one at a time; also the tail of the vector kernels
+static inline void transform_scalar(const Affine &m, const Number *xs, const Number *ys, Number *out_xs,
+                                    Number *out_ys, std::size_t begin, const std::size_t count) noexcept {
+    for (std::size_t i = begin; i < count; ++i) {
+        const Number x = xs[i], y = ys[i];
+        out_xs[i] = (m.a * x + m.b * y) + m.e;
+        out_ys[i] = (m.c * x + m.d * y) + m.f;
+    }
+}
+
+#ifdef TRANSFORM_SSE2
+static void transform_sse2(const Affine &m, const Number *xs, const Number *ys, Number *out_xs, Number *out_ys,
+                           const std::size_t count) noexcept {
+    const __m128d a = _mm_set1_pd(m.a), b = _mm_set1_pd(m.b), c = _mm_set1_pd(m.c);
+    const __m128d d = _mm_set1_pd(m.d), e = _mm_set1_pd(m.e), f = _mm_set1_pd(m.f);
+    std::size_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+        const __m128d x = _mm_loadu_pd(xs + i), y = _mm_loadu_pd(ys + i);
+        _mm_storeu_pd(out_xs + i, _mm_add_pd(_mm_add_pd(_mm_mul_pd(a, x), _mm_mul_pd(b, y)), e));
+        _mm_storeu_pd(out_ys + i, _mm_add_pd(_mm_add_pd(_mm_mul_pd(c, x), _mm_mul_pd(d, y)), f));
+    }
+    transform_scalar(m, xs, ys, out_xs, out_ys, i, count);
+}
+#endif
+
+#ifdef TRANSFORM_AVX2
+AVX2_TARGET static void transform_avx2(const Affine &m, const Number *xs, const Number *ys, Number *out_xs,
+                                       Number *out_ys, const std::size_t count) noexcept {
+    const __m256d a = _mm256_set1_pd(m.a), b = _mm256_set1_pd(m.b), c = _mm256_set1_pd(m.c);
+    const __m256d d = _mm256_set1_pd(m.d), e = _mm256_set1_pd(m.e), f = _mm256_set1_pd(m.f);
+    std::size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const __m256d x = _mm256_loadu_pd(xs + i), y = _mm256_loadu_pd(ys + i);
+        _mm256_storeu_pd(out_xs + i, _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(a, x), _mm256_mul_pd(b, y)), e));
+        _mm256_storeu_pd(out_ys + i, _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(c, x), _mm256_mul_pd(d, y)), f));
+    }
+    transform_scalar(m, xs, ys, out_xs, out_ys, i, count);
+}
+#endif
+
+bool kernel_available(const TransformKernel kernel) noexcept {
+    switch (kernel) {
+        case ScalarKernel:
+            return true;
+        case Sse2Kernel:
+#ifdef TRANSFORM_SSE2
+            return true;
+#else
+            return false;
+#endif
+        case Avx2Kernel:
+#ifdef TRANSFORM_AVX2
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2");
+#else
+            return false;
+#endif
+    }
+    return false;
+}
+
+TransformKernel best_transform_kernel() noexcept {
+    static const TransformKernel best = kernel_available(Avx2Kernel) ? Avx2Kernel
+                                        : kernel_available(Sse2Kernel) ? Sse2Kernel
+                                        : ScalarKernel;
+    return best;
+}
+
+void transform_points(const TransformKernel kernel, const Affine &m, const Number *xs, const Number *ys,
+                      Number *out_xs, Number *out_ys, const std::size_t count) noexcept {
+    switch (kernel) {
+#ifdef TRANSFORM_AVX2
+        case Avx2Kernel:
+            transform_avx2(m, xs, ys, out_xs, out_ys, count);
+            return;
+#endif
+#ifdef TRANSFORM_SSE2
+        case Sse2Kernel:
+            transform_sse2(m, xs, ys, out_xs, out_ys, count);
+            return;
+#endif
+        default:
+            transform_scalar(m, xs, ys, out_xs, out_ys, 0, count);
+    }
+}
+
+void transform_points(const Affine &m, const Number *xs, const Number *ys, Number *out_xs, Number *out_ys,
+                      const std::size_t count) noexcept {
+    transform_points(best_transform_kernel(), m, xs, ys, out_xs, out_ys, count);
+}
+
+Point transform_point(const Affine &m, const Point p) noexcept {
+    return Point{(m.a * p.x + m.b * p.y) + m.e, (m.c * p.x + m.d * p.y) + m.f};
+}
+
+bool is_transformable(const Atom &atom) noexcept {
+    switch (atom.type) {
+        case PointType:
+        case LineType:
+        case ArcType:
+        case RectType:
+        case FillRectType:
+        case EllipseType:
+        case BatchType:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Tolerance for the shape tests, relative to the size of 'm', so
+// rotation(pi / 2), whose cosine is a rounding error off zero, keeps axes
+static const Number ShapeTolerance = 1e-12;
+
+bool keeps_axes(const Affine &m) noexcept {
+    const Number diagonal = std::fabs(m.a) + std::fabs(m.d), off = std::fabs(m.b) + std::fabs(m.c);
+    return off <= ShapeTolerance * diagonal || diagonal <= ShapeTolerance * off;
+}
+
+bool is_similarity(const Affine &m) noexcept {
+    const Number size = std::fabs(m.a) + std::fabs(m.b) + std::fabs(m.c) + std::fabs(m.d);
+    return std::fabs(m.a - m.d) + std::fabs(m.b + m.c) <= ShapeTolerance * size || // rotation
+           std::fabs(m.a + m.d) + std::fabs(m.b - m.c) <= ShapeTolerance * size;   // reflection
+}
+
+// Vertices a full turn of a curve is sampled at when it becomes a batch
+static const int CurveSamples = 64;
+
+static Rect transform_rect(const Affine &m, const Rect &r) noexcept {
+    return Rect{transform_point(m, r.point1), transform_point(m, r.point2)};
+}
+
+// A PolygonBatch through the corners of 'r' mapped by 'm'
+static Batch rect_polygon(const Affine &m, const Rect &r) {
+    Number *xs, *ys;
+    const Batch batch = BatchTable::current().add(PolygonBatch, 4, xs, ys);
+    const Point corners[] = {r.point1, Point{r.point2.x, r.point1.y}, r.point2, Point{r.point1.x, r.point2.y}};
+    for (int i = 0; i < 4; ++i) {
+        xs[i] = corners[i].x;
+        ys[i] = corners[i].y;
+    }
+    transform_points(m, xs, ys, xs, ys, 4);
+    return batch;
+}
+
+// A PolygonBatch through points of the ellipse inscribed in 'r' mapped by
+// 'm'; the image of an ellipse is an ellipse, sampled at its mapped points
+static Batch ellipse_polygon(const Affine &m, const Rect &r) {
+    const Number cx = (r.point1.x + r.point2.x) / 2, cy = (r.point1.y + r.point2.y) / 2;
+    const Number rx = std::fabs(r.point2.x - r.point1.x) / 2, ry = std::fabs(r.point2.y - r.point1.y) / 2;
+    const Number step = 2 * std::atan2(0.0, -1.0) / CurveSamples;
+    Number *xs, *ys;
+    const Batch batch = BatchTable::current().add(PolygonBatch, CurveSamples, xs, ys);
+    for (int i = 0; i < CurveSamples; ++i) {
+        xs[i] = cx + rx * std::cos(i * step);
+        ys[i] = cy + ry * std::sin(i * step);
+    }
+    transform_points(m, xs, ys, xs, ys, CurveSamples);
+    return batch;
+}
+
+// A PolylineBatch along 'arc' mapped by 'm', sampled at CurveSamples per
+// turn and at both ends
+static Batch arc_polyline(const Affine &m, const Arc &arc) {
+    const Number turn = 2 * std::atan2(0.0, -1.0);
+    const int segments = std::max(2, static_cast<int>(std::ceil(std::fabs(arc.angle) / turn * CurveSamples)));
+    const Number dx = arc.start.x - arc.center.x, dy = arc.start.y - arc.center.y;
+    Number *xs, *ys;
+    const Batch batch = BatchTable::current().add(PolylineBatch, static_cast<std::size_t>(segments) + 1, xs, ys);
+    for (int i = 0; i <= segments; ++i) {
+        // counterclockwise on screen, where y points down, unlike rotation(s)
+        const Number s = arc.angle * i / segments, cs = std::cos(s), sn = std::sin(s);
+        xs[i] = arc.center.x + dx * cs + dy * sn;
+        ys[i] = arc.center.y - dx * sn + dy * cs;
+    }
+    transform_points(m, xs, ys, xs, ys, static_cast<std::size_t>(segments) + 1);
+    return batch;
+}
+
+Atom transform_graphic(const Affine &m, const Atom &atom) {
+    Atom out = atom;
+    Value &v = out.value;
+    switch (atom.type) {
+        case PointType:
+            v.point_value = transform_point(m, v.point_value);
+            break;
+        case LineType:
+            v.line_value.start = transform_point(m, v.line_value.start);
+            v.line_value.end = transform_point(m, v.line_value.end);
+            break;
+        case ArcType:
+            if (!is_similarity(m)) {
+                out.type = BatchType;
+                v.batch_value = arc_polyline(m, atom.value.arc_value);
+                break;
+            }
+            v.arc_value.center = transform_point(m, v.arc_value.center);
+            v.arc_value.start = transform_point(m, v.arc_value.start);
+            if (m.a * m.d - m.b * m.c < 0) {
+                v.arc_value.angle = -v.arc_value.angle; // mirrored, so it sweeps the other way
+            }
+            break;
+        case RectType:
+            if (!keeps_axes(m)) {
+                out.type = BatchType;
+                v.batch_value = rect_polygon(m, atom.value.rect_value);
+                break;
+            }
+            v.rect_value = transform_rect(m, v.rect_value);
+            break;
+        case FillRectType:
+            v.fill_rect_value.rect = transform_rect(m, v.fill_rect_value.rect);
+            break;
+        case EllipseType:
+            if (!keeps_axes(m)) {
+                out.type = BatchType;
+                v.batch_value = ellipse_polygon(m, atom.value.ellipse_value.rect);
+                break;
+            }
+            v.ellipse_value.rect = transform_rect(m, v.ellipse_value.rect);
+            break;
+        case BatchType: {
+            const Batch &batch = atom.value.batch_value;
+            Number *xs, *ys;
+            v.batch_value = BatchTable::current().add(batch.kind, batch.count, xs, ys);
+            transform_points(m, batch.xs, batch.ys, xs, ys, batch.count);
+            break;
+        }
+        default:
+            break;
+    }
+    return out;
+}
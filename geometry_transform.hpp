@@ -0,0 +1,74 @@
+#ifndef GEOMETRY_TRANSFORM_HPP
+#define GEOMETRY_TRANSFORM_HPP
+
+// system includes
+#include <cstddef>
+
+// module includes
+#include "expression.hpp"
+
+// Affine map of the plane: x' = a x + b y + e, y' = c x + d y + f
+struct Affine {
+    Number a, b, c, d, e, f;
+};
+
+Affine translation(Number dx, Number dy);
+
+Affine scaling(Number sx, Number sy);
+
+// By 'angle' rad about the origin, (1, 0) toward (0, 1): clockwise on
+// screen, where y points down, so the other way to an Arc's angle
+Affine rotation(Number angle);
+
+// Kernels applying an Affine to structure-of-arrays coordinates. All of
+// them evaluate (a x + b y) + e in the same order without fused
+// multiply-add, so they give bit-identical results.
+enum TransformKernel {
+    ScalarKernel, // portable fallback
+    Sse2Kernel,   // two points per step
+    Avx2Kernel    // four points per step
+};
+
+// Can this CPU run 'kernel'?
+bool kernel_available(TransformKernel kernel) noexcept;
+
+// The widest kernel this CPU runs, chosen once
+TransformKernel best_transform_kernel() noexcept;
+
+// Write 'm' applied to the points (xs[i], ys[i]), i in [0, count), to
+// (out_xs[i], out_ys[i]). The output may be the input itself, but must not
+// otherwise overlap it. 'kernel' must be available.
+void transform_points(TransformKernel kernel, const Affine &m, const Number *xs, const Number *ys,
+                      Number *out_xs, Number *out_ys, std::size_t count) noexcept;
+
+// Same, with best_transform_kernel()
+void transform_points(const Affine &m, const Number *xs, const Number *ys, Number *out_xs, Number *out_ys,
+                      std::size_t count) noexcept;
+
+Point transform_point(const Affine &m, Point p) noexcept;
+
+// Does 'm' map axis-aligned rectangles to axis-aligned rectangles (no
+// rotation or shear but by quarter turns)?
+bool keeps_axes(const Affine &m) noexcept;
+
+// Does 'm' map circles to circles (a rotation, a reflection and a uniform
+// scale)?
+bool is_similarity(const Affine &m) noexcept;
+
+// Is 'atom' a drawable transform_graphic() accepts (Point, Line, Arc,
+// Rect, FillRect, Ellipse or Batch)?
+bool is_transformable(const Atom &atom) noexcept;
+
+// 'm' applied to the drawable 'atom', mapping every defining point. A
+// shape whose type cannot hold its image becomes a batch:
+//   - a Rect or Ellipse under an 'm' that does not keep_axes() becomes a
+//     PolygonBatch, exact for a Rect and sampled for an Ellipse;
+//   - an Arc under an 'm' that is not a similarity becomes a sampled
+//     PolylineBatch; otherwise it keeps its angle, mirrored if 'm' flips
+//     the plane.
+// A FillRect has no batch form that keeps its colour, so it requires an
+// 'm' that keeps_axes(); rotate and transform reject any other. Batches
+// are made in BatchTable::current().
+Atom transform_graphic(const Affine &m, const Atom &atom);
+
+#endif
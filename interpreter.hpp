@@ -1,38 +1,183 @@
 #ifndef INTERPRETER_HPP
 #define INTERPRETER_HPP
 
+#include <memory>
+
+#include "arena.hpp"
+#include "bytecode.hpp"
+#include "display_list.hpp"
 #include "expression.hpp"
 #include "environment.hpp"
+#include "flat_ast.hpp"
+#include "geometry_batch.hpp"
+#include "optimizer.hpp"
 #include "tokenizer.hpp"
 
+// How eval() runs the AST: walk the tree, walk its flattened form (see
+// FlatAst), or compile it to bytecode and run that on the stack VM. All
+// produce the same results, draws and errors.
+enum EvalMode { TreeWalkEval, BytecodeEval, FlatEval };
+
 // Interpreter has
 // Environment, which starts at a default
 // parse method, builds an internal AST
 // eval method, updates Environment, returns last result
 class Interpreter {
 protected:
-    std::vector<Expression> pendingDraws;
+    DisplayList displayList;
 
 public:
-    const std::vector<Expression> &getPendingDraws() const { return pendingDraws; }
-    void clearPendingDraws() { pendingDraws.clear(); }
+    // What eval() drew, per primitive kind, in draw order
+    const DisplayList &getDisplayList() const noexcept { return displayList; }
+
+    // The same draws as Expressions. The view is built on demand and kept:
+    // a call after more draws converts only those, and until then it takes
+    // no memory beyond the display list.
+    const std::vector<Expression> &getPendingDraws() const;
+
+    void clearPendingDraws() {
+        displayList.clear();
+        pendingDraws.clear();
+    }
 
     bool parse(std::istream &expression) noexcept;
 
+    // Parse the program in data[0, size) in place, without copying it
+    bool parse(const char *data, std::size_t size) noexcept;
+
+    // Byte offset of the first syntax error found by the last failed parse()
+    std::size_t parseErrorOffset() const noexcept { return errorOffset; }
+
     Expression eval();
 
+    // Snapshot the environment, how many draws are pending and how many
+    // batches exist, and roll all three back to a snapshot after a failed
+    // eval(): the draws of earlier evals stay, and the batches made since
+    // are released, but for those the current AST holds. See
+    // Environment::Checkpoint.
+    struct Checkpoint {
+        Environment::Checkpoint environment;
+        std::size_t draws;
+        std::size_t batches;
+    };
+
+    Checkpoint checkpoint() noexcept { return Checkpoint{env.checkpoint(), displayList.size(), batches.size()}; }
+    void rollback(Checkpoint to);
+
+    // Forget the environment's history before 'to'; see Environment::commit
+    void commit(Checkpoint to) { env.commit(to.environment); }
+
+    // Back to the builtins only, with no history; draws are kept
+    void resetEnvironment() { env.reset(); }
+
+    void setEvalMode(EvalMode mode) noexcept { evalMode = mode; }
+    EvalMode getEvalMode() const noexcept { return evalMode; }
+
+    // Run fold_constants() over the parsed AST now; with setOptimize(true)
+    // every successful parse() does so itself
+    FoldStats optimize();
+
+    void setOptimize(bool enabled) noexcept { optimizeAst = enabled; }
+    bool getOptimize() const noexcept { return optimizeAst; }
+
+    // The batches eval() and optimize() made (see BatchTable). They live
+    // until rolled back or released; draws keep theirs.
+    const BatchTable &getBatches() const noexcept { return batches; }
+
+    // Release the batches neither the current AST nor a definition holds,
+    // e.g. once the draws of an eval have been handed on. This reorders
+    // the batch count older checkpoints kept, so take a new one after.
+    void releaseUnboundBatches();
+
+    // The AST the last successful parse() built, as optimized
+    const Expression &getAst() const noexcept { return ast; }
+
+    // Arena bytes the AST occupies; its lists' tails live there, and the
+    // next successful parse() releases them all in one reset
+    std::size_t astBytes() const noexcept { return astArena->bytes(); }
+
+    // Lower the parsed AST to bytecode now instead of on the first
+    // eval() in BytecodeEval mode
+    void compile();
+
+    // Flatten the parsed AST now instead of on the first eval() in
+    // FlatEval mode
+    void flatten();
+
+    // The flattened AST, empty until flattened
+    const FlatAst &getFlatAst() const noexcept { return flat; }
+
+    // Deepest list nesting parse() and eval() accept. Both run on heap
+    // allocated work stacks, so the default is limited only by memory; past
+    // the limit parse() fails and eval() throws InterpreterSemanticError.
+    void setMaxDepth(std::size_t depth) noexcept { maxDepth = depth; }
+    std::size_t getMaxDepth() const noexcept { return maxDepth; }
+
 private:
-    Expression eval(const Expression &exp);
+    // A list being evaluated: the next child to evaluate, and where its
+    // evaluated children start on valueStack
+    template<class Node>
+    struct EvalFrame {
+        Node node;
+        std::size_t next;
+        std::size_t base;
+    };
+
+    // Evaluate the tree 'tree' views from 'root', with its pending lists on
+    // 'frames'; 'tree' is an Expression or a FlatAst (see interpreter.cpp)
+    template<class Tree>
+    Atom walk(const Tree &tree, typename Tree::Node root, std::vector<EvalFrame<typename Tree::Node> > &frames);
+
+    // push 'node' for evaluation: atoms go straight onto valueStack,
+    // lists get an EvalFrame
+    template<class Tree>
+    void eval_enter(const Tree &tree, typename Tree::Node node, std::vector<EvalFrame<typename Tree::Node> > &frames);
 
-    static bool parse_atom(TokenSequenceType::const_iterator &it, const TokenSequenceType::const_iterator &end,
-                           Expression &exp);
+    // A list being parsed: where it opened, where its children start on
+    // parseStack, and where its latest child started
+    struct ParseFrame {
+        std::size_t open;
+        std::size_t base;
+        std::size_t lastOffset;
+    };
 
-    bool parse_expression(TokenSequenceType::const_iterator &it, TokenSequenceType::const_iterator &end,
-                          Expression &exp);
+    bool parse_atom(TokenStream &tokens, Expression &exp);
+
+    bool parse_expression(TokenStream &tokens, Expression &exp);
 
     Environment env;
+
+    // getPendingDraws() view of the first draws of displayList; eval()
+    // only appends to the list, and rollback() trims both alike
+    mutable std::vector<Expression> pendingDraws;
+
+    // Vertices of the batches made by eval() and by folding; the first
+    // 'astBatches' include every constant folded into 'ast'
+    BatchTable batches;
+    std::size_t astBatches = 0;
+
+    // Tail storage of 'ast', and of the tree the next parse() builds. They
+    // swap after each successful parse, so a failed one leaves 'ast' intact.
+    // Held by pointer so the tails stay put when the Interpreter moves.
+    std::unique_ptr<Arena> astArena{new Arena()};
+    std::unique_ptr<Arena> parseArena{new Arena()};
     Expression ast;
 
+    EvalMode evalMode = TreeWalkEval;
+    bool optimizeAst = false;
+    Program program; // bytecode for 'ast', empty until compiled
+    FlatAst flat; // 'ast' flattened, empty until flattened
+
+    std::size_t errorOffset = 0;
+    std::size_t maxDepth = static_cast<std::size_t>(-1);
+
+    std::vector<Expression> parseStack; // children of the lists being parsed
+    std::vector<ParseFrame> parseFrames;
+    std::vector<EvalFrame<const Expression *> > evalFrames;
+    std::vector<EvalFrame<FlatAst::Index> > flatFrames;
+    std::vector<Atom> valueStack; // evaluated results, all single atoms
+    std::string tokenText; // scratch for token_to_atom, reused across tokens
+
     void debug() const;
 };
 
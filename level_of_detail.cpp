@@ -0,0 +1,390 @@
+#include "level_of_detail.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+// Most cells of the base level, and of its columns or rows
+static const std::size_t MaxBaseCells = std::size_t(1) << 22;
+static const std::size_t MaxBaseSide = 4096;
+
+// Base cells per draw
+static const std::size_t CellsPerDraw = 4;
+
+// Most segments of one tessellated arc
+static const std::size_t MaxArcSegments = 1024;
+
+static const Number TwoPi = 2 * std::atan2(0, -1);
+
+std::size_t arc_segments(const Number radius, const Number angle, const Number tolerance) noexcept {
+    const Number sweep = std::min(std::fabs(angle), TwoPi);
+    if (!(radius > 0) || sweep == 0) {
+        return 1;
+    }
+    // a chord spanning 'step' rad is 'radius (1 - cos(step / 2))' from its arc
+    const Number step = 2 * std::acos(std::max<Number>(-1, 1 - tolerance / radius));
+    const Number segments = std::ceil(sweep / step);
+    return segments <= 1 ? 1 : segments >= MaxArcSegments ? MaxArcSegments : static_cast<std::size_t>(segments);
+}
+
+// Arcs are drawn as on screen: angles grow counterclockwise with y
+// pointing down, as in spatial_index.cpp
+void tessellate_arc(const Arc &arc, const std::size_t segments, std::vector<Point> &out) {
+    const Number r = std::hypot(arc.start.x - arc.center.x, arc.start.y - arc.center.y);
+    const Number start = std::atan2(-(arc.start.y - arc.center.y), arc.start.x - arc.center.x);
+    out.push_back(arc.start);
+    for (std::size_t i = 1; i <= segments; ++i) {
+        const Number t = start + arc.angle * static_cast<Number>(i) / static_cast<Number>(segments);
+        out.push_back(Point{arc.center.x + r * std::cos(t), arc.center.y - r * std::sin(t)});
+    }
+}
+
+void decimate(const Number *xs, const Number *ys, const std::uint32_t count, const Number tolerance,
+              std::vector<Point> &out) {
+    if (count == 0) {
+        return;
+    }
+    const Number tolerance2 = tolerance * tolerance;
+    Point last{xs[0], ys[0]};
+    out.push_back(last);
+    for (std::uint32_t i = 1; i + 1 < count; ++i) {
+        const Number dx = xs[i] - last.x, dy = ys[i] - last.y;
+        if (dx * dx + dy * dy > tolerance2) {
+            last = Point{xs[i], ys[i]};
+            out.push_back(last);
+        }
+    }
+    if (count > 1) {
+        out.push_back(Point{xs[count - 1], ys[count - 1]});
+    }
+}
+
+// What one draw adds to a cell
+struct Ink {
+    Number stroke = 0;
+    Number area = 0;
+    Number red = 0, green = 0, blue = 0;
+};
+
+static Number length(const Point a, const Point b) noexcept {
+    return std::hypot(b.x - a.x, b.y - a.y);
+}
+
+static Ink ink_of(const Point &, const Number dot) noexcept {
+    Ink ink;
+    ink.stroke = dot;
+    return ink;
+}
+
+static Ink ink_of(const Line &l, Number) noexcept {
+    Ink ink;
+    ink.stroke = length(l.start, l.end);
+    return ink;
+}
+
+static Ink ink_of(const Arc &arc, Number) noexcept {
+    Ink ink;
+    ink.stroke = length(arc.center, arc.start) * std::min(std::fabs(arc.angle), TwoPi);
+    return ink;
+}
+
+static Ink ink_of(const Rect &r, Number) noexcept {
+    Ink ink;
+    ink.stroke = 2 * (std::fabs(r.point2.x - r.point1.x) + std::fabs(r.point2.y - r.point1.y));
+    return ink;
+}
+
+static Ink ink_of(const FillRect &fr, Number) noexcept {
+    Ink ink;
+    ink.area = std::fabs((fr.rect.point2.x - fr.rect.point1.x) * (fr.rect.point2.y - fr.rect.point1.y));
+    ink.red = fr.r * ink.area;
+    ink.green = fr.g * ink.area;
+    ink.blue = fr.b * ink.area;
+    return ink;
+}
+
+static Ink ink_of(const Ellipse &e, Number) noexcept {
+    // Ramanujan's approximation of the perimeter
+    const Number a = std::fabs(e.rect.point2.x - e.rect.point1.x) / 2;
+    const Number b = std::fabs(e.rect.point2.y - e.rect.point1.y) / 2;
+    Ink ink;
+    ink.stroke = TwoPi / 2 * (3 * (a + b) - std::sqrt((3 * a + b) * (a + 3 * b)));
+    return ink;
+}
+
+static Ink ink_of(const Batch &batch, const Number dot) noexcept {
+    Ink ink;
+    if (batch.kind == PointsBatch) {
+        ink.stroke = dot * batch.count;
+        return ink;
+    }
+    const std::uint32_t step = batch.kind == LinesBatch ? 2 : 1;
+    for (std::uint32_t i = 0; i + 1 < batch.count; i += step) {
+        ink.stroke += length(batch.vertex(i), batch.vertex(i + 1));
+    }
+    if (batch.kind == PolygonBatch && batch.count > 2) {
+        ink.stroke += length(batch.vertex(batch.count - 1), batch.vertex(0));
+    }
+    return ink;
+}
+
+// A draw's bounds and ink, before it is placed
+struct Sample {
+    Box box;
+    Ink ink;
+};
+
+template<class T>
+static void append_samples(const std::vector<T> &array, const DisplayList::Run &run, const Number dot,
+                           std::vector<Sample> &samples) {
+    for (std::uint32_t i = run.first; i < run.first + run.count; ++i) {
+        samples.push_back(Sample{bounds_of(array[i]), ink_of(array[i], dot)});
+    }
+}
+
+// cell 'offset / size' of 'count', clamped; NaN to the first
+static std::size_t cell_of(const Number offset, const Number size, const std::size_t count) noexcept {
+    const Number c = offset / size;
+    return !(c > 0) ? 0 : c >= count - 1 ? count - 1 : static_cast<std::size_t>(c);
+}
+
+// cells along a side 'cells' base cells long, at least one
+static std::size_t side_of(const Number cells) noexcept {
+    return cells > 1 ? static_cast<std::size_t>(std::ceil(std::min<Number>(cells, MaxBaseSide))) : 1;
+}
+
+void DensityPyramid::build(const DisplayList &list, const SpatialIndex &spatial, const Number dot) {
+    clear();
+    index = &spatial;
+    std::vector<Sample> samples;
+    samples.reserve(list.size());
+    bool filled = false;
+    for (const DisplayList::Run &run: list.runs()) {
+        switch (run.type) {
+            case PointType:
+                append_samples(list.points(), run, dot, samples);
+                break;
+            case LineType:
+                append_samples(list.lines(), run, dot, samples);
+                break;
+            case ArcType:
+                append_samples(list.arcs(), run, dot, samples);
+                break;
+            case RectType:
+                append_samples(list.rects(), run, dot, samples);
+                break;
+            case FillRectType:
+                append_samples(list.fill_rects(), run, dot, samples);
+                filled = true;
+                break;
+            case EllipseType:
+                append_samples(list.ellipses(), run, dot, samples);
+                break;
+            case BatchType:
+                append_samples(list.batches(), run, dot, samples);
+                break;
+            default:
+                break;
+        }
+    }
+    if (samples.empty()) {
+        return;
+    }
+
+    // samples that overflowed to infinity or NaN are kept whole, as
+    // SpatialIndex keeps them out of its grid
+    bool first = true;
+    for (const Sample &s: samples) {
+        if (!s.box.finite()) {
+            continue;
+        }
+        if (first) {
+            all = s.box;
+            first = false;
+        }
+        all.x0 = std::min(all.x0, s.box.x0);
+        all.y0 = std::min(all.y0, s.box.y0);
+        all.x1 = std::max(all.x1, s.box.x1);
+        all.y1 = std::max(all.y1, s.box.y1);
+    }
+
+    // square base cells, about CellsPerDraw per draw within the limits
+    const Number width = all.x1 - all.x0, height = all.y1 - all.y0;
+    const Number cellCount = static_cast<Number>(std::min(MaxBaseCells, CellsPerDraw * samples.size()));
+    if (width > 0 && height > 0) {
+        base = std::sqrt(width * height / cellCount);
+    } else {
+        base = std::max(width, height) / std::min(cellCount, static_cast<Number>(MaxBaseSide));
+    }
+    base = std::max(base, std::max(width, height) / MaxBaseSide);
+    if (!(base > 0)) {
+        base = 1;
+    }
+
+    // a drawing too wide for a finite width has an infinite base cell
+    Level level{side_of(width / base), side_of(height / base), 0};
+    for (;;) {
+        sizes.push_back(level);
+        level.first += level.columns * level.rows;
+        if (level.columns == 1 && level.rows == 1) {
+            break;
+        }
+        level.columns = (level.columns + 1) / 2;
+        level.rows = (level.rows + 1) / 2;
+    }
+    cells.assign(level.first, Cell{0, 0});
+    if (filled) {
+        tints.assign(3 * level.first, 0);
+    }
+
+    // each draw into the first level whose cells are as large as it is
+    const std::size_t n = samples.size();
+    std::vector<std::uint8_t> levelOf(n);
+    levelStarts.assign(levels() + 2, 0);
+    for (std::size_t d = 0; d < n; ++d) {
+        const Box &box = samples[d].box;
+        const Number extent = std::max(box.x1 - box.x0, box.y1 - box.y0);
+        std::size_t l = box.finite() ? 0 : levels();
+        while (l < levels() && cell_size(l) < extent) {
+            ++l;
+        }
+        levelOf[d] = static_cast<std::uint8_t>(l);
+        ++levelStarts[l + 1];
+        if (l == levels()) {
+            continue;
+        }
+        const Number size = cell_size(l);
+        const std::size_t cell = sizes[l].first +
+                                 cell_of((box.y0 + box.y1) / 2 - all.y0, size, sizes[l].rows) * sizes[l].columns +
+                                 cell_of((box.x0 + box.x1) / 2 - all.x0, size, sizes[l].columns);
+        const Ink &ink = samples[d].ink;
+        cells[cell].stroke += static_cast<float>(ink.stroke);
+        cells[cell].area += static_cast<float>(ink.area);
+        if (filled) {
+            tints[3 * cell] += static_cast<float>(ink.red);
+            tints[3 * cell + 1] += static_cast<float>(ink.green);
+            tints[3 * cell + 2] += static_cast<float>(ink.blue);
+        }
+    }
+    for (std::size_t l = 1; l < levelStarts.size(); ++l) {
+        levelStarts[l] += levelStarts[l - 1];
+    }
+    bySize.resize(n);
+    std::vector<std::uint32_t> fill(levelStarts.begin(), levelStarts.end() - 1);
+    for (std::size_t d = 0; d < n; ++d) {
+        bySize[fill[levelOf[d]]++] = static_cast<Draw>(d);
+    }
+
+    // and every coarser level sums the one below
+    for (std::size_t l = 1; l < levels(); ++l) {
+        const Level &fine = sizes[l - 1], &coarse = sizes[l];
+        for (std::size_t row = 0; row < fine.rows; ++row) {
+            for (std::size_t column = 0; column < fine.columns; ++column) {
+                const std::size_t from = fine.first + row * fine.columns + column;
+                const std::size_t to = coarse.first + row / 2 * coarse.columns + column / 2;
+                cells[to].stroke += cells[from].stroke;
+                cells[to].area += cells[from].area;
+                if (filled) {
+                    for (int c = 0; c < 3; ++c) {
+                        tints[3 * to + c] += tints[3 * from + c];
+                    }
+                }
+            }
+        }
+    }
+}
+
+void DensityPyramid::clear() {
+    sizes.clear();
+    cells.clear();
+    tints.clear();
+    all = Box{0, 0, 0, 0};
+    base = 1;
+    bySize.clear();
+    levelStarts.clear();
+    index = nullptr;
+}
+
+Number DensityPyramid::cell_size(const std::size_t level) const noexcept {
+    return std::ldexp(base, static_cast<int>(level));
+}
+
+std::size_t DensityPyramid::level_for(const Number pixel) const noexcept {
+    if (pixel < base) {
+        return levels();
+    }
+    std::size_t l = 0;
+    while (l + 1 < levels() && cell_size(l) < pixel) {
+        ++l;
+    }
+    return l;
+}
+
+bool DensityPyramid::cells_of(const std::size_t level, const Box &area, std::size_t &cx0, std::size_t &cy0,
+                              std::size_t &cx1, std::size_t &cy1) const noexcept {
+    if (empty() || !area.intersects(all)) {
+        return false;
+    }
+    const Number size = cell_size(level);
+    const Level &l = sizes[level];
+    cx0 = cell_of(area.x0 - all.x0, size, l.columns);
+    cx1 = cell_of(area.x1 - all.x0, size, l.columns);
+    cy0 = cell_of(area.y0 - all.y0, size, l.rows);
+    cy1 = cell_of(area.y1 - all.y0, size, l.rows);
+    return true;
+}
+
+Box DensityPyramid::cell_box(const std::size_t level, const std::size_t column, const std::size_t row) const noexcept {
+    const Number size = cell_size(level);
+    const Number x = all.x0 + size * column, y = all.y0 + size * row;
+    return Box{x, y, x + size, y + size};
+}
+
+// clamped without branches, which random coverage would mispredict
+static std::uint32_t channel(const float value) noexcept {
+    return static_cast<std::uint32_t>(std::min(255.f, std::max(0.f, value)) + 0.5f);
+}
+
+std::uint32_t DensityPyramid::argb(const std::size_t level, const std::size_t column, const std::size_t row) const
+    noexcept {
+    std::uint32_t pixel;
+    argb(level, row, column, column, &pixel);
+    return pixel;
+}
+
+void DensityPyramid::argb(const std::size_t level, const std::size_t row, const std::size_t cx0, const std::size_t cx1,
+                          std::uint32_t *out) const noexcept {
+    const Number size = cell_size(level);
+    const float perLength = static_cast<float>(1 / size), perArea = static_cast<float>(1 / (size * size));
+    const std::size_t first = sizes[level].first + row * sizes[level].columns;
+    for (std::size_t c = first + cx0; c <= first + cx1; ++c) {
+        const float stroke = std::min(1.f, cells[c].stroke * perLength);
+        const float fill = std::min(1.f, cells[c].area * perArea);
+        const float alpha = stroke + fill * (1 - stroke);
+        std::uint32_t pixel = channel(alpha * 255) << 24;
+        if (fill > 0 && !tints.empty()) {
+            // the mean color of the fills, showing where the strokes do not
+            const float weight = fill * (1 - stroke) / cells[c].area;
+            pixel |= channel(tints[3 * c] * weight) << 16 | channel(tints[3 * c + 1] * weight) << 8 |
+                     channel(tints[3 * c + 2] * weight);
+        }
+        *out++ = pixel;
+    }
+}
+
+void DensityPyramid::large_draws(const std::size_t level, const Box &area, std::vector<Draw> &out) const {
+    out.clear();
+    if (empty()) {
+        return;
+    }
+    for (std::size_t i = levelStarts[std::min(level, levels()) + 1]; i < bySize.size(); ++i) {
+        if (index->bounds(bySize[i]).intersects(area)) {
+            out.push_back(bySize[i]);
+        }
+    }
+    std::sort(out.begin(), out.end());
+}
+
+std::size_t DensityPyramid::bytes() const noexcept {
+    return sizes.size() * sizeof(Level) + cells.size() * sizeof(Cell) + tints.size() * sizeof(float) +
+           bySize.size() * sizeof(Draw) + levelStarts.size() * sizeof(std::uint32_t);
+}
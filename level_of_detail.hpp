@@ -0,0 +1,120 @@
+#ifndef LEVEL_OF_DETAIL_HPP
+#define LEVEL_OF_DETAIL_HPP
+
+// system includes
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// module includes
+#include "display_list.hpp"
+#include "expression.hpp"
+#include "spatial_index.hpp"
+
+// Segments of a polyline that stays within 'tolerance' of an arc of
+// 'radius' sweeping 'angle' rad; lengths in pixels, so a far zoomed out
+// arc costs a segment or two and a close one a few hundred at most
+std::size_t arc_segments(Number radius, Number angle, Number tolerance = 0.25) noexcept;
+
+// Append the 'segments' + 1 vertices of 'arc' to 'out', from its start
+void tessellate_arc(const Arc &arc, std::size_t segments, std::vector<Point> &out);
+
+// Append to 'out' the vertices of a path a renderer can draw in place of
+// 'count' vertices when 'tolerance' is about a pixel: a vertex within
+// 'tolerance' of the last one kept is dropped. The first and last
+// vertices are always kept.
+void decimate(const Number *xs, const Number *ys, std::uint32_t count, Number tolerance, std::vector<Point> &out);
+
+// Ink of a display list summed over square cells at a series of
+// resolutions, each level's cells twice the size of the level below's,
+// for painting a zoomed out view as one image per frame instead of
+// primitive by primitive.
+//
+// A draw no wider or taller than a level's cells is aggregated into the
+// cell holding its center at that level and all coarser ones; larger
+// draws are left to be painted whole. Strokes add their length and fill
+// rects their area and color, so a cell's coverage is its stroke length
+// over the cell width plus its filled area over the cell area, which is
+// what a renderer drawing hairlines at one pixel per cell would ink.
+class DensityPyramid {
+public:
+    typedef SpatialIndex::Draw Draw;
+
+    // Sums of one cell
+    struct Cell {
+        float stroke; // length of outlines, lines and arcs
+        float area; // area of fill rects
+    };
+
+    // Aggregate the draws of 'list', with points counted as strokes of
+    // 'dot' length. 'index' must be built over 'list'; large_draws culls
+    // with its bounds. The base level has about four cells per draw, up
+    // to four million.
+    void build(const DisplayList &list, const SpatialIndex &index, Number dot = 1);
+
+    void clear();
+
+    bool empty() const noexcept { return sizes.empty(); }
+
+    std::size_t levels() const noexcept { return sizes.size(); }
+
+    const Box &bounds() const noexcept { return all; }
+
+    // Width of the cells of 'level'
+    Number cell_size(std::size_t level) const noexcept;
+
+    std::size_t columns(std::size_t level) const noexcept { return sizes[level].columns; }
+    std::size_t rows(std::size_t level) const noexcept { return sizes[level].rows; }
+
+    // The finest level with cells at least 'pixel' wide, or levels() if
+    // 'pixel' is finer than the base level's cells: then the draws are
+    // few enough per pixel to paint one by one
+    std::size_t level_for(Number pixel) const noexcept;
+
+    // Cell range [cx0, cx1] x [cy0, cy1] of 'area' at 'level', clamped;
+    // false if 'area' misses the drawing
+    bool cells_of(std::size_t level, const Box &area, std::size_t &cx0, std::size_t &cy0, std::size_t &cx1,
+                  std::size_t &cy1) const noexcept;
+
+    // The box of a cell
+    Box cell_box(std::size_t level, std::size_t column, std::size_t row) const noexcept;
+
+    const Cell &cell(std::size_t level, std::size_t column, std::size_t row) const noexcept {
+        return cells[sizes[level].first + row * sizes[level].columns + column];
+    }
+
+    // The cell as a premultiplied 0xAARRGGBB pixel: fills under black
+    // strokes, each saturating at full coverage
+    std::uint32_t argb(std::size_t level, std::size_t column, std::size_t row) const noexcept;
+
+    // Set out[0, cx1 - cx0] to the pixels of cells [cx0, cx1] of 'row'
+    void argb(std::size_t level, std::size_t row, std::size_t cx0, std::size_t cx1, std::uint32_t *out) const noexcept;
+
+    // Set 'out' to the draws too large to aggregate at 'level' whose
+    // bounds in the index intersect 'area', in draw order
+    void large_draws(std::size_t level, const Box &area, std::vector<Draw> &out) const;
+
+    // Bytes of the arrays' contents
+    std::size_t bytes() const noexcept;
+
+private:
+    struct Level {
+        std::size_t columns, rows;
+        std::size_t first; // of its cells in 'cells'
+    };
+
+    std::vector<Level> sizes;
+    std::vector<Cell> cells; // level by level, row by row
+    std::vector<float> tints; // red, green and blue times area per cell, if anything is filled
+    Box all{0, 0, 0, 0};
+    Number base = 1; // cell size of level 0
+
+    // draws by the first level that aggregates them, the draws of level
+    // l being bySize[levelStarts[l], levelStarts[l + 1]), and those no
+    // level aggregates last
+    std::vector<Draw> bySize;
+    std::vector<std::uint32_t> levelStarts;
+    const SpatialIndex *index = nullptr;
+};
+
+#endif
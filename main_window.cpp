@@ -47,9 +47,9 @@ MainWindow::MainWindow(QWidget *parent) : QWidget(parent) {
     connect(&interp, &QtInterpreter::error,
             messageWidget, &MessageWidget::error);
 
-    // QtInterpreter draw graphic
-    connect(&interp, &QtInterpreter::drawGraphic,
-            canvasWidget, &CanvasWidget::addGraphic);
+    // QtInterpreter draw graphics, all of an eval at once
+    connect(&interp, &QtInterpreter::drawGraphics,
+            canvasWidget, &CanvasWidget::addGraphics);
 }
 
 MainWindow::MainWindow(std::string filename, QWidget *parent) : MainWindow(parent) {
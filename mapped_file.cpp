@@ -0,0 +1,55 @@
+#include "mapped_file.hpp"
+
+#include <fstream>
+#include <iterator>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define POSTLISP_HAVE_MMAP
+#endif
+
+MappedFile::MappedFile(const std::string &path)
+    : opened(false), mapped(false), bytes(""), length(0) {
+#ifdef POSTLISP_HAVE_MMAP
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    struct stat info;
+    if (::fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+        void *addr = ::mmap(nullptr, static_cast<std::size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr != MAP_FAILED) {
+            ::madvise(addr, static_cast<std::size_t>(info.st_size), MADV_SEQUENTIAL);
+            bytes = static_cast<const char *>(addr);
+            length = static_cast<std::size_t>(info.st_size);
+            mapped = true;
+        }
+    }
+    ::close(fd);
+    if (mapped) {
+        opened = true;
+        return;
+    }
+#endif
+
+    // empty, special or unmappable file: read it instead
+    std::ifstream in(path, std::ios::binary);
+    if (!in.good()) {
+        return;
+    }
+    contents.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    bytes = contents.data();
+    length = contents.size();
+    opened = true;
+}
+
+MappedFile::~MappedFile() {
+#ifdef POSTLISP_HAVE_MMAP
+    if (mapped) {
+        ::munmap(const_cast<char *>(bytes), length);
+    }
+#endif
+}
@@ -0,0 +1,36 @@
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+
+// system includes
+#include <cstddef>
+#include <string>
+
+// Read-only view of a whole file as one contiguous buffer, for the buffer
+// tokenizer. On POSIX systems the file is memory-mapped; elsewhere, or if
+// mapping fails, it is read into memory instead.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string &path);
+
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    // Could the file be opened?
+    bool good() const noexcept { return opened; }
+
+    const char *data() const noexcept { return bytes; }
+
+    std::size_t size() const noexcept { return length; }
+
+private:
+    bool opened;
+    bool mapped;
+    const char *bytes;
+    std::size_t length;
+    std::string contents; // fallback storage when not mapped
+};
+
+#endif
@@ -0,0 +1,116 @@
+#include "optimizer.hpp"
+#include "interpreter_semantic_error.hpp"
+
+#include <utility>
+#include <vector>
+
+namespace {
+    // A list whose children are being folded: fold the next child, or the
+    // list itself once they are all done
+    struct Frame {
+        Expression *exp;
+        std::size_t next;
+    };
+
+    class Folder {
+    public:
+        explicit Folder(const Environment &env) : env(env) {
+        }
+
+        FoldStats run(Expression &root) {
+            enter(root);
+            while (!frames.empty()) {
+                Frame &frame = frames.back();
+                Expression::Tail &tail = frame.exp->getTail();
+                if (frame.next < tail.size()) {
+                    enter(tail[frame.next++]);
+                    continue;
+                }
+                Expression &exp = *frame.exp;
+                frames.pop_back();
+                fold(exp);
+            }
+            return stats;
+        }
+
+    private:
+        const Environment &env;
+        std::vector<Frame> frames;
+        std::vector<Atom> args; // scratch for the arguments of a call
+        FoldStats stats;
+
+        void enter(Expression &exp) {
+            if (!exp.tailIsEmpty() && exp.headType() == SymbolType) {
+                frames.push_back(Frame{&exp, 0});
+            }
+        }
+
+        // The value of an already folded child, if it is a constant. Only
+        // builtin symbols are resolved: they can never be rebound, while a
+        // user symbol is not bound until its define runs.
+        bool constant(const Expression &exp, Atom &value) const {
+            if (!exp.tailIsEmpty()) {
+                return false;
+            }
+            const Atom &atom = exp.getHead();
+            if (atom.type != SymbolType) {
+                value = atom;
+                return true;
+            }
+            if (atom.value.sym_value.id() >= BuiltinSymbolCount) {
+                return false;
+            }
+            const Expression *bound = env.lookup(atom.value.sym_value);
+            if (!bound) {
+                return false;
+            }
+            value = bound->getHead();
+            return true;
+        }
+
+        void fold(Expression &exp) {
+            Expression::Tail &tail = exp.getTail();
+            switch (exp.getHead().value.sym_value.id()) {
+                case SymIf: {
+                    Atom cond;
+                    if (tail.size() != 3 || !constant(tail[0], cond) || cond.type != BooleanType) {
+                        return; // left for eval to take, or to reject
+                    }
+                    Expression taken(std::move(tail[cond.value.bool_value ? 1 : 2]));
+                    exp = std::move(taken);
+                    ++stats.pruned;
+                    return;
+                }
+
+                case SymDefine:
+                case SymBegin:
+                case SymDraw:
+                    return;
+
+                default:
+                    break;
+            }
+
+            const Builtin *builtin = env.lookup_builtin(exp.getHead().value.sym_value);
+            if (!builtin) {
+                return;
+            }
+            args.resize(tail.size());
+            for (std::size_t i = 0; i < tail.size(); ++i) {
+                if (!constant(tail[i], args[i])) {
+                    return;
+                }
+            }
+            try {
+                exp = call_builtin(*builtin, ArgSpan(args.data(), args.size()));
+            } catch (const InterpreterSemanticError &) {
+                return; // raise it at eval time instead
+            }
+            ++stats.folded;
+        }
+    };
+}
+
+FoldStats fold_constants(Expression &exp, const Environment &env) {
+    return Folder(env).run(exp);
+}
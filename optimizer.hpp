@@ -0,0 +1,27 @@
+#ifndef OPTIMIZER_HPP
+#define OPTIMIZER_HPP
+
+// system includes
+#include <cstddef>
+
+// module includes
+#include "environment.hpp"
+#include "expression.hpp"
+
+// What fold_constants() changed
+struct FoldStats {
+    std::size_t folded = 0; // builtin calls replaced by their value
+    std::size_t pruned = 0; // if forms replaced by the branch they take
+};
+
+// Simplify 'exp' in place before it is evaluated:
+//  - a builtin call whose arguments are all constants (literals, or
+//    constants bound by 'env' such as pi) is replaced by its value;
+//  - an if whose condition is a constant Boolean is replaced by the
+//    branch it takes.
+// Builtins are pure, so this changes no result, draw or error: a call that
+// fails, e.g. (1 0 /), is left in place to fail at eval time. Runs on an
+// explicit stack, so it handles programs of any depth.
+FoldStats fold_constants(Expression &exp, const Environment &env);
+
+#endif
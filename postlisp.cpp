@@ -1,10 +1,9 @@
 #include <string>
-#include <sstream>
 #include <iostream>
-#include <fstream>
 
 #include "interpreter.hpp"
 #include "interpreter_semantic_error.hpp"
+#include "mapped_file.hpp"
 
 #include <exception>
 
@@ -16,7 +15,7 @@
 //   • REPL (no args):
 //       - Prompt exactly: "postlisp>"
 //       - Read lines until EOF; ignore empty lines
-//       - parse() each line; on false → print "Error: parse error"
+//       - parse() each line; on false → print "Error: parse error at byte <offset>"
 //       - On success → eval() and print the result via operator<<
 //       - On InterpreterSemanticError → print "Error: <msg>" and reset env
 //
@@ -43,21 +42,53 @@ static void error(const std::string &err_str) {
     std::cerr << "Error: " << err_str << std::endl;
 }
 
-static bool parse_and_eval(Interpreter &interp, std::istream &in, Expression &out) {
-    if (!interp.parse(in)) {
+static void parse_error(const Interpreter &interp) {
+    error("parse error at byte " + std::to_string(interp.parseErrorOffset()));
+}
+
+// Command line options shared by all three modes
+struct Options {
+    EvalMode mode = TreeWalkEval;
+    bool keepDefinitions = false; // REPL: keep user definitions across errors
+    bool optimize = false;        // fold constants between parse and eval
+    bool dumpAst = false;         // write each parsed (optimized) AST to stderr
+};
+
+static void configure(Interpreter &interp, const Options &options) {
+    interp.setEvalMode(options.mode);
+    interp.setOptimize(options.optimize);
+}
+
+static bool parse_and_eval(Interpreter &interp, const Options &options, const char *data, std::size_t size,
+                           Expression &out) {
+    if (!interp.parse(data, size)) {
         return false;
     }
+    if (options.dumpAst) {
+        if (options.mode == FlatEval) {
+            interp.flatten();
+            std::cerr << interp.getFlatAst() << std::endl;
+        } else {
+            write_source(std::cerr, interp.getAst());
+            std::cerr << std::endl;
+        }
+    }
     out = interp.eval();
     return true;
 }
 
-static int run_single_expression_mode(const std::string &filename) {
+static bool parse_and_eval(Interpreter &interp, const Options &options, const std::string &program,
+                           Expression &out) {
+    return parse_and_eval(interp, options, program.data(), program.size(), out);
+}
+
+static int run_single_expression_mode(const std::string &program, const Options &options) {
     Interpreter interp;
-    std::istringstream iss{filename};
+    configure(interp, options);
     try {
         Expression result;
-        if (!parse_and_eval(interp, iss, result)) {
-            error("parse error");
+        if (!parse_and_eval(interp, options, program, result)) {
+            parse_error(interp);
             return EXIT_FAILURE;
         }
         std::cout << result << std::endl;
@@ -71,18 +102,20 @@ static int run_single_expression_mode(const std::string &filename) {
     }
 }
 
-static int run_file_mode(const std::string &filename) {
-    std::ifstream infile(filename);
+static int run_file_mode(const std::string &filename, const Options &options) {
+    // parse the file in place, straight from a read-only mapping
+    const MappedFile infile(filename);
     if (!infile.good()) {
         error("could not open file");
         return EXIT_FAILURE;
     }
 
     Interpreter interp;
+    configure(interp, options);
     try {
         Expression result;
-        if (!parse_and_eval(interp, infile, result)) {
-            error("parse error");
+        if (!parse_and_eval(interp, options, infile.data(), infile.size(), result)) {
+            parse_error(interp);
             return EXIT_FAILURE;
         }
         std::cout << result << std::endl;
@@ -96,8 +129,24 @@ static int run_file_mode(const std::string &filename) {
     }
 }
 
-static int run_interactive_mode() {
+// A failed line is rolled back to the checkpoint taken before it. By
+// default the environment is then reset to the builtins only, as the REPL
+// always did; with options.keepDefinitions it keeps the state before the
+// failed line. Either way no older state is ever needed, so the history is
+// committed after each good line and the journal holds one line's
+// definitions at most.
+static void recover(Interpreter &interp, const Options &options, Interpreter::Checkpoint &good) {
+    interp.rollback(good);
+    if (!options.keepDefinitions) {
+        interp.resetEnvironment();
+    }
+    good = interp.checkpoint();
+}
+
+static int run_interactive_mode(const Options &options) {
     Interpreter interp;
+    configure(interp, options);
+    Interpreter::Checkpoint good = interp.checkpoint();
 
     // initial prompt
     prompt();
@@ -114,22 +163,23 @@ static int run_interactive_mode() {
             continue;
         }
 
-        std::istringstream iss(line);
         try {
             Expression result;
-            if (!parse_and_eval(interp, iss, result)) {
-                error("parse error");
+            if (!parse_and_eval(interp, options, line, result)) {
+                parse_error(interp);
             } else {
                 std::cout << result << std::endl;
+                good = interp.checkpoint();
+                interp.commit(good);
             }
         } catch (const InterpreterSemanticError &e) {
             error(e.what());
             // reset env on semantic error
-            interp = Interpreter();
+            recover(interp, options, good);
         } catch (const std::exception &e) {
             // any other error: throw and reset
             error(e.what());
-            interp = Interpreter();
+            recover(interp, options, good);
         }
 
         prompt();
@@ -145,29 +195,57 @@ int main(int argc, char *argv[]) {
     //
     // IMPORTANT:
     //   - Do not call eval() unless parse() returned true.
-    //   - On parse failure:       Error: parse error
+    //   - On parse failure:       Error: parse error at byte <offset>
     //   - On semantic exception:  Error: <message>
     //   - In REPL, reset the environment after a semantic error.
     //   - Exit codes:
     //       * success   → EXIT_SUCCESS
     //       * any error → EXIT_FAILURE
 
+    // Leading options pick the evaluator: --tree (default) walks the AST,
+    // --flat walks its flattened form, --vm compiles it to bytecode and
+    // runs that. --keep-definitions makes
+    // the REPL keep user definitions across errors instead of resetting.
+    // --optimize folds constants before eval; --dump-ast writes the AST that
+    // will be evaluated to stderr.
+    Options options;
+    int first = 1;
+    for (; first < argc; ++first) {
+        const std::string option(argv[first]);
+        if (option == "--vm") {
+            options.mode = BytecodeEval;
+        } else if (option == "--tree") {
+            options.mode = TreeWalkEval;
+        } else if (option == "--flat") {
+            options.mode = FlatEval;
+        } else if (option == "--keep-definitions") {
+            options.keepDefinitions = true;
+        } else if (option == "--optimize") {
+            options.optimize = true;
+        } else if (option == "--dump-ast") {
+            options.dumpAst = true;
+        } else {
+            break;
+        }
+    }
+    const int args = argc - first;
+
     // Interactive REPL mode
-    if (argc == 1) {
-        return run_interactive_mode();
+    if (args == 0) {
+        return run_interactive_mode(options);
     }
 
     // Single Expression mode
-    if (argc == 3 && std::string(argv[1]) == "-e") {
-        return run_single_expression_mode(std::string(argv[2]));
+    if (args == 2 && std::string(argv[first]) == "-e") {
+        return run_single_expression_mode(std::string(argv[first + 1]), options);
     }
 
     // File mode
-    if (argc == 2) {
-        return run_file_mode(argv[1]);
+    if (args == 1) {
+        return run_file_mode(argv[first], options);
     }
 
     // otherwise, throw invalid args
     error("invalid arguments");
     return EXIT_FAILURE;
-}
\ No newline at end of file
+}
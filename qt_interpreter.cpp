@@ -1,10 +1,13 @@
 #include "qt_interpreter.hpp"
 #include "qgraphics_arc_item.hpp"
+#include "display_list_item.hpp"
 #include "interpreter_semantic_error.hpp"
 #include "tokenizer.hpp"
 
 #include <QPen>
+#include <QPainterPath>
 #include <QGraphicsEllipseItem>
+#include <QGraphicsPathItem>
 
 #include <algorithm>
 #include <cctype>
@@ -24,115 +27,195 @@ void QtInterpreter::parseAndEvaluate(QString entry) {
         return;
     }
 
+    // 2) Drop the last entry's draws; a failed eval rolls back to here,
+    // so it neither leaves definitions nor leaks batches
+    clearPendingDraws();
+    const Checkpoint before = checkpoint();
+
     try {
         // 3) Evaluate full program
-        clearPendingDraws();
         Expression result = eval();
 
         // 4) Render graphics collected in eval
-        for (const auto &graphic: getPendingDraws()) {
-            createGraphicItem(graphic);
-        }
+        drawDisplayList(getDisplayList());
 
         std::ostringstream oss;
         oss << result;
         emit info(QString::fromStdString(oss.str()));
+
+        // 5) The scene holds the draws now; keep only the batches that
+        // definitions hold
+        commit(checkpoint());
+        releaseUnboundBatches();
     } catch (const InterpreterSemanticError &e) {
+        rollback(before);
         emit error(QString("Error: ") + QString(e.what()));
     } catch (const std::exception &e) {
+        rollback(before);
         emit error(QString("Error: ") + QString(e.what()));
     }
 }
 
-void QtInterpreter::createGraphicItem(const Expression &exp) {
-    const Type type = exp.headType();
+// One scene item per primitive
+static QGraphicsItem *make_item(const Point &p) {
+    auto *item = new QGraphicsEllipseItem(p.x - 2, p.y - 2, 4, 4);
+    item->setBrush(QBrush(Qt::black));
+    item->setPen(Qt::NoPen);
+    return item;
+}
 
-    if (type == PointType) {
-        const Point p = exp.headValue().point_value;
-        auto *item = new QGraphicsEllipseItem(p.x - 2, p.y - 2, 4, 4);
-        item->setBrush(QBrush(Qt::black));
-        item->setPen(Qt::NoPen);
-        emit drawGraphic(item);
-        return;
-    }
+static QGraphicsItem *make_item(const Line &l) {
+    auto *item = new QGraphicsLineItem(l.start.x, l.start.y, l.end.x, l.end.y);
+    item->setPen(QPen(Qt::black));
+    return item;
+}
 
-    if (type == LineType) {
-        const Line l = exp.headValue().line_value;
-        auto *item = new QGraphicsLineItem(l.start.x, l.start.y, l.end.x, l.end.y);
-        item->setPen(QPen(Qt::black));
-        emit drawGraphic(item);
-        return;
-    }
+static QGraphicsItem *make_item(const Arc &arc) {
+    const double dx = (arc.start.x - arc.center.x);
+    const double dy = (arc.start.y - arc.center.y);
+    const double radius = std::sqrt(dx * dx + dy * dy);
 
-    if (type == ArcType) {
-        const Arc arc = exp.headValue().arc_value;
+    const double startAngleRad = std::atan2(-dy, dx);
 
-        const double dx = (arc.start.x - arc.center.x);
-        const double dy = (arc.start.y - arc.center.y);
-        const double radius = std::sqrt(dx * dx + dy * dy);
+    const int startAngleQt = int(startAngleRad * 180.0 / M_PI * 16.0);
+    const int spanAngleQt = int(arc.angle * 180.0 / M_PI * 16.0);
 
-        const double startAngleRad = std::atan2(-dy, dx);
+    const qreal x = arc.center.x - radius;
+    const qreal y = arc.center.y - radius;
+    const qreal w = 2 * radius;
+    const qreal h = 2 * radius;
 
-        const int startAngleQt = int(startAngleRad * 180.0 / M_PI * 16.0);
-        const int spanAngleQt = int(arc.angle * 180.0 / M_PI * 16.0);
+    auto *item = new QGraphicsArcItem(x, y, w, h);
+    item->setStartAngle(startAngleQt);
+    item->setSpanAngle(spanAngleQt);
 
-        const qreal x = arc.center.x - radius;
-        const qreal y = arc.center.y - radius;
-        const qreal w = 2 * radius;
-        const qreal h = 2 * radius;
+    QPen pen(Qt::black);
+    pen.setWidthF(1.0);
+    pen.setCapStyle(Qt::RoundCap);
+    pen.setJoinStyle(Qt::RoundJoin);
+    item->setPen(pen);
+    return item;
+}
 
-        auto *item = new QGraphicsArcItem(x, y, w, h);
-        item->setStartAngle(startAngleQt);
-        item->setSpanAngle(spanAngleQt);
+// The normalized rectangle with corners 'r'
+static QRectF bounds(const Rect &r) {
+    const double x = std::min(r.point1.x, r.point2.x);
+    const double y = std::min(r.point1.y, r.point2.y);
+    const double w = std::abs(r.point2.x - r.point1.x);
+    const double h = std::abs(r.point2.y - r.point1.y);
+    return QRectF(x, y, w, h);
+}
 
-        QPen pen(Qt::black);
-        pen.setWidthF(1.0);
-        pen.setCapStyle(Qt::RoundCap);
-        pen.setJoinStyle(Qt::RoundJoin);
-        item->setPen(pen);
+static QGraphicsItem *make_item(const Rect &r) {
+    auto *item = new QGraphicsRectItem(bounds(r));
+    item->setPen(QPen(Qt::black));
+    item->setBrush(Qt::NoBrush);
+    return item;
+}
 
-        emit drawGraphic(item);
-        return;
-    }
+static QGraphicsItem *make_item(const FillRect &fr) {
+    auto *item = new QGraphicsRectItem(bounds(fr.rect));
+    item->setPen(Qt::NoPen);
+    item->setBrush(QBrush(QColor(int(fr.r), int(fr.g), int(fr.b))));
+    return item;
+}
+
+static QGraphicsItem *make_item(const Ellipse &e) {
+    auto *item = new QGraphicsEllipseItem(bounds(e.rect));
+    item->setPen(QPen(Qt::black));
+    item->setBrush(Qt::NoBrush);
+    return item;
+}
 
-    if (type == RectType) {
-        const Rect r = exp.headValue().rect_value;
-        const double x = std::min(r.point1.x, r.point2.x);
-        const double y = std::min(r.point1.y, r.point2.y);
-        const double w = std::abs(r.point2.x - r.point1.x);
-        const double h = std::abs(r.point2.y - r.point1.y);
+// one path item for the whole batch, however many vertices it has
+static QGraphicsItem *make_item(const Batch &batch) {
+    QPainterPath path;
+    if (batch.kind == PointsBatch) {
+        for (std::uint32_t i = 0; i < batch.count; ++i) {
+            path.addEllipse(batch.xs[i] - 2, batch.ys[i] - 2, 4, 4);
+        }
+    } else if (batch.kind == LinesBatch) {
+        for (std::uint32_t i = 0; i + 1 < batch.count; i += 2) {
+            path.moveTo(batch.xs[i], batch.ys[i]);
+            path.lineTo(batch.xs[i + 1], batch.ys[i + 1]);
+        }
+    } else {
+        path.moveTo(batch.xs[0], batch.ys[0]);
+        for (std::uint32_t i = 1; i < batch.count; ++i) {
+            path.lineTo(batch.xs[i], batch.ys[i]);
+        }
+        if (batch.kind == PolygonBatch) {
+            path.closeSubpath();
+        }
+    }
 
-        auto *item = new QGraphicsRectItem(x, y, w, h);
+    auto *item = new QGraphicsPathItem(path);
+    if (batch.kind == PointsBatch) {
+        item->setBrush(QBrush(Qt::black));
+        item->setPen(Qt::NoPen);
+    } else {
         item->setPen(QPen(Qt::black));
         item->setBrush(Qt::NoBrush);
-        emit drawGraphic(item);
-        return;
     }
+    return item;
+}
 
-    if (type == FillRectType) {
-        const FillRect fr = exp.headValue().fill_rect_value;
-        const double x = std::min(fr.rect.point1.x, fr.rect.point2.x);
-        const double y = std::min(fr.rect.point1.y, fr.rect.point2.y);
-        const double w = std::abs(fr.rect.point2.x - fr.rect.point1.x);
-        const double h = std::abs(fr.rect.point2.y - fr.rect.point1.y);
+template<class T>
+static void append_items(const std::vector<T> &array, const DisplayList::Run &run, QList<QGraphicsItem *> &items) {
+    for (std::uint32_t i = run.first; i < run.first + run.count; ++i) {
+        items.append(make_item(array[i]));
+    }
+}
 
-        auto *item = new QGraphicsRectItem(x, y, w, h);
-        item->setPen(Qt::NoPen);
-        item->setBrush(QBrush(QColor(int(fr.r), int(fr.g), int(fr.b))));
-        emit drawGraphic(item);
+void QtInterpreter::drawDisplayList(const DisplayList &list) {
+    if (list.empty()) {
+        return;
+    }
+    QList<QGraphicsItem *> items;
+    if (list.size() >= packedThreshold) {
+        items.append(new DisplayListItem(list));
+        emitItems(items);
         return;
     }
 
-    if (type == EllipseType) {
-        const Ellipse e = exp.headValue().ellipse_value;
-        const double x = std::min(e.rect.point1.x, e.rect.point2.x);
-        const double y = std::min(e.rect.point1.y, e.rect.point2.y);
-        const double w = std::abs(e.rect.point2.x - e.rect.point1.x);
-        const double h = std::abs(e.rect.point2.y - e.rect.point1.y);
+    // each run is a slice of one kind's array, in draw order
+    items.reserve(static_cast<int>(list.size()));
+    for (const DisplayList::Run &run: list.runs()) {
+        switch (run.type) {
+            case PointType:
+                append_items(list.points(), run, items);
+                break;
+            case LineType:
+                append_items(list.lines(), run, items);
+                break;
+            case ArcType:
+                append_items(list.arcs(), run, items);
+                break;
+            case RectType:
+                append_items(list.rects(), run, items);
+                break;
+            case FillRectType:
+                append_items(list.fill_rects(), run, items);
+                break;
+            case EllipseType:
+                append_items(list.ellipses(), run, items);
+                break;
+            case BatchType:
+                append_items(list.batches(), run, items);
+                break;
+            default:
+                break;
+        }
+    }
+    emitItems(items);
+}
 
-        auto *item = new QGraphicsEllipseItem(x, y, w, h);
-        item->setPen(QPen(Qt::black));
-        item->setBrush(Qt::NoBrush);
+void QtInterpreter::emitItems(const QList<QGraphicsItem *> &items) {
+    if (!perItemSignals) {
+        emit drawGraphics(items);
+        return;
+    }
+    for (QGraphicsItem *item: items) {
         emit drawGraphic(item);
     }
 }
@@ -1,12 +1,15 @@
 #ifndef QT_INTERPRETER_HPP
 #define QT_INTERPRETER_HPP
 
+#include <cstddef>
 #include <string>
 
+#include <QList>
 #include <QObject>
 #include <QString>
 #include <QGraphicsItem>
 
+#include "display_list.hpp"
 #include "interpreter.hpp"
 #include "expression.hpp"
 
@@ -16,9 +19,26 @@ class QtInterpreter : public QObject, Interpreter {
 public:
     QtInterpreter(QObject *parent = nullptr);
 
+    // Display lists of at least this many draws go to the scene as one
+    // DisplayListItem instead of an item per primitive
+    void setPackedThreshold(std::size_t draws) noexcept { packedThreshold = draws; }
+    std::size_t getPackedThreshold() const noexcept { return packedThreshold; }
+
+    // Compatibility with receivers of the documented drawGraphic: emit it
+    // once per item instead of drawGraphics. Only one of the two is ever
+    // emitted for an eval, so each item has exactly one owner.
+    void setPerItemSignals(bool enabled) noexcept { perItemSignals = enabled; }
+    bool getPerItemSignals() const noexcept { return perItemSignals; }
+
 signals:
+    // each item one eval() drew, in draw order, one signal per item; only
+    // with setPerItemSignals(true)
     void drawGraphic(QGraphicsItem *item);
 
+    // all the items one eval() drew, in draw order, in a single signal for
+    // receivers that insert in bulk; the default
+    void drawGraphics(QList<QGraphicsItem *> items);
+
     void info(QString message);
 
     void error(QString message);
@@ -27,7 +47,15 @@ public slots:
     void parseAndEvaluate(QString entry);
 
 private:
-    void createGraphicItem(const Expression &exp);
+    // emit drawGraphics, or drawGraphic per item, with a scene item per
+    // drawn primitive, or a DisplayListItem for all of them
+    void drawDisplayList(const DisplayList &list);
+
+    // hand the items to the receivers of whichever signal is selected
+    void emitItems(const QList<QGraphicsItem *> &items);
+
+    std::size_t packedThreshold = 10000;
+    bool perItemSignals = false;
 };
 
 #endif
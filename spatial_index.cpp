@@ -0,0 +1,410 @@
+#include "spatial_index.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+// Draws covering more cells than this are kept in 'large'
+static const std::size_t LargeCells = 64;
+
+// Most columns or rows of the grid
+static const std::size_t MaxCells = 4096;
+
+static const Number TwoPi = 2 * std::atan2(0, -1);
+
+static Box box_of(const Point a, const Point b) noexcept {
+    return Box{std::min(a.x, b.x), std::min(a.y, b.y), std::max(a.x, b.x), std::max(a.y, b.y)};
+}
+
+static void extend(Box &box, const Point p) noexcept {
+    box.x0 = std::min(box.x0, p.x);
+    box.y0 = std::min(box.y0, p.y);
+    box.x1 = std::max(box.x1, p.x);
+    box.y1 = std::max(box.y1, p.y);
+}
+
+// Arcs are drawn as on screen: angles grow counterclockwise with y
+// pointing down, so the point at angle t is (cx + r cos t, cy - r sin t)
+static Number arc_radius(const Arc &arc) noexcept {
+    return std::hypot(arc.start.x - arc.center.x, arc.start.y - arc.center.y);
+}
+
+static Number angle_of(const Arc &arc, const Point p) noexcept {
+    return std::atan2(-(p.y - arc.center.y), p.x - arc.center.x);
+}
+
+static Point on_arc(const Arc &arc, const Number r, const Number t) noexcept {
+    return Point{arc.center.x + r * std::cos(t), arc.center.y - r * std::sin(t)};
+}
+
+// Does the sweep of 'arc' pass the angle 't'?
+static bool sweeps(const Arc &arc, const Number t) noexcept {
+    if (std::fabs(arc.angle) >= TwoPi) {
+        return true;
+    }
+    const Number start = angle_of(arc, arc.start);
+    Number d = arc.angle >= 0 ? t - start : start - t;
+    d = std::fmod(d, TwoPi);
+    if (d < 0) {
+        d += TwoPi;
+    }
+    return d <= std::fabs(arc.angle);
+}
+
+Box bounds_of(const Point &p) noexcept {
+    return Box{p.x, p.y, p.x, p.y};
+}
+
+Box bounds_of(const Line &l) noexcept {
+    return box_of(l.start, l.end);
+}
+
+Box bounds_of(const Arc &arc) noexcept {
+    const Number r = arc_radius(arc);
+    const Number start = angle_of(arc, arc.start);
+    Box box = box_of(arc.start, on_arc(arc, r, start + arc.angle));
+    for (int quadrant = 0; quadrant < 4; ++quadrant) {
+        const Number t = quadrant * TwoPi / 4;
+        if (sweeps(arc, t)) {
+            extend(box, on_arc(arc, r, t));
+        }
+    }
+    return box;
+}
+
+Box bounds_of(const Rect &r) noexcept {
+    return box_of(r.point1, r.point2);
+}
+
+Box bounds_of(const FillRect &fr) noexcept {
+    return bounds_of(fr.rect);
+}
+
+Box bounds_of(const Ellipse &e) noexcept {
+    return bounds_of(e.rect);
+}
+
+Box bounds_of(const Batch &batch) noexcept {
+    Box box = bounds_of(batch.vertex(0));
+    for (std::uint32_t i = 1; i < batch.count; ++i) {
+        extend(box, batch.vertex(i));
+    }
+    return box;
+}
+
+template<class T>
+static void append_boxes(const std::vector<T> &array, const DisplayList::Run &run, const Number margin,
+                         std::vector<Box> &boxes) {
+    for (std::uint32_t i = run.first; i < run.first + run.count; ++i) {
+        boxes.push_back(bounds_of(array[i]).inflated(margin));
+    }
+}
+
+void SpatialIndex::build(const DisplayList &drawn, const Number margin) {
+    clear();
+    list = &drawn;
+    boxes.reserve(drawn.size());
+    runStarts.reserve(drawn.runs().size());
+    for (const DisplayList::Run &run: drawn.runs()) {
+        runStarts.push_back(static_cast<Draw>(boxes.size()));
+        switch (run.type) {
+            case PointType:
+                append_boxes(drawn.points(), run, margin, boxes);
+                break;
+            case LineType:
+                append_boxes(drawn.lines(), run, margin, boxes);
+                break;
+            case ArcType:
+                append_boxes(drawn.arcs(), run, margin, boxes);
+                break;
+            case RectType:
+                append_boxes(drawn.rects(), run, margin, boxes);
+                break;
+            case FillRectType:
+                append_boxes(drawn.fill_rects(), run, margin, boxes);
+                break;
+            case EllipseType:
+                append_boxes(drawn.ellipses(), run, margin, boxes);
+                break;
+            case BatchType:
+                append_boxes(drawn.batches(), run, margin, boxes);
+                break;
+            default:
+                break;
+        }
+    }
+    if (boxes.empty()) {
+        return;
+    }
+
+    // draws that overflowed to infinity or NaN stay out of the grid
+    bool first = true;
+    for (const Box &box: boxes) {
+        if (!box.finite()) {
+            continue;
+        }
+        if (first) {
+            all = box;
+            first = false;
+        }
+        extend(all, Point{box.x0, box.y0});
+        extend(all, Point{box.x1, box.y1});
+    }
+
+    // about one cell per draw, shaped like the drawing; a drawing too
+    // wide for its width to be finite is one column, as is a thin one
+    const std::size_t n = boxes.size();
+    const Number width = all.x1 - all.x0, height = all.y1 - all.y0;
+    const bool wide = width > 0 && std::isfinite(width), tall = height > 0 && std::isfinite(height);
+    if (wide && tall) {
+        const Number ideal = std::min<Number>(std::sqrt(static_cast<Number>(n) * width / height), MaxCells);
+        columns = std::min(MaxCells, std::max<std::size_t>(1, static_cast<std::size_t>(ideal)));
+        rows = std::min(MaxCells, std::max<std::size_t>(1, (n + columns - 1) / columns));
+    } else {
+        columns = wide ? std::min(MaxCells, n) : 1;
+        rows = tall ? std::min(MaxCells, n) : 1;
+    }
+    cellWidth = wide ? width / columns : 1;
+    cellHeight = tall ? height / rows : 1;
+
+    // two passes: count the draws per cell, then place them
+    cellStarts.assign(columns * rows + 1, 0);
+    std::size_t cx0, cy0, cx1, cy1;
+    for (Draw d = 0; d < n; ++d) {
+        if (!boxes[d].finite()) {
+            large.push_back(d);
+            continue;
+        }
+        cells_of(boxes[d], cx0, cy0, cx1, cy1);
+        if ((cx1 - cx0 + 1) * (cy1 - cy0 + 1) > LargeCells) {
+            large.push_back(d);
+            continue;
+        }
+        for (std::size_t cy = cy0; cy <= cy1; ++cy) {
+            for (std::size_t cx = cx0; cx <= cx1; ++cx) {
+                ++cellStarts[cy * columns + cx + 1];
+            }
+        }
+    }
+    for (std::size_t c = 1; c < cellStarts.size(); ++c) {
+        cellStarts[c] += cellStarts[c - 1];
+    }
+    cellDraws.resize(cellStarts.back());
+    std::vector<std::uint32_t> fill(cellStarts.begin(), cellStarts.end() - 1);
+    std::size_t next = 0; // into 'large', which is in draw order
+    for (Draw d = 0; d < n; ++d) {
+        if (next < large.size() && large[next] == d) {
+            ++next;
+            continue;
+        }
+        cells_of(boxes[d], cx0, cy0, cx1, cy1);
+        for (std::size_t cy = cy0; cy <= cy1; ++cy) {
+            for (std::size_t cx = cx0; cx <= cx1; ++cx) {
+                cellDraws[fill[cy * columns + cx]++] = d;
+            }
+        }
+    }
+}
+
+void SpatialIndex::clear() {
+    list = nullptr;
+    boxes.clear();
+    runStarts.clear();
+    all = Box{0, 0, 0, 0};
+    columns = rows = 0;
+    cellWidth = cellHeight = 1;
+    cellStarts.clear();
+    cellDraws.clear();
+    large.clear();
+}
+
+// cell 'offset / size' of 'count', clamped; NaN to the first
+static std::size_t cell_of(const Number offset, const Number size, const std::size_t count) noexcept {
+    const Number c = offset / size;
+    return !(c > 0) ? 0 : c >= count - 1 ? count - 1 : static_cast<std::size_t>(c);
+}
+
+std::size_t SpatialIndex::column_of(const Number x) const noexcept {
+    return cell_of(x - all.x0, cellWidth, columns);
+}
+
+std::size_t SpatialIndex::row_of(const Number y) const noexcept {
+    return cell_of(y - all.y0, cellHeight, rows);
+}
+
+void SpatialIndex::cells_of(const Box &box, std::size_t &cx0, std::size_t &cy0, std::size_t &cx1,
+                            std::size_t &cy1) const {
+    cx0 = column_of(box.x0);
+    cx1 = column_of(box.x1);
+    cy0 = row_of(box.y0);
+    cy1 = row_of(box.y1);
+}
+
+std::size_t SpatialIndex::run_of(const Draw draw) const noexcept {
+    return static_cast<std::size_t>(std::upper_bound(runStarts.begin(), runStarts.end(), draw) - runStarts.begin()) - 1;
+}
+
+std::uint32_t SpatialIndex::index_of(const Draw draw) const noexcept {
+    const std::size_t run = run_of(draw);
+    return list->runs()[run].first + (draw - runStarts[run]);
+}
+
+Atom SpatialIndex::atom(const Draw draw) const noexcept {
+    return list->atom(list->runs()[run_of(draw)].type, index_of(draw));
+}
+
+void SpatialIndex::query(const Box &area, std::vector<Draw> &out) const {
+    out.clear();
+    if (boxes.empty() || (!all.intersects(area) && large.empty())) {
+        return;
+    }
+    if (area.x0 <= all.x0 && area.y0 <= all.y0 && area.x1 >= all.x1 && area.y1 >= all.y1) {
+        // everything shows, but for the draws without finite bounds
+        std::size_t next = 0;
+        for (Draw d = 0; d < boxes.size(); ++d) {
+            if (next < large.size() && large[next] == d) {
+                ++next;
+                if (!boxes[d].finite() && !boxes[d].intersects(area)) {
+                    continue;
+                }
+            }
+            out.push_back(d);
+        }
+        return;
+    }
+
+    // a draw listed in several cells is reported only from the first cell
+    // of both its own range and the area's, so each is reported once
+    std::size_t ax0, ay0, ax1, ay1;
+    cells_of(area, ax0, ay0, ax1, ay1);
+    for (std::size_t cy = ay0; cy <= ay1; ++cy) {
+        for (std::size_t cx = ax0; cx <= ax1; ++cx) {
+            const std::size_t cell = cy * columns + cx;
+            for (std::uint32_t i = cellStarts[cell]; i < cellStarts[cell + 1]; ++i) {
+                const Draw d = cellDraws[i];
+                if (!boxes[d].intersects(area)) {
+                    continue;
+                }
+                if (cx == std::max(ax0, column_of(boxes[d].x0)) && cy == std::max(ay0, row_of(boxes[d].y0))) {
+                    out.push_back(d);
+                }
+            }
+        }
+    }
+    for (const Draw d: large) {
+        if (boxes[d].intersects(area)) {
+            out.push_back(d);
+        }
+    }
+
+    // back to draw order; a mark per draw beats sorting most of them
+    if (out.size() > boxes.size() / 16) {
+        std::vector<bool> marked(boxes.size(), false);
+        for (const Draw d: out) {
+            marked[d] = true;
+        }
+        out.clear();
+        for (Draw d = 0; d < boxes.size(); ++d) {
+            if (marked[d]) {
+                out.push_back(d);
+            }
+        }
+    } else {
+        std::sort(out.begin(), out.end());
+    }
+}
+
+static Number distance_to_segment(const Point p, const Point a, const Point b) noexcept {
+    const Number dx = b.x - a.x, dy = b.y - a.y;
+    const Number length2 = dx * dx + dy * dy;
+    Number t = length2 > 0 ? ((p.x - a.x) * dx + (p.y - a.y) * dy) / length2 : 0;
+    t = std::max<Number>(0, std::min<Number>(1, t));
+    return std::hypot(p.x - (a.x + t * dx), p.y - (a.y + t * dy));
+}
+
+static bool inside_ellipse(const Point p, const Box &box, const Number tolerance) noexcept {
+    const Number rx = (box.x1 - box.x0) / 2 + tolerance, ry = (box.y1 - box.y0) / 2 + tolerance;
+    if (rx <= 0 || ry <= 0) {
+        return false;
+    }
+    const Number u = (p.x - (box.x0 + box.x1) / 2) / rx, v = (p.y - (box.y0 + box.y1) / 2) / ry;
+    return u * u + v * v <= 1;
+}
+
+static bool hits_batch(const Batch &batch, const Point p, const Number tolerance) noexcept {
+    if (batch.kind == PointsBatch) {
+        for (std::uint32_t i = 0; i < batch.count; ++i) {
+            if (std::hypot(p.x - batch.xs[i], p.y - batch.ys[i]) <= tolerance) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    const std::uint32_t step = batch.kind == LinesBatch ? 2 : 1;
+    for (std::uint32_t i = 0; i + 1 < batch.count; i += step) {
+        if (distance_to_segment(p, batch.vertex(i), batch.vertex(i + 1)) <= tolerance) {
+            return true;
+        }
+    }
+    if (batch.kind != PolygonBatch) {
+        return false;
+    }
+    if (distance_to_segment(p, batch.vertex(batch.count - 1), batch.vertex(0)) <= tolerance) {
+        return true;
+    }
+    bool inside = false; // even-odd crossings of a ray to the right
+    for (std::uint32_t i = 0, j = batch.count - 1; i < batch.count; j = i++) {
+        if ((batch.ys[i] > p.y) != (batch.ys[j] > p.y) &&
+            p.x < (batch.xs[j] - batch.xs[i]) * (p.y - batch.ys[i]) / (batch.ys[j] - batch.ys[i]) + batch.xs[i]) {
+            inside = !inside;
+        }
+    }
+    return inside;
+}
+
+// Is 'p' within 'tolerance' of the drawable 'a'?
+static bool hits(const Atom &a, const Point p, const Number tolerance) noexcept {
+    const Value &v = a.value;
+    switch (a.type) {
+        case PointType:
+            return std::hypot(p.x - v.point_value.x, p.y - v.point_value.y) <= tolerance;
+        case LineType:
+            return distance_to_segment(p, v.line_value.start, v.line_value.end) <= tolerance;
+        case ArcType: {
+            const Arc &arc = v.arc_value;
+            const Number r = arc_radius(arc);
+            const Number d = std::hypot(p.x - arc.center.x, p.y - arc.center.y);
+            if (std::fabs(d - r) > tolerance) {
+                return false;
+            }
+            const Point end = on_arc(arc, r, angle_of(arc, arc.start) + arc.angle);
+            return sweeps(arc, angle_of(arc, p)) || std::hypot(p.x - arc.start.x, p.y - arc.start.y) <= tolerance ||
+                   std::hypot(p.x - end.x, p.y - end.y) <= tolerance;
+        }
+        case RectType:
+        case FillRectType:
+            return bounds_of(a.type == RectType ? v.rect_value : v.fill_rect_value.rect).inflated(tolerance).contains(p);
+        case EllipseType:
+            return inside_ellipse(p, bounds_of(v.ellipse_value), tolerance);
+        case BatchType:
+            return hits_batch(v.batch_value, p, tolerance);
+        default:
+            return false;
+    }
+}
+
+void SpatialIndex::hit_test(const Point p, const Number tolerance, std::vector<Draw> &out) const {
+    query(bounds_of(p).inflated(tolerance), out);
+    std::size_t kept = 0;
+    for (const Draw d: out) {
+        if (hits(atom(d), p, tolerance)) {
+            out[kept++] = d;
+        }
+    }
+    out.resize(kept);
+}
+
+std::size_t SpatialIndex::bytes() const noexcept {
+    return boxes.size() * sizeof(Box) + runStarts.size() * sizeof(Draw) + cellStarts.size() * sizeof(std::uint32_t) +
+           cellDraws.size() * sizeof(Draw) + large.size() * sizeof(Draw);
+}
@@ -0,0 +1,105 @@
+#ifndef SPATIAL_INDEX_HPP
+#define SPATIAL_INDEX_HPP
+
+// system includes
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// module includes
+#include "display_list.hpp"
+#include "expression.hpp"
+
+// Axis-aligned box [x0, x1] x [y0, y1]
+struct Box {
+    Number x0, y0, x1, y1;
+
+    bool contains(const Point p) const noexcept { return p.x >= x0 && p.x <= x1 && p.y >= y0 && p.y <= y1; }
+
+    bool intersects(const Box &o) const noexcept { return o.x0 <= x1 && x0 <= o.x1 && o.y0 <= y1 && y0 <= o.y1; }
+
+    Box inflated(const Number margin) const noexcept { return Box{x0 - margin, y0 - margin, x1 + margin, y1 + margin}; }
+
+    // No infinite or NaN coordinate, as arithmetic that overflowed leaves
+    bool finite() const noexcept {
+        return std::isfinite(x0) && std::isfinite(y0) && std::isfinite(x1) && std::isfinite(y1);
+    }
+};
+
+// Bounds of each drawable, without pens. An arc is bounded by its end
+// points and the quadrant extremes its sweep passes, not its whole circle.
+Box bounds_of(const Point &p) noexcept;
+Box bounds_of(const Line &l) noexcept;
+Box bounds_of(const Arc &arc) noexcept;
+Box bounds_of(const Rect &r) noexcept;
+Box bounds_of(const FillRect &fr) noexcept;
+Box bounds_of(const Ellipse &e) noexcept;
+Box bounds_of(const Batch &batch) noexcept;
+
+// Uniform grid over the draws of a display list, for culling what a
+// viewport shows and picking what lies under a point. Draws are numbered
+// in draw order; each is listed in every cell its bounds overlap, except
+// draws covering many cells, which are kept aside and checked on every
+// query. So are draws with bounds that are not finite, which neither
+// the grid nor bounds() covers. Built once: the list must outlive the
+// index and stay unchanged.
+class SpatialIndex {
+public:
+    typedef std::uint32_t Draw;
+
+    // Index 'list', with every draw's bounds grown by 'margin' (e.g. to
+    // cover the pen it is painted with)
+    void build(const DisplayList &list, Number margin = 0);
+
+    void clear();
+
+    bool empty() const noexcept { return boxes.empty(); }
+
+    std::size_t size() const noexcept { return boxes.size(); }
+
+    // Bounds of all draws with finite bounds, and of one
+    const Box &bounds() const noexcept { return all; }
+    const Box &bounds(const Draw draw) const noexcept { return boxes[draw]; }
+
+    // The run of the display list 'draw' belongs to, and its index into
+    // the array of the run's type
+    std::size_t run_of(Draw draw) const noexcept;
+    std::uint32_t index_of(Draw draw) const noexcept;
+
+    // The draw as an Atom
+    Atom atom(Draw draw) const noexcept;
+
+    // Set 'out' to the draws whose bounds intersect 'area', in draw order
+    void query(const Box &area, std::vector<Draw> &out) const;
+
+    // Set 'out' to the draws within 'tolerance' of 'p', in draw order, so
+    // the topmost is last. Lines, arcs, polylines and point sets are hit
+    // near their strokes, closed shapes (rects, fill rects, ellipses and
+    // polygons) anywhere inside too.
+    void hit_test(Point p, Number tolerance, std::vector<Draw> &out) const;
+
+    // Bytes of the arrays' contents
+    std::size_t bytes() const noexcept;
+
+private:
+    // grid column of 'x' and row of 'y', clamped to the grid
+    std::size_t column_of(Number x) const noexcept;
+    std::size_t row_of(Number y) const noexcept;
+
+    // cell range [cx0, cx1] x [cy0, cy1] of 'box', clamped to the grid
+    void cells_of(const Box &box, std::size_t &cx0, std::size_t &cy0, std::size_t &cx1, std::size_t &cy1) const;
+
+    const DisplayList *list = nullptr;
+    std::vector<Box> boxes; // per draw
+    std::vector<Draw> runStarts; // first draw of each run
+    Box all{0, 0, 0, 0};
+
+    std::size_t columns = 0, rows = 0;
+    Number cellWidth = 1, cellHeight = 1;
+    std::vector<std::uint32_t> cellStarts; // cell c holds cellDraws[cellStarts[c], cellStarts[c + 1])
+    std::vector<Draw> cellDraws;
+    std::vector<Draw> large; // draws over too many cells to list in each
+};
+
+#endif
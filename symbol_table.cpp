@@ -0,0 +1,37 @@
+#include "symbol_table.hpp"
+
+// Spelling of each BuiltinSymbol, in enum order
+static const char *const builtin_names[BuiltinSymbolCount] = {
+    "",
+    "define", "begin", "if", "draw",
+    "pi",
+    "+", "-", "*", "/",
+    "not", "and", "or",
+    "<", "<=", ">", ">=", "==",
+    "sqrt", "log2", "sin", "cos", "arctan",
+    "point", "line", "arc", "rect", "fill_rect", "ellipse",
+    "points", "polyline", "lines", "polygon",
+    "translate", "scale", "rotate", "transform",
+};
+
+SymbolTable &SymbolTable::global() {
+    static SymbolTable table;
+    return table;
+}
+
+SymbolTable::SymbolTable() {
+    for (const char *name: builtin_names) {
+        intern(name);
+    }
+}
+
+SymbolId SymbolTable::intern(const std::string &name) {
+    auto it = ids.find(name);
+    if (it != ids.end()) {
+        return it->second;
+    }
+    const SymbolId id = static_cast<SymbolId>(names.size());
+    it = ids.emplace(name, id).first;
+    names.push_back(&it->first);
+    return id;
+}
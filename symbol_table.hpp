@@ -0,0 +1,56 @@
+#ifndef SYMBOL_TABLE_HPP
+#define SYMBOL_TABLE_HPP
+
+// system includes
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+typedef std::uint32_t SymbolId;
+
+// Symbols every interpreter knows about. They are interned first, in this
+// order, so their ids are compile-time constants usable in a switch.
+enum BuiltinSymbol : SymbolId {
+    SymEmpty, // the empty symbol, id of a zero-initialized SymbolRef
+
+    // special forms
+    SymDefine, SymBegin, SymIf, SymDraw,
+
+    // constants
+    SymPi,
+
+    // procedures
+    SymAdd, SymSub, SymMul, SymDiv,
+    SymNot, SymAnd, SymOr,
+    SymLt, SymLe, SymGt, SymGe, SymEq,
+    SymSqrt, SymLog2, SymSin, SymCos, SymArctan,
+    SymPoint, SymLine, SymArc, SymRect, SymFillRect, SymEllipse,
+    SymPoints, SymPolyline, SymLines, SymPolygon,
+    SymTranslate, SymScale, SymRotate, SymTransform,
+
+    BuiltinSymbolCount
+};
+
+// Process-wide interner mapping symbol text to small dense integer ids.
+// Ids are never reused and names are never freed. Not thread-safe: symbols
+// are interned while parsing, which happens on one thread.
+class SymbolTable {
+public:
+    static SymbolTable &global();
+
+    // Id of 'name', interning it on first use
+    SymbolId intern(const std::string &name);
+
+    const std::string &name(SymbolId id) const { return *names[id]; }
+
+    std::size_t size() const noexcept { return names.size(); }
+
+private:
+    SymbolTable();
+
+    std::unordered_map<std::string, SymbolId> ids;
+    std::vector<const std::string *> names; // keys of 'ids', which never move
+};
+
+#endif
@@ -0,0 +1,61 @@
+#include "tile_cache.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// Levels past these are clamped; 2^30 pixels per unit is beyond any zoom
+static const int MinLevel = -30;
+static const int MaxLevel = 30;
+
+int tile_level(const Number scale) noexcept {
+    if (!(scale > 0)) {
+        return 0;
+    }
+    // a scale a rounding error over a power of two is that power
+    const Number level = std::ceil(std::log2(scale) - 1e-9);
+    return level <= MinLevel ? MinLevel : level >= MaxLevel ? MaxLevel : static_cast<int>(level);
+}
+
+static Number tile_width(const int level, const int size) noexcept {
+    return std::ldexp(static_cast<Number>(size), -level);
+}
+
+Box tile_box(const TileKey &key, const int size) noexcept {
+    const Number width = tile_width(key.level, size);
+    return Box{key.column * width, key.row * width, (key.column + 1) * width, (key.row + 1) * width};
+}
+
+// 'n / 2^levels', rounded down for negative 'n' too
+static int floor_shift(const int n, const int levels) noexcept {
+    return n >= 0 ? n >> levels : -((-n - 1) >> levels) - 1;
+}
+
+TileKey tile_parent(const TileKey &key, const int levels) noexcept {
+    return TileKey{key.layer, key.level - levels, floor_shift(key.column, levels), floor_shift(key.row, levels)};
+}
+
+// Tile indices are clamped to this: at level 30 a tile is 2^-22 units
+// wide, so a coordinate of a few hundred units is already past INT_MAX
+// tiles. Half the range leaves room for the +1 of a tile's far edge.
+static const int MaxIndex = std::numeric_limits<int>::max() / 2;
+
+// 'index', a whole number, as an int within +-MaxIndex; NaN is -MaxIndex
+static int to_index(const Number index) noexcept {
+    return !(index > -MaxIndex) ? -MaxIndex : index >= MaxIndex ? MaxIndex : static_cast<int>(index);
+}
+
+void tiles_covering(const std::uint64_t layer, const int level, const int size, const Box &area,
+                    std::vector<TileKey> &out) {
+    const Number width = tile_width(level, size);
+    const int column0 = to_index(std::floor(area.x0 / width));
+    const int row0 = to_index(std::floor(area.y0 / width));
+    // a tile the area only touches at its edge is not covered
+    const int column1 = std::max(column0, to_index(std::ceil(area.x1 / width)) - 1);
+    const int row1 = std::max(row0, to_index(std::ceil(area.y1 / width)) - 1);
+    for (int row = row0; row <= row1; ++row) {
+        for (int column = column0; column <= column1; ++column) {
+            out.push_back(TileKey{layer, level, column, row});
+        }
+    }
+}
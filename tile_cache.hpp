@@ -0,0 +1,147 @@
+#ifndef TILE_CACHE_HPP
+#define TILE_CACHE_HPP
+
+// system includes
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// module includes
+#include "expression.hpp"
+#include "spatial_index.hpp"
+
+// One square of 'size' pixels of a layer rendered at the scale 2^level:
+// the tile (column, row) of the grid of such squares from the origin
+struct TileKey {
+    std::uint64_t layer;
+    int level;
+    int column;
+    int row;
+
+    bool operator==(const TileKey &o) const noexcept {
+        return layer == o.layer && level == o.level && column == o.column && row == o.row;
+    }
+};
+
+struct TileKeyHash {
+    std::size_t operator()(const TileKey &key) const noexcept {
+        std::uint64_t h = key.layer * 0x9e3779b97f4a7c15ull;
+        h ^= static_cast<std::uint32_t>(key.level) + 0x9e3779b9u + (h << 6) + (h >> 2);
+        h ^= static_cast<std::uint32_t>(key.column) + 0x9e3779b9u + (h << 6) + (h >> 2);
+        h ^= static_cast<std::uint32_t>(key.row) + 0x9e3779b9u + (h << 6) + (h >> 2);
+        return static_cast<std::size_t>(h);
+    }
+};
+
+// The level of the tiles a view at 'scale' pixels per unit shows: the
+// smallest power of two at least 'scale', so tiles are never enlarged
+int tile_level(Number scale) noexcept;
+
+// The box 'key' covers, for tiles of 'size' pixels
+Box tile_box(const TileKey &key, int size) noexcept;
+
+// The parent of 'key' 'levels' levels coarser, which covers it
+TileKey tile_parent(const TileKey &key, int levels) noexcept;
+
+// Append the tiles of 'layer' at 'level' that 'area' overlaps, row by
+// row, for tiles of 'size' pixels. Columns and rows are clamped to half
+// the range of int, so an area too far out for the level gets the tiles
+// at the clamp instead of overflowing.
+void tiles_covering(std::uint64_t layer, int level, int size, const Box &area, std::vector<TileKey> &out);
+
+// Rendered tiles by key, least recently used first out once their bytes
+// pass the budget
+template<class Tile>
+class TileCache {
+public:
+    explicit TileCache(std::size_t budget) : limit(budget) {}
+
+    // Evicts down to 'bytes' at once
+    void set_budget(std::size_t bytes) {
+        limit = bytes;
+        evict();
+    }
+
+    std::size_t budget() const noexcept { return limit; }
+
+    // Bytes of the tiles held, as given to insert
+    std::size_t bytes() const noexcept { return total; }
+
+    std::size_t size() const noexcept { return lookup.size(); }
+
+    // The tile, now the most recently used, or nullptr
+    const Tile *find(const TileKey &key) {
+        const auto found = lookup.find(key);
+        if (found == lookup.end()) {
+            return nullptr;
+        }
+        entries.splice(entries.begin(), entries, found->second);
+        return &found->second->tile;
+    }
+
+    // Is 'key' held? Does not count as a use
+    bool contains(const TileKey &key) const { return lookup.count(key) != 0; }
+
+    // Hold 'tile' of 'bytes' as the most recently used, in place of any
+    // tile of the same key; a tile over the whole budget is not kept
+    void insert(const TileKey &key, Tile tile, std::size_t bytes) {
+        erase(key);
+        entries.push_front(Entry{key, std::move(tile), bytes});
+        lookup[key] = entries.begin();
+        total += bytes;
+        evict();
+    }
+
+    void erase(const TileKey &key) {
+        const auto found = lookup.find(key);
+        if (found != lookup.end()) {
+            total -= found->second->bytes;
+            entries.erase(found->second);
+            lookup.erase(found);
+        }
+    }
+
+    // Drop every tile of 'layer'
+    void erase_layer(std::uint64_t layer) {
+        for (auto i = entries.begin(); i != entries.end();) {
+            if (i->key.layer == layer) {
+                total -= i->bytes;
+                lookup.erase(i->key);
+                i = entries.erase(i);
+            } else {
+                ++i;
+            }
+        }
+    }
+
+    void clear() {
+        entries.clear();
+        lookup.clear();
+        total = 0;
+    }
+
+private:
+    struct Entry {
+        TileKey key;
+        Tile tile;
+        std::size_t bytes;
+    };
+
+    void evict() {
+        while (total > limit && !entries.empty()) {
+            total -= entries.back().bytes;
+            lookup.erase(entries.back().key);
+            entries.pop_back();
+        }
+    }
+
+    std::size_t limit;
+    std::size_t total = 0;
+    std::list<Entry> entries; // most recently used first
+    std::unordered_map<TileKey, typename std::list<Entry>::iterator, TileKeyHash> lookup;
+};
+
+#endif
@@ -0,0 +1,213 @@
+#include "tile_renderer.hpp"
+
+#include <QColor>
+#include <QCoreApplication>
+#include <QGraphicsItem>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QPainter>
+#include <QRunnable>
+#include <QTransform>
+
+#include <cmath>
+
+// Default budget of the tile cache
+static const std::size_t DefaultBudget = std::size_t(64) << 20;
+
+// Most tiles queued; older requests beyond it are dropped, since the
+// view has long moved on from them
+static const std::size_t MaxQueued = 512;
+
+// Coarser levels searched for a stand-in of a missing tile
+static const int StandInLevels = 3;
+
+static QRectF to_rect(const Box &box) {
+    return QRectF(QPointF(box.x0, box.y0), QPointF(box.x1, box.y1));
+}
+
+// Where workers hand their tiles: the renderer, until its destructor
+// clears it under 'lock', so no worker emits through a renderer being
+// destroyed
+struct TileSink {
+    QMutex lock;
+    TileRenderer *renderer;
+};
+
+// Paints one tile into an image on a worker thread, and hands it to the
+// renderer's thread through tileRendered. A tile of a removed layer is
+// handed over unpainted, for the renderer to count it finished.
+class TileTask : public QRunnable {
+public:
+    TileTask(std::shared_ptr<TileSink> sink, const TileKey &key,
+             std::shared_ptr<const TileRenderer::Content> content, std::shared_ptr<std::atomic<bool>> removed)
+        : sink(std::move(sink)), key(key), content(std::move(content)), removed(std::move(removed)) {}
+
+    void run() override {
+        QImage image;
+        if (!*removed) {
+            image = QImage(TileRenderer::TileSize, TileRenderer::TileSize, QImage::Format_ARGB32_Premultiplied);
+            image.fill(Qt::transparent);
+            const QRectF area = to_rect(tile_box(key, TileRenderer::TileSize));
+            QPainter painter(&image);
+            const qreal scale = std::ldexp(1.0, key.level);
+            painter.scale(scale, scale);
+            painter.translate(-area.topLeft());
+            painter.setClipRect(area);
+            (*content)(&painter, area);
+        }
+        const QMutexLocker hold(&sink->lock);
+        if (sink->renderer != nullptr) {
+            emit sink->renderer->tileRendered(key.layer, key.level, key.column, key.row, image);
+        }
+    }
+
+private:
+    std::shared_ptr<TileSink> sink;
+    TileKey key;
+    std::shared_ptr<const TileRenderer::Content> content;
+    std::shared_ptr<std::atomic<bool>> removed;
+};
+
+TileRenderer::TileRenderer(QObject *parent)
+    : QObject(parent), sink(std::make_shared<TileSink>()), cache(DefaultBudget) {
+    sink->renderer = this;
+    connect(this, &TileRenderer::tileRendered, this, &TileRenderer::finishTile, Qt::QueuedConnection);
+}
+
+TileRenderer::~TileRenderer() {
+    {
+        const QMutexLocker hold(&sink->lock);
+        sink->renderer = nullptr;
+    }
+    queue.clear();
+    for (auto &layer: layers) {
+        *layer.second.removed = true;
+    }
+    pool.waitForDone();
+}
+
+TileRenderer::Layer TileRenderer::addLayer(QGraphicsItem *item, Content content) {
+    const Layer layer = nextLayer++;
+    layers[layer] = LayerState{item, std::make_shared<const Content>(std::move(content)),
+                               std::make_shared<std::atomic<bool>>(false)};
+    return layer;
+}
+
+void TileRenderer::removeLayer(const Layer layer) {
+    const auto found = layers.find(layer);
+    if (found == layers.end()) {
+        return;
+    }
+    *found->second.removed = true;
+    layers.erase(found);
+    cache.erase_layer(layer);
+    for (auto i = queue.begin(); i != queue.end();) {
+        if (i->layer == layer) {
+            requested.erase(*i);
+            i = queue.erase(i);
+        } else {
+            ++i;
+        }
+    }
+    // tiles started are dropped in finishTile, as their layer is gone
+}
+
+bool TileRenderer::paint(const Layer layer, QPainter *painter, const QRectF &exposed, const QWidget *widget) {
+    const QWidget *target = shown;
+    if (target == nullptr || widget != target || painter->device() != target) {
+        return false; // a one-shot render, which a placeholder would spoil
+    }
+    const QTransform transform = painter->worldTransform();
+    if (transform.type() > QTransform::TxScale || transform.m11() <= 0 ||
+        std::fabs(transform.m11() - transform.m22()) > 1e-9 * transform.m11()) {
+        return false;
+    }
+    const auto found = layers.find(layer);
+    if (found == layers.end()) {
+        return false;
+    }
+    const QRectF area = exposed & found->second.item->boundingRect();
+    if (area.isEmpty()) {
+        return true;
+    }
+
+    keys.clear();
+    tiles_covering(layer, tile_level(transform.m11()), TileSize,
+                   Box{area.left(), area.top(), area.right(), area.bottom()}, keys);
+    painter->save();
+    painter->setRenderHint(QPainter::SmoothPixmapTransform);
+    for (const TileKey &key: keys) {
+        const QRectF target = to_rect(tile_box(key, TileSize));
+        if (const QImage *image = cache.find(key)) {
+            painter->drawImage(target, *image);
+        } else {
+            request(key);
+            paintPlaceholder(painter, key, target);
+        }
+    }
+    painter->restore();
+    schedule();
+    return true;
+}
+
+void TileRenderer::paintPlaceholder(QPainter *painter, const TileKey &key, const QRectF &target) {
+    for (int up = 1; up <= StandInLevels; ++up) {
+        const TileKey parent = tile_parent(key, up);
+        if (const QImage *image = cache.find(parent)) {
+            // the part of the parent over this tile, scaled up
+            const int span = 1 << up;
+            const qreal part = static_cast<qreal>(TileSize / span);
+            const QRectF source((key.column - parent.column * span) * part, (key.row - parent.row * span) * part, part,
+                                part);
+            painter->drawImage(target, *image, source);
+            return;
+        }
+    }
+    painter->fillRect(target, QColor(0, 0, 0, 16));
+}
+
+void TileRenderer::request(const TileKey &key) {
+    if (!requested.insert(key).second) {
+        return;
+    }
+    queue.push_front(key);
+    while (queue.size() > MaxQueued) {
+        requested.erase(queue.back());
+        queue.pop_back();
+    }
+}
+
+void TileRenderer::schedule() {
+    while (running < pool.maxThreadCount() && !queue.empty()) {
+        const TileKey key = queue.front();
+        queue.pop_front();
+        const auto found = layers.find(key.layer);
+        if (found == layers.end()) {
+            requested.erase(key);
+            continue;
+        }
+        ++running;
+        pool.start(new TileTask(sink, key, found->second.content, found->second.removed));
+    }
+}
+
+void TileRenderer::finishTile(const quint64 layer, const int level, const int column, const int row,
+                              const QImage image) {
+    --running;
+    const TileKey key{layer, level, column, row};
+    requested.erase(key);
+    const auto found = layers.find(layer);
+    if (found != layers.end()) {
+        cache.insert(key, image, static_cast<std::size_t>(image.bytesPerLine()) * image.height());
+        found->second.item->update(to_rect(tile_box(key, TileSize)));
+    }
+    schedule();
+}
+
+void TileRenderer::waitForIdle() {
+    while (!requested.empty()) {
+        schedule();
+        pool.waitForDone();
+        QCoreApplication::processEvents();
+    }
+}
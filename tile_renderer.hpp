@@ -0,0 +1,133 @@
+#ifndef TILE_RENDERER_HPP
+#define TILE_RENDERER_HPP
+
+#include <QImage>
+#include <QObject>
+#include <QPointer>
+#include <QRectF>
+#include <QThreadPool>
+#include <QWidget>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "tile_cache.hpp"
+
+class QGraphicsItem;
+class QPainter;
+struct TileSink;
+
+// Paints scene items from tiles rasterized off the GUI thread. Each layer
+// (an item) is cut into squares of TileSize pixels per zoom level, see
+// tile_level; a pool of worker threads paints missing tiles into QImages,
+// and an LRU cache keeps them within a memory budget. Panning then costs
+// a blit per tile shown, and a tile still in flight shows the cached
+// tile of a coarser level scaled up, or a placeholder, until it arrives
+// and its item is updated. Only the viewport of the view the layers are
+// shown in is painted from tiles, as it is painted again when they
+// arrive; one-shot renders (QGraphicsScene::render, printing) paint
+// their items directly.
+//
+// Layers paint through a Content function called on worker threads: it
+// may only read data no one changes while the layer exists. A tile
+// already being painted when its layer is removed still holds the
+// Content and may still call it, so the Content must own or share what it
+// reads rather than point into its item.
+class TileRenderer : public QObject {
+    Q_OBJECT
+
+public:
+    typedef std::uint64_t Layer;
+
+    // Paint the part of a layer within 'area', in item coordinates
+    typedef std::function<void(QPainter *painter, const QRectF &area)> Content;
+
+    static const int TileSize = 256;
+
+    explicit TileRenderer(QObject *parent = nullptr);
+
+    // Detaches the workers, then waits for the tiles being painted; the
+    // ones finishing from then on are dropped
+    ~TileRenderer() override;
+
+    // Bytes of tiles to cache; 64 MiB, 256 tiles, by default
+    void setBudget(std::size_t bytes) { cache.set_budget(bytes); }
+    std::size_t budget() const noexcept { return cache.budget(); }
+    std::size_t cachedBytes() const noexcept { return cache.bytes(); }
+
+    // The view's viewport, the one widget painted from tiles; none by
+    // default, so nothing is
+    void setViewport(QWidget *widget) { shown = widget; }
+    QWidget *viewport() const { return shown; }
+
+    // Worker threads; the ideal thread count by default
+    void setThreads(int threads) { pool.setMaxThreadCount(threads); }
+    int threads() const { return pool.maxThreadCount(); }
+
+    // Add a layer painted by 'content', repainting 'item' as its tiles
+    // arrive
+    Layer addLayer(QGraphicsItem *item, Content content);
+
+    // Drop a layer's tiles and the ones still in flight: queued ones at
+    // once, ones not yet started by a worker skip painting, and ones being
+    // painted are dropped as they arrive
+    void removeLayer(Layer layer);
+
+    // Paint 'layer' over 'exposed' with 'painter', from the tiles at its
+    // scale, and request the missing ones; 'widget' is the one
+    // QGraphicsItem::paint was given. False, painting nothing, if the
+    // painter is not painting the viewport, or rotates, shears or scales
+    // unevenly: then the caller paints directly.
+    bool paint(Layer layer, QPainter *painter, const QRectF &exposed, const QWidget *widget);
+
+    // Tiles queued or being painted
+    std::size_t pending() const noexcept { return requested.size(); }
+
+    // Process events until no tile is pending, for tests and benchmarks
+    void waitForIdle();
+
+signals:
+    // From a worker thread, delivered on the renderer's thread
+    void tileRendered(quint64 layer, int level, int column, int row, QImage image);
+
+private slots:
+    void finishTile(quint64 layer, int level, int column, int row, QImage image);
+
+private:
+    struct LayerState {
+        QGraphicsItem *item;
+        std::shared_ptr<const Content> content;
+        std::shared_ptr<std::atomic<bool>> removed; // read by its workers
+    };
+
+    // Queue 'key' for painting, ahead of older requests
+    void request(const TileKey &key);
+
+    // Start queued tiles while workers are free
+    void schedule();
+
+    // Paint something in place of 'key' while it is in flight
+    void paintPlaceholder(QPainter *painter, const TileKey &key, const QRectF &target);
+
+    QPointer<QWidget> shown; // see setViewport
+    QThreadPool pool;
+    std::shared_ptr<TileSink> sink; // what workers hand tiles to
+    TileCache<QImage> cache;
+    std::unordered_map<Layer, LayerState> layers;
+    Layer nextLayer = 1;
+
+    std::deque<TileKey> queue; // newest first
+    std::unordered_set<TileKey, TileKeyHash> requested; // queued or being painted
+    int running = 0;
+
+    std::vector<TileKey> keys; // scratch for paint
+};
+
+#endif
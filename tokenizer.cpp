@@ -51,3 +51,91 @@ TokenSequenceType tokenize(std::istream &seq) {
     store_ifnot_empty(cur, tokens);
     return tokens;
 }
+
+// Character classes for the buffer tokenizer
+enum CharClass : unsigned char { AtomChar, SpaceChar, OpenChar, CloseChar, CommentChar };
+
+struct CharClassTable {
+    CharClass cls[256];
+
+    // built from std::isspace so both tokenizers split on the same bytes
+    CharClassTable() {
+        for (int c = 0; c < 256; ++c) {
+            cls[c] = std::isspace(c) != 0 ? SpaceChar : AtomChar;
+        }
+        cls[static_cast<unsigned char>('(')] = OpenChar;
+        cls[static_cast<unsigned char>(')')] = CloseChar;
+        cls[static_cast<unsigned char>(';')] = CommentChar;
+    }
+};
+
+static const CharClassTable &char_classes() {
+    static const CharClassTable table;
+    return table;
+}
+
+bool next_token(const char *data, const std::size_t size, std::size_t &pos, Token &token) {
+    const CharClass *cls = char_classes().cls;
+
+    std::size_t i = pos;
+    while (i < size) {
+        switch (cls[static_cast<unsigned char>(data[i])]) {
+            case SpaceChar:
+                ++i;
+                break;
+
+            case CommentChar:
+                // ';' to end of line (consume newline, too)
+                while (i < size && data[i] != '\n') {
+                    ++i;
+                }
+                ++i;
+                break;
+
+            case OpenChar:
+                token = Token{i, 1, OpenToken};
+                pos = i + 1;
+                return true;
+
+            case CloseChar:
+                token = Token{i, 1, CloseToken};
+                pos = i + 1;
+                return true;
+
+            case AtomChar: {
+                const std::size_t begin = i;
+                while (i < size && cls[static_cast<unsigned char>(data[i])] == AtomChar) {
+                    ++i;
+                }
+                token = Token{begin, static_cast<std::uint32_t>(i - begin), AtomToken};
+                pos = i;
+                return true;
+            }
+        }
+    }
+    pos = size;
+    return false;
+}
+
+// Bytes tokenized before reserving for the rest of a buffer
+static const std::size_t SampleBytes = std::size_t(64) << 10;
+
+void tokenize(const char *data, const std::size_t size, TokenBuffer &tokens) {
+    tokens.clear();
+
+    // reserve for the rest at the token density of the first SampleBytes,
+    // with an eighth to spare, rather than for the densest possible source;
+    // a denser rest still grows geometrically
+    std::size_t pos = 0;
+    Token token;
+    while (pos < SampleBytes && next_token(data, size, pos, token)) {
+        tokens.push_back(token);
+    }
+    if (pos < size) {
+        const std::size_t rest = tokens.size() * (size - pos) / pos;
+        tokens.reserve(tokens.size() + rest + rest / 8);
+    }
+    while (next_token(data, size, pos, token)) {
+        tokens.push_back(token);
+    }
+}
@@ -1,8 +1,11 @@
 #ifndef TOKENIZER_H
 #define TOKENIZER_H
 
+#include <cstddef>
+#include <cstdint>
 #include <deque>
 #include <string>
+#include <vector>
 
 typedef std::deque<std::string> TokenSequenceType;
 
@@ -11,4 +14,68 @@ typedef std::deque<std::string> TokenSequenceType;
 // ignores any whitespace and from any ";" to end-of-line
 TokenSequenceType tokenize(std::istream &seq);
 
+enum TokenKind { OpenToken, CloseToken, AtomToken };
+
+// A token located in a contiguous source buffer. It does not own its text:
+// the characters are data[offset, offset + length) of the tokenized buffer.
+struct Token {
+    std::size_t offset;
+    std::uint32_t length;
+    TokenKind kind;
+};
+
+typedef std::vector<Token> TokenBuffer;
+
+// Same token rules as tokenize(std::istream&), over the buffer
+// data[0, size) without copying any token text. Replaces the contents of
+// 'tokens', reusing its capacity.
+void tokenize(const char *data, std::size_t size, TokenBuffer &tokens);
+
+inline TokenBuffer tokenize(const char *data, std::size_t size) {
+    TokenBuffer tokens;
+    tokenize(data, size, tokens);
+    return tokens;
+}
+
+// Pull the next token from data[pos, size) into 'token' and advance 'pos'
+// past it. Return false when only whitespace and comments remain.
+bool next_token(const char *data, std::size_t size, std::size_t &pos, Token &token);
+
+inline TokenBuffer tokenize(const std::string &text) {
+    return tokenize(text.data(), text.size());
+}
+
+inline std::string token_text(const char *data, const Token &token) {
+    return std::string(data + token.offset, token.length);
+}
+
+// One-token lookahead over a buffer, for parsers that consume tokens as
+// they are scanned instead of materializing a TokenBuffer first.
+class TokenStream {
+public:
+    TokenStream(const char *data, std::size_t size) : data(data), size(size), pos(0) {
+        more = next_token(data, size, pos, current);
+    }
+
+    bool atEnd() const noexcept { return !more; }
+
+    // Current token; only valid when !atEnd()
+    const Token &peek() const noexcept { return current; }
+
+    void advance() { more = next_token(data, size, pos, current); }
+
+    // Offset of the current token, or the buffer size at end of input
+    std::size_t offset() const noexcept { return more ? current.offset : size; }
+
+    // Copy the current token's text into 'text', reusing its capacity
+    void text(std::string &text) const { text.assign(data + current.offset, current.length); }
+
+private:
+    const char *data;
+    std::size_t size;
+    std::size_t pos;
+    Token current;
+    bool more;
+};
+
 #endif
@@ -2,6 +2,11 @@
 #define CATCH_CONFIG_COLOUR_NONE
 #include "catch.hpp"
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <random>
 #include <string>
 #include <sstream>
 
@@ -10,6 +15,13 @@
 #include "interpreter.hpp"
 #include "expression.hpp"
 #include "environment.hpp"
+#include "geometry_batch.hpp"
+#include "geometry_transform.hpp"
+#include "level_of_detail.hpp"
+#include "mapped_file.hpp"
+#include "spatial_index.hpp"
+#include "tile_cache.hpp"
+#include "tokenizer.hpp"
 #include "test_config.hpp"
 
 // This is example unit test case with Catch 2
@@ -25,3 +37,1268 @@ TEST_CASE("evaluating add", "[interpreter]") {
 }
 
 // TODO: add more unit test cases to fully cover your code.
+
+TEST_CASE("Atom is a compact tagged union", "[expression]") {
+    REQUIRE(sizeof(Value) == sizeof(FillRect));
+
+    Atom a, b;
+    REQUIRE(token_to_atom("var", a));
+    REQUIRE(token_to_atom(std::string("v") + "ar", b));
+    REQUIRE(a.value.sym_value == b.value.sym_value);
+    REQUIRE(a.value.sym_value.str() == "var");
+
+    Expression sym(std::string("var"));
+    Expression copy = sym;
+    REQUIRE(copy == Expression(a));
+    REQUIRE(!(copy == Expression(std::string("other"))));
+
+    std::ostringstream out;
+    out << copy;
+    REQUIRE(out.str() == "(var)");
+}
+
+TEST_CASE("symbols are interned to integer ids", "[expression]") {
+    REQUIRE(SymbolRef("define").id() == SymDefine);
+    REQUIRE(SymbolRef("fill_rect").id() == SymFillRect);
+    REQUIRE(SymbolRef(SymPi).str() == "pi");
+
+    const SymbolRef a(std::string("user_symbol")), b(std::string("user_") + "symbol");
+    REQUIRE(a == b);
+    REQUIRE(a.id() >= BuiltinSymbolCount);
+
+    std::string program = "((x 2 define) (x x *) begin)";
+    std::istringstream iss(program);
+    Interpreter interpreter;
+    REQUIRE(interpreter.parse(iss));
+    REQUIRE(interpreter.eval() == Expression(4.));
+}
+
+// token_to_atom as it was before the numeric fast path: every token went
+// through a stream
+static bool reference_token_to_atom(const std::string &token, Atom &atom) {
+    if (token == "True" || token == "False") {
+        atom.type = BooleanType;
+        atom.value.bool_value = token == "True";
+        return true;
+    }
+    std::istringstream iss(token);
+    iss.setf(std::ios::fmtflags(0), std::ios::basefield);
+    double temp;
+    if ((iss >> temp) && iss.rdbuf()->in_avail() == 0) {
+        atom.type = NumberType;
+        atom.value.num_value = temp;
+        return true;
+    }
+    if (!token.empty() && std::isdigit(static_cast<unsigned char>(token[0])) == 0) {
+        atom.type = SymbolType;
+        atom.value.sym_value = token;
+        return true;
+    }
+    return false;
+}
+
+static void require_same_atom(const std::string &token) {
+    INFO("token: \"" << token << "\"");
+    Atom expected, actual;
+    const bool accepted = reference_token_to_atom(token, expected);
+    REQUIRE(token_to_atom(token, actual) == accepted);
+    if (!accepted) {
+        return;
+    }
+    REQUIRE(actual.type == expected.type);
+    if (expected.type == NumberType) {
+        // bit for bit, so -0 and the last rounding step count
+        REQUIRE(std::memcmp(&actual.value.num_value, &expected.value.num_value, sizeof(double)) == 0);
+    } else if (expected.type == SymbolType) {
+        REQUIRE(actual.value.sym_value == expected.value.sym_value);
+    }
+}
+
+TEST_CASE("numeric literals parse as the stream parser did", "[expression]") {
+    const char *tokens[] = {
+        "0", "-0", "+0", "00012", "1", "-1", "+1", "1.", ".5", "-.5", "+.5", "5.e3", "1e5", "1E5", "1e+5",
+        "1e-5", "-1.5e-3", "0.1", "0.3", "123456789012345", "1234567890123456789", "12345678901234567890123",
+        "9007199254740993", "1e22", "1e23", "4.9e-324", "2e-324", "1e-400", "1e400", "-1e400", "1.7976931348623157e308",
+        "1.7976931348623159e308", "0e99999999999", "1e0000000000000000005", "0.000000000000000000000000000001",
+        "-", "+", ".", "-.", "+-1", "--1", "1-", "1e", "1e+", "1e-", "e5", ".e5", "1.2.3", "1e5.3", "1e5e3", "0x10",
+        "1,5", "inf", "-inf", "nan", "infinity", " 5", "\t-2", "5 ", "- 5", "1f", "1.5x", "point", "pi", "x1", "True",
+    };
+    for (const char *token: tokens) {
+        require_same_atom(token);
+    }
+
+    // fuzzed: short strings over the characters of the number grammar
+    std::mt19937 random(20240917);
+    const std::string alphabet = "0123456789+-.eE \tx";
+    std::uniform_int_distribution<std::size_t> length(1, 10), pick(0, alphabet.size() - 1);
+    for (int i = 0; i < 200000; ++i) {
+        std::string token(length(random), ' ');
+        for (auto &c: token) {
+            c = alphabet[pick(random)];
+        }
+        require_same_atom(token);
+    }
+
+    // fuzzed: printed doubles of every magnitude and precision
+    std::uniform_real_distribution<double> fraction(-10, 10);
+    std::uniform_int_distribution<int> magnitude(-330, 330), precision(1, 20);
+    for (int i = 0; i < 100000; ++i) {
+        std::ostringstream out;
+        out.precision(precision(random));
+        if (i % 3 == 1) {
+            out << std::scientific;
+        } else if (i % 3 == 2) {
+            out << std::fixed;
+            out.precision(precision(random) % 8);
+        }
+        out << fraction(random) * std::pow(10.0, magnitude(random) % (i % 3 == 2 ? 25 : 330));
+        require_same_atom(out.str());
+    }
+}
+
+// The buffer tokenizer must split exactly like the stream tokenizer
+static void require_same_tokens(const std::string &text) {
+    std::istringstream iss(text);
+    const TokenSequenceType expected = tokenize(iss);
+    const TokenBuffer tokens = tokenize(text);
+
+    REQUIRE(tokens.size() == expected.size());
+    for (std::size_t i = 0; i < tokens.size(); ++i) {
+        const std::string token = token_text(text.data(), tokens[i]);
+        REQUIRE(token == expected[i]);
+        const TokenKind kind = token == "(" ? OpenToken : token == ")" ? CloseToken : AtomToken;
+        REQUIRE(tokens[i].kind == kind);
+    }
+}
+
+TEST_CASE("buffer tokenizer matches stream tokenizer", "[tokenize]") {
+    require_same_tokens("");
+    require_same_tokens("(f");
+    require_same_tokens("((a 1 define)(a 2 +)begin)");
+    require_same_tokens("; only a comment");
+    require_same_tokens("(1 ; comment\r\n 2 +);trailing");
+    require_same_tokens("\t(x\ty\fpoint)\v\r\n");
+
+    const char *files[] = {"test2.slp", "test_airplane.slp", "test_car.slp", "test_crlf.slp"};
+    for (const char *name: files) {
+        const MappedFile file(TEST_FILE_DIR + "/" + name);
+        REQUIRE(file.good());
+        require_same_tokens(std::string(file.data(), file.size()));
+    }
+    REQUIRE(!MappedFile(TEST_FILE_DIR + "/missing.slp").good());
+
+    // past the sampled prefix, capacity follows the source's token density
+    std::string large;
+    while (large.size() < (std::size_t(1) << 20)) {
+        large += "((123456 789012 point) (-0.125 1e3 point) line) ";
+    }
+    require_same_tokens(large);
+    const TokenBuffer tokens = tokenize(large);
+    REQUIRE(tokens.capacity() <= tokens.size() + tokens.size() / 4);
+}
+
+static std::size_t parse_error_offset(const std::string &program) {
+    Interpreter interpreter;
+    REQUIRE(!interpreter.parse(program.data(), program.size()));
+    return interpreter.parseErrorOffset();
+}
+
+TEST_CASE("parser reports the offset of the first syntax error", "[interpreter]") {
+    REQUIRE(parse_error_offset("") == 0);
+    REQUIRE(parse_error_offset("  ; comment") == 11);
+    REQUIRE(parse_error_offset("((1 2 +) 3") == 10);    // missing ')'
+    REQUIRE(parse_error_offset("((1 2 +) 3 -))") == 13); // stray ')'
+    REQUIRE(parse_error_offset("(1 ())") == 3);         // empty list
+    REQUIRE(parse_error_offset("(1 2 3)") == 5);        // operator not a symbol
+    REQUIRE(parse_error_offset("(1 2 +) (3)") == 8);    // second expression
+    REQUIRE(parse_error_offset("(1 2abc +)") == 3);     // bad token
+
+    Interpreter interpreter;
+    std::istringstream iss("((1 2 +) (3 4 +) *)");
+    REQUIRE(interpreter.parse(iss));
+    REQUIRE(interpreter.eval() == Expression(21.));
+}
+
+// 'depth' nested lists: ((((1 op) op) op) ... op)
+static std::string nested_program(std::size_t depth, const std::string &op) {
+    std::string program(depth, '(');
+    program += "1";
+    for (std::size_t i = 0; i < depth; ++i) {
+        program += " " + op + ")";
+    }
+    return program;
+}
+
+TEST_CASE("parse and eval survive nesting 1,000,000 deep", "[interpreter]") {
+    const std::size_t depth = 1000000;
+
+    Interpreter interpreter;
+    const std::string negations = nested_program(depth, "-");
+    REQUIRE(interpreter.parse(negations.data(), negations.size()));
+    REQUIRE(interpreter.eval() == Expression(1.));
+
+    const std::string begins = nested_program(depth, "begin");
+    REQUIRE(interpreter.parse(begins.data(), begins.size()));
+    REQUIRE(interpreter.eval() == Expression(1.));
+
+    // (True (True ... 1 ... 0 if) 0 if)
+    std::string ifs;
+    for (std::size_t i = 0; i < depth; ++i) {
+        ifs += "(True ";
+    }
+    ifs += "1";
+    for (std::size_t i = 0; i < depth; ++i) {
+        ifs += " 0 if)";
+    }
+    REQUIRE(interpreter.parse(ifs.data(), ifs.size()));
+    REQUIRE(interpreter.eval() == Expression(1.));
+}
+
+TEST_CASE("nesting past the depth limit is an error", "[interpreter]") {
+    Interpreter interpreter;
+    interpreter.setMaxDepth(100);
+
+    const std::string deep = nested_program(101, "-");
+    REQUIRE(!interpreter.parse(deep.data(), deep.size()));
+    REQUIRE(interpreter.parseErrorOffset() == 100);
+
+    interpreter.setMaxDepth(1000);
+    REQUIRE(interpreter.parse(deep.data(), deep.size()));
+    interpreter.setMaxDepth(100);
+    REQUIRE_THROWS_AS(interpreter.eval(), InterpreterSemanticError);
+
+    interpreter.setMaxDepth(101);
+    REQUIRE(interpreter.eval() == Expression(-1.));
+}
+
+// Outcome of running 'program' with one evaluator: the result or the
+// error message, followed by every pending draw
+static std::string run_with(EvalMode mode, const std::string &program, bool optimize = false) {
+    Interpreter interpreter;
+    interpreter.setEvalMode(mode);
+    interpreter.setOptimize(optimize);
+    std::ostringstream out;
+    if (!interpreter.parse(program.data(), program.size())) {
+        return "parse error";
+    }
+    try {
+        out << interpreter.eval();
+    } catch (const InterpreterSemanticError &e) {
+        out << "Error: " << e.what();
+    }
+    for (const auto &draw: interpreter.getPendingDraws()) {
+        out << " " << draw;
+    }
+    return out.str();
+}
+
+TEST_CASE("bytecode VM matches the tree-walking evaluator", "[interpreter]") {
+    const char *programs[] = {
+        "(1 2 +)", "(True)", "(pi)", "(x)", "(1 True +)", "(1 0 /)", "(1 2 3 -)",
+        "((a 1 define) (a 2 define) begin)", "((1 0 /) pi define)", "(pi (1 0 /) define)",
+        "((1 2 <) (3) (4) if)", "((1 2 >) (3) (4) if)", "(1 2 3 if)", "(1 2 if)",
+        "((x 1 define) (x (x 1 +) define) begin)", "(1 2 foo)", "((1 2 foo) (3 4 foo) True if)",
+        "(True (1 0 /) (1 2 +) if)", "((0 0 point) 1 (1 1 point) draw)",
+        "(((0 0 point) (1 1 point) line) (0 0 point) draw)",
+        "((1 1 point) (2 2 point) (3 3 point) draw)", "((1 2 foo) draw)",
+        "((r (0 0 point) (10 10 point) rect) ((r 1 2 3 fill_rect) (r ellipse) draw) begin)",
+        "(((0 0 point) (1 0 point) (pi 2 /) arc) draw)",
+    };
+    for (const char *program: programs) {
+        INFO(program);
+        REQUIRE(run_with(BytecodeEval, program) == run_with(TreeWalkEval, program));
+    }
+
+    const char *files[] = {
+        "test2.slp", "test3.slp", "test4.slp", "test5.slp", "test_airplane.slp", "test_arc.slp",
+        "test_arc_simple.slp", "test_badeval.slp", "test_car.slp", "test_crlf.slp", "test_line.slp",
+        "test_point.slp",
+    };
+    for (const char *name: files) {
+        INFO(name);
+        const MappedFile file(TEST_FILE_DIR + "/" + name);
+        const std::string program(file.data(), file.size());
+        REQUIRE(run_with(BytecodeEval, program) == run_with(TreeWalkEval, program));
+    }
+}
+
+TEST_CASE("environment resolves symbols to slots by id", "[environment]") {
+    Environment env;
+    REQUIRE(env.lookup_builtin(SymAdd) != nullptr);
+    REQUIRE(env.lookup_builtin(SymDefine) == nullptr);
+    REQUIRE(env.lookup(SymPi) != nullptr);
+    REQUIRE(env.is_reserved(SymDefine));
+
+    // a symbol interned after the environment was built
+    const SymbolRef late(std::string("slot_test_symbol"));
+    REQUIRE(env.lookup(late) == nullptr);
+    REQUIRE(!env.is_reserved(late));
+    env.define(late, Expression(2.));
+    REQUIRE(*env.lookup(late) == Expression(2.));
+    REQUIRE(&env.get_symbol(late) == env.lookup(late)); // no copy
+    REQUIRE(env.is_reserved(late));
+
+    env.reset();
+    REQUIRE(env.lookup(late) == nullptr);
+
+    for (EvalMode mode: {TreeWalkEval, BytecodeEval}) {
+        REQUIRE(run_with(mode, "((slot_a 1 define) (slot_a 2 define) begin)") ==
+                "Error: define: cannot redefine built-in symbol: slot_a");
+        REQUIRE(run_with(mode, "((slot_b 1 define) (slot_c (slot_b 1 +) define) (slot_b slot_c +) begin)") == "(3)");
+    }
+}
+
+TEST_CASE("environment rolls back to checkpoints", "[environment]") {
+    Environment env;
+    const SymbolRef a(std::string("rollback_a"));
+    const SymbolRef b(std::string("rollback_b"));
+
+    const Environment::Checkpoint start = env.checkpoint();
+    env.define(a, Expression(1.));
+    const Environment::Checkpoint good = env.checkpoint();
+    env.define(b, Expression(2.));
+    env.define(a, Expression(3.)); // rebinding is undone too
+
+    env.rollback(good);
+    REQUIRE(*env.lookup(a) == Expression(1.));
+    REQUIRE(env.lookup(b) == nullptr);
+    REQUIRE(!env.is_reserved(b));
+
+    env.rollback(start);
+    REQUIRE(env.lookup(a) == nullptr);
+    REQUIRE(env.lookup_builtin(SymAdd) != nullptr);
+
+    // a failed line in the REPL rolls back only its own definitions
+    Interpreter interp;
+    const std::string first = "(rollback_c 1 define)";
+    const std::string failing = "((rollback_d 2 define) (rollback_c True +) begin)";
+    const std::string retry = "((rollback_d 3 define) (rollback_c rollback_d +) begin)";
+    REQUIRE(interp.parse(first.data(), first.size()));
+    interp.eval();
+    const Interpreter::Checkpoint afterFirst = interp.checkpoint();
+    REQUIRE(interp.parse(failing.data(), failing.size()));
+    REQUIRE_THROWS_AS(interp.eval(), InterpreterSemanticError);
+    interp.rollback(afterFirst);
+    REQUIRE(interp.parse(retry.data(), retry.size()));
+    REQUIRE(interp.eval() == Expression(4.));
+
+    // ... and drops only its own draws
+    const std::string drawn = "((0 0 point) (1 1 point) draw)";
+    const std::string failingDraw = "(((2 2 point) draw) (rollback_c True +) begin)";
+    REQUIRE(interp.parse(drawn.data(), drawn.size()));
+    interp.eval();
+    const Interpreter::Checkpoint afterDraw = interp.checkpoint();
+    REQUIRE(interp.parse(failingDraw.data(), failingDraw.size()));
+    REQUIRE_THROWS_AS(interp.eval(), InterpreterSemanticError);
+    REQUIRE(interp.getDisplayList().size() == 3);
+    REQUIRE(interp.getPendingDraws().size() == 3);
+    interp.rollback(afterDraw);
+    REQUIRE(interp.getDisplayList().size() == 2);
+    REQUIRE(interp.getPendingDraws().size() == 2);
+    REQUIRE(interp.getDisplayList().points().size() == 2);
+
+    // committing a checkpoint keeps later rollbacks working
+    interp.commit(afterDraw);
+    const std::string failingDefine = "((rollback_e 2 define) (rollback_c True +) begin)";
+    const std::string useE = "(rollback_e 1 define)";
+    REQUIRE(interp.parse(failingDefine.data(), failingDefine.size()));
+    REQUIRE_THROWS_AS(interp.eval(), InterpreterSemanticError);
+    interp.rollback(afterDraw);
+    REQUIRE(interp.parse(useE.data(), useE.size()));
+    REQUIRE(interp.eval() == Expression(1.));
+}
+
+static std::string optimized_source(const std::string &program, FoldStats &stats) {
+    Interpreter interp;
+    REQUIRE(interp.parse(program.data(), program.size()));
+    stats = interp.optimize();
+    std::ostringstream out;
+    write_source(out, interp.getAst());
+    return out.str();
+}
+
+TEST_CASE("constant folding and dead-branch pruning", "[optimizer]") {
+    FoldStats stats;
+    REQUIRE(optimized_source("((2 pi *) (pi 2 /) (-6 2 /) begin)", stats) == "(6.28319 1.5708 -3 begin)");
+    REQUIRE(stats.folded == 3);
+
+    REQUIRE(optimized_source("((1 2 <) (x 1 define) (y 2 define) if)", stats) == "(x 1 define)");
+    REQUIRE(stats.pruned == 1);
+    REQUIRE(optimized_source("(((1 2 +) 3 ==) 1 (x sqrt) if)", stats) == "1");
+
+    // calls that fail, read user symbols or have effects are left alone
+    REQUIRE(optimized_source("((1 0 /) (1 True +) (x 1 +) ((1 1 point) draw) begin)", stats) ==
+            "((1 0 /) (1 True +) (x 1 +) ((1,1) draw) begin)");
+    REQUIRE(stats.folded == 1);
+    REQUIRE(optimized_source("(1 2 3 if)", stats) == "(1 2 3 if)");
+
+    const char *programs[] = {
+        "((1 0 /) 2 +)",
+        "((x (2 pi *) define) (x 1 define) begin)",
+        "((True False and) (1 (0 0 point) line) 3 if)",
+        "(((0 0 point) (1 1 point) line) ((1 2 <) (0 0 point) 5 if) draw)",
+        "((1 2 3 -) 1 +)",
+    };
+    for (const char *program: programs) {
+        INFO(program);
+        for (EvalMode mode: {TreeWalkEval, BytecodeEval}) {
+            REQUIRE(run_with(mode, program, true) == run_with(mode, program));
+        }
+    }
+
+    const char *files[] = {"test_airplane.slp", "test_arc.slp", "test_car.slp", "test_line.slp", "test_point.slp"};
+    for (const char *name: files) {
+        INFO(name);
+        const MappedFile file(TEST_FILE_DIR + "/" + name);
+        const std::string program(file.data(), file.size());
+        REQUIRE(run_with(TreeWalkEval, program, true) == run_with(TreeWalkEval, program));
+    }
+
+    // deep programs fold without recursion
+    REQUIRE(optimized_source(nested_program(100000, "+"), stats) == "1");
+    REQUIRE(stats.folded == 100000);
+}
+
+TEST_CASE("arena allocates aligned blocks and frees them at once", "[arena]") {
+    Arena arena(64);
+    const void *small = arena.allocate(3, 1);
+    const void *aligned = arena.allocate(sizeof(double), alignof(double));
+    REQUIRE(reinterpret_cast<std::size_t>(aligned) % alignof(double) == 0);
+    REQUIRE(aligned > small);
+    REQUIRE(arena.allocate(1000, 16) != nullptr); // larger than a chunk
+    REQUIRE(arena.bytes() == 3 + sizeof(double) + 1000);
+
+    const std::size_t capacity = arena.capacity();
+    arena.reset();
+    REQUIRE(arena.bytes() == 0);
+    REQUIRE(arena.capacity() < capacity); // only the largest chunk is kept
+    REQUIRE(arena.capacity() >= 1000);
+}
+
+TEST_CASE("AST tails live in a per-parse arena", "[interpreter]") {
+    Interpreter interp;
+    const std::string program = "(((1 2 +) (3 4 +) *) 5 -)";
+    REQUIRE(interp.parse(program.data(), program.size()));
+    const Expression &ast = interp.getAst();
+    REQUIRE(ast.getTail().get_allocator().arena() != nullptr);
+    REQUIRE(interp.astBytes() == 8 * sizeof(Expression));
+
+    // tails are laid out in the order their lists close
+    const Expression::Tail &product = ast.getTail()[0].getTail();
+    REQUIRE(product[0].getTail().data() < product[1].getTail().data());
+    REQUIRE(product[1].getTail().data() < product.data());
+    REQUIRE(product.data() < ast.getTail().data());
+
+    // a copy is on the heap and outlives the arena
+    const Expression copy = ast;
+    REQUIRE(copy.getTail().get_allocator().arena() == nullptr);
+    REQUIRE(copy.getTail()[0].getTail().get_allocator().arena() == nullptr);
+
+    // a failed parse leaves the AST alone
+    const std::string broken = "((1 2 +) (3 4 +)";
+    REQUIRE(!interp.parse(broken.data(), broken.size()));
+    REQUIRE(interp.getAst() == copy);
+    REQUIRE(interp.eval() == Expression(16.));
+
+    // reparsing releases the old tree and reuses its storage
+    for (int i = 0; i < 3; ++i) {
+        REQUIRE(interp.parse(program.data(), program.size()));
+        REQUIRE(interp.astBytes() == 8 * sizeof(Expression));
+        REQUIRE(interp.getAst() == copy);
+        REQUIRE(interp.eval() == Expression(16.));
+    }
+    const std::string atom = "7";
+    REQUIRE(interp.parse(atom.data(), atom.size()));
+    REQUIRE(interp.astBytes() == 0);
+    REQUIRE(copy.getTail()[0].getTail()[1].getTail()[1] == Expression(4.));
+}
+
+TEST_CASE("flat AST evaluates and prints like the tree", "[interpreter]") {
+    Interpreter interp;
+    const std::string program = "(((1 2 point) (x 4 point) line) (y True (1 -) if) draw)";
+    REQUIRE(interp.parse(program.data(), program.size()));
+    interp.flatten();
+    const FlatAst &flat = interp.getFlatAst();
+    REQUIRE(flat.size() == 13);
+    REQUIRE(flat.expression() == interp.getAst());
+
+    std::ostringstream tree, flattened;
+    write_source(tree, interp.getAst());
+    flattened << flat;
+    REQUIRE(flattened.str() == tree.str());
+    REQUIRE(flattened.str() == program);
+
+    // children are adjacent, right after their parent's siblings
+    REQUIRE(flat.first(FlatAst::Root) == 1);
+    REQUIRE(flat.count(FlatAst::Root) == 2);
+    REQUIRE(flat.kind(1) == SymbolType);
+    REQUIRE(flat.payload(1).sym_value == SymbolRef(SymLine));
+    REQUIRE(flat.first(1) == 3);
+    REQUIRE(flat.first(3) == 5);
+    REQUIRE(flat.kind(5) == NumberType);
+    REQUIRE(flat.payload(5).num_value == 1.);
+    // each symbol's payload is stored once
+    REQUIRE(&flat.payload(3) == &flat.payload(flat.first(1) + 1));
+
+    const char *programs[] = {
+        "(1 2 +)", "(True)", "(pi)", "(x)", "(1 True +)", "(1 0 /)", "(1 2 3 -)",
+        "((a 1 define) (a 2 define) begin)", "((1 0 /) pi define)", "(pi (1 0 /) define)",
+        "((1 2 <) (3) (4) if)", "(1 2 3 if)", "((x 1 define) (x (x 1 +) define) begin)",
+        "(1 2 foo)", "(True (1 0 /) (1 2 +) if)", "((0 0 point) 1 (1 1 point) draw)",
+        "((r (0 0 point) (10 10 point) rect) ((r 1 2 3 fill_rect) (r ellipse) draw) begin)",
+        "((1 2 +) (1 2 +) (True (1 2 +) 0 if) +)",
+    };
+    for (const char *text: programs) {
+        INFO(text);
+        REQUIRE(run_with(FlatEval, text) == run_with(TreeWalkEval, text));
+        REQUIRE(run_with(FlatEval, text, true) == run_with(TreeWalkEval, text));
+    }
+
+    const char *files[] = {"test2.slp", "test_airplane.slp", "test_arc.slp", "test_badeval.slp", "test_car.slp"};
+    for (const char *name: files) {
+        INFO(name);
+        const MappedFile file(TEST_FILE_DIR + "/" + name);
+        const std::string text(file.data(), file.size());
+        REQUIRE(run_with(FlatEval, text) == run_with(TreeWalkEval, text));
+    }
+
+    // deep programs flatten and evaluate without recursion, within maxDepth
+    const std::string deep = nested_program(1000000, "-");
+    interp.setEvalMode(FlatEval);
+    REQUIRE(interp.parse(deep.data(), deep.size()));
+    REQUIRE(interp.eval() == Expression(1.));
+    interp.setMaxDepth(100);
+    REQUIRE_THROWS_AS(interp.eval(), InterpreterSemanticError);
+}
+
+static Expression legacy_sum(const std::vector<Atom> &args) {
+    double sum = 0;
+    for (const auto &a: args) {
+        sum += a.value.num_value;
+    }
+    return Expression(sum);
+}
+
+TEST_CASE("batch builtins pack coordinates into one atom", "[interpreter]") {
+    Interpreter interpreter;
+    const std::string program = "((0 0 1 1 2 0 polyline) (0 0 1 0 0 1 polygon) (3 4 points) draw)";
+    REQUIRE(interpreter.parse(program.data(), program.size()));
+    interpreter.eval();
+
+    // three draws, however many vertices each carries
+    const auto &draws = interpreter.getPendingDraws();
+    REQUIRE(draws.size() == 3);
+    const Batch &path = draws[0].getHead().value.batch_value;
+    REQUIRE(draws[0].headType() == BatchType);
+    REQUIRE(path.kind == PolylineBatch);
+    REQUIRE(path.count == 3);
+    REQUIRE(path.xs[2] == 2.);
+    REQUIRE(path.ys[2] == 0.);
+    REQUIRE(draws[1].getHead().value.batch_value.kind == PolygonBatch);
+    REQUIRE(draws[2].getHead().value.batch_value.count == 1);
+
+    std::ostringstream out;
+    out << draws[0];
+    REQUIRE(out.str() == "(polyline (0,0) (1,1) (2,0))");
+
+    // equal by kind and vertices, not by where they are stored
+    const Batch again = BatchTable::global().add(PolylineBatch, nullptr, 0);
+    REQUIRE(Expression(path) == Expression(path));
+    REQUIRE(!(Expression(path) == Expression(again)));
+    REQUIRE(!(draws[0] == Expression(Batch{LinesBatch, path.count, path.xs, path.ys, path.storage})));
+
+    const char *programs[] = {
+        "(0 0 10 10 polyline)", "(0 0 1 1 2 2 3 3 lines)", "((0 0 5 0 5 5 polygon) draw)",
+        "((p (0 0 1 1 points) define) (p p draw) begin)", "((True (0 0 1 1 polyline) (0 0 1 1 lines) if) draw)",
+    };
+    for (const char *p: programs) {
+        INFO(p);
+        REQUIRE(run_with(BytecodeEval, p) == run_with(TreeWalkEval, p));
+        REQUIRE(run_with(FlatEval, p) == run_with(TreeWalkEval, p));
+        REQUIRE(run_with(TreeWalkEval, p, true) == run_with(TreeWalkEval, p));
+    }
+}
+
+TEST_CASE("batches belong to the interpreter that made them", "[interpreter]") {
+    DisplayList kept;
+    {
+        Interpreter interp;
+        const std::string drawn = "((0 0 1 1 polyline) draw)";
+        REQUIRE(interp.parse(drawn.data(), drawn.size()));
+        const Interpreter::Checkpoint start = interp.checkpoint();
+        interp.eval();
+        REQUIRE(interp.getBatches().size() == 1);
+
+        // a failed eval's batches go with its rollback
+        const std::string failing = "(((2 2 3 3 points) draw) (1 True +) begin)";
+        const std::string retry = "((4 4 points) draw)";
+        REQUIRE(interp.parse(failing.data(), failing.size()));
+        const Interpreter::Checkpoint good = interp.checkpoint();
+        REQUIRE_THROWS_AS(interp.eval(), InterpreterSemanticError);
+        REQUIRE(interp.getBatches().size() == 2);
+        interp.rollback(good);
+        REQUIRE(interp.getBatches().size() == 1);
+        REQUIRE(interp.getDisplayList().size() == 1);
+        REQUIRE(interp.parse(retry.data(), retry.size()));
+        interp.eval();
+        REQUIRE(interp.getBatches().vertices() == 3);
+
+        kept = interp.getDisplayList();
+        interp.rollback(start);
+        REQUIRE(interp.getDisplayList().empty());
+        REQUIRE(interp.getBatches().size() == 0);
+
+        // but for the constants folded into the AST, which it still needs
+        interp.setOptimize(true);
+        REQUIRE(interp.parse(drawn.data(), drawn.size()));
+        interp.rollback(start);
+        REQUIRE(interp.getBatches().size() == 1);
+        interp.eval();
+        REQUIRE(interp.getDisplayList().batches()[0].xs[1] == 1.);
+    }
+
+    // draws share their vertices, so they outlive the interpreter
+    REQUIRE(kept.batches().size() == 2);
+    REQUIRE(kept.batches()[0].xs[1] == 1.);
+    REQUIRE(kept.batches()[1].vertex(0).y == 4.);
+}
+
+TEST_CASE("unbound batches can be released between evals", "[interpreter]") {
+    Interpreter interp;
+    const std::string program =
+        "((kept (0 0 1 1 polyline) define) ((2 2 3 3 points) draw) (4 4 5 5 lines) kept draw)";
+    REQUIRE(interp.parse(program.data(), program.size()));
+    interp.eval();
+    REQUIRE(interp.getBatches().size() == 3);
+
+    const DisplayList drawn = interp.getDisplayList();
+    interp.clearPendingDraws();
+    interp.releaseUnboundBatches();
+    REQUIRE(interp.getBatches().size() == 1);
+    REQUIRE(interp.getBatches().vertices() == 2);
+
+    // the bound batch still evaluates, and the draws keep the released ones
+    const std::string redraw = "(kept draw)";
+    REQUIRE(interp.parse(redraw.data(), redraw.size()));
+    interp.eval();
+    REQUIRE(interp.getDisplayList().batches()[0].xs[1] == 1.);
+    REQUIRE(drawn.batches()[1].vertex(1).y == 3.);
+    interp.releaseUnboundBatches();
+    REQUIRE(interp.getBatches().size() == 1);
+}
+
+TEST_CASE("display list keeps draws per kind in draw order", "[interpreter]") {
+    const std::string program =
+        "((0 0 point) (1 1 point) ((0 0 point) (1 1 point) line) 5 (2 2 point) (0 0 1 1 polyline) True draw)";
+    for (const EvalMode mode: {TreeWalkEval, BytecodeEval, FlatEval}) {
+        Interpreter interpreter;
+        interpreter.setEvalMode(mode);
+        REQUIRE(interpreter.parse(program.data(), program.size()));
+        interpreter.eval();
+
+        // consecutive draws of one kind share a run; non-graphics are dropped
+        const DisplayList &list = interpreter.getDisplayList();
+        REQUIRE(list.size() == 5);
+        REQUIRE(list.points().size() == 3);
+        REQUIRE(list.lines().size() == 1);
+        REQUIRE(list.batches().size() == 1);
+        REQUIRE(list.runs().size() == 4);
+        REQUIRE(list.runs()[0].type == PointType);
+        REQUIRE(list.runs()[0].first == 0);
+        REQUIRE(list.runs()[0].count == 2);
+        REQUIRE(list.runs()[2].type == PointType);
+        REQUIRE(list.runs()[2].first == 2);
+        REQUIRE(list.points()[2].x == 2.);
+        REQUIRE(list.bytes() == 4 * sizeof(DisplayList::Run) + 3 * sizeof(Point) + sizeof(Line) + sizeof(Batch) +
+                               sizeof(std::shared_ptr<const BatchStorage>));
+
+        // the Expression view lists them in the same order
+        std::ostringstream out;
+        for (const auto &draw: interpreter.getPendingDraws()) {
+            out << draw << " ";
+        }
+        REQUIRE(out.str() == "(0,0) (1,1) ((0,0),(1,1)) (2,2) (polyline (0,0) (1,1)) ");
+        REQUIRE(&interpreter.getPendingDraws() == &interpreter.getPendingDraws()); // kept, not rebuilt
+
+        // truncating keeps the first draws, cutting a run short if need be
+        DisplayList kept = list;
+        kept.truncate(3);
+        REQUIRE(kept.size() == 3);
+        REQUIRE(kept.runs().size() == 2);
+        REQUIRE(kept.points().size() == 2);
+        REQUIRE(kept.lines().size() == 1);
+        REQUIRE(kept.batches().empty());
+        kept.truncate(1);
+        REQUIRE(kept.runs().size() == 1);
+        REQUIRE(kept.runs()[0].count == 1);
+        REQUIRE(kept.points().size() == 1);
+        REQUIRE(kept.lines().empty());
+
+        interpreter.clearPendingDraws();
+        REQUIRE(interpreter.getDisplayList().empty());
+        REQUIRE(interpreter.getPendingDraws().empty());
+    }
+}
+
+static bool same_box(const Box &a, const Box &b) {
+    const double eps = 1e-9;
+    return std::fabs(a.x0 - b.x0) < eps && std::fabs(a.y0 - b.y0) < eps && std::fabs(a.x1 - b.x1) < eps &&
+           std::fabs(a.y1 - b.y1) < eps;
+}
+
+TEST_CASE("partial arcs are bounded by their sweep", "[geometry]") {
+    const double pi = std::atan2(0, -1);
+    const Point center{0, 0}, east{100, 0};
+    // counterclockwise on screen, where y points down
+    REQUIRE(same_box(bounds_of(Arc{center, east, pi / 2}), Box{0, -100, 100, 0}));
+    REQUIRE(same_box(bounds_of(Arc{center, east, pi}), Box{-100, -100, 100, 0}));
+    REQUIRE(same_box(bounds_of(Arc{center, east, -pi / 2}), Box{0, 0, 100, 100}));
+    REQUIRE(same_box(bounds_of(Arc{center, east, 2 * pi}), Box{-100, -100, 100, 100}));
+    REQUIRE(same_box(bounds_of(Arc{Point{10, 10}, Point{10, 0}, pi / 4}), bounds_of(Line{
+        Point{10, 0}, Point{10 - 10 * std::sqrt(.5), 10 - 10 * std::sqrt(.5)}})));
+}
+
+TEST_CASE("spatial index finds what a linear scan finds", "[geometry]") {
+    // lines, arcs and fill rects scattered by a fixed linear congruential
+    // walk; a few fill rects reach the origin, too large to list per cell
+    DisplayList list;
+    std::uint32_t seed = 12345;
+    const auto next = [&seed]() {
+        seed = seed * 1664525u + 1013904223u;
+        return static_cast<double>(seed >> 8) / (1u << 24) * 1000;
+    };
+    for (int i = 0; i < 3000; ++i) {
+        const Point a{next(), next()};
+        const Point b{a.x + next() / 50, a.y + next() / 50};
+        Atom atom;
+        switch (i % 4) {
+            case 0:
+            case 1:
+                atom = Atom{LineType, Value()};
+                atom.value.line_value = Line{a, b};
+                break;
+            case 2:
+                atom = Atom{ArcType, Value()};
+                atom.value.arc_value = Arc{a, b, next() / 100};
+                break;
+            default:
+                atom = Atom{FillRectType, Value()};
+                atom.value.fill_rect_value = FillRect{Rect{a, i % 100 != 3 ? b : Point{0, 0}}, 1, 2, 3};
+        }
+        list.add(atom);
+    }
+    SpatialIndex index;
+    index.build(list, 0.5);
+    REQUIRE(index.size() == list.size());
+
+    std::vector<SpatialIndex::Draw> found;
+    for (int q = 0; q < 200; ++q) {
+        const double x = next(), y = next(), size = q % 10 == 0 ? 2000 : next() / 10;
+        const Box area{x - size, y - size, x + size, y + size};
+        index.query(area, found);
+        std::vector<SpatialIndex::Draw> expected;
+        for (SpatialIndex::Draw d = 0; d < index.size(); ++d) {
+            if (index.bounds(d).intersects(area)) {
+                expected.push_back(d);
+            }
+        }
+        REQUIRE(found == expected);
+    }
+
+    // atoms come back in draw order from the per-kind arrays
+    const std::vector<Expression> draws = list.expressions();
+    for (SpatialIndex::Draw d = 0; d < index.size(); d += 7) {
+        REQUIRE(Expression(index.atom(d)) == draws[d]);
+    }
+}
+
+TEST_CASE("hit tests pick primitives under a point", "[geometry]") {
+    Interpreter interpreter;
+    const std::string program =
+        "(((0 0 point) (100 0 point) line) ((0 0 point) (50 0 point) pi arc) "
+        "(((200 200 point) (300 250 point) rect) 1 2 3 fill_rect) "
+        "(((200 0 point) (240 60 point) rect) ellipse) (0 100 50 150 100 100 polygon) draw)";
+    REQUIRE(interpreter.parse(program.data(), program.size()));
+    interpreter.eval();
+    SpatialIndex index;
+    index.build(interpreter.getDisplayList());
+
+    const auto hit = [&index](double x, double y) {
+        std::vector<SpatialIndex::Draw> draws;
+        index.hit_test(Point{x, y}, 1, draws);
+        return draws;
+    };
+    typedef std::vector<SpatialIndex::Draw> Draws;
+    REQUIRE(hit(75, 0.5) == Draws{0});
+    REQUIRE((hit(50, 0) == Draws{0, 1})); // on both, topmost last
+    REQUIRE(hit(0, -50) == Draws{1}); // top of the half circle
+    REQUIRE(hit(0, 50) == Draws{}); // its undrawn half
+    REQUIRE(hit(10, -10) == Draws{}); // inside the arc, off its stroke
+    REQUIRE(hit(250, 225) == Draws{2});
+    REQUIRE(hit(220, 30) == Draws{3});
+    REQUIRE(hit(201, 1) == Draws{}); // corner of the ellipse's rect
+    REQUIRE(hit(50, 120) == Draws{4});
+    REQUIRE(hit(50, 160) == Draws{});
+}
+
+TEST_CASE("draws that overflowed stay out of the grid", "[geometry]") {
+    Interpreter interpreter;
+    const std::string program =
+        "((0 0 point) ((0 0 point) ((1e308 10 *) 10 point) line) (((1e308 10 *) (1e308 10 *) -) 5 point) "
+        "((5 5 point) (10 10 point) line) (-1e308 0 1e308 1 lines) draw)";
+    REQUIRE(interpreter.parse(program.data(), program.size()));
+    interpreter.eval();
+    SpatialIndex index;
+    index.build(interpreter.getDisplayList());
+    REQUIRE(index.size() == 5);
+    REQUIRE(!index.bounds(1).finite());
+    REQUIRE(!index.bounds(2).finite());
+    REQUIRE(index.bounds().finite());
+    REQUIRE(index.bounds().x1 == 1e308);
+
+    // the line to infinity is still found by its bounds, the NaN point never
+    typedef std::vector<SpatialIndex::Draw> Draws;
+    Draws found;
+    index.query(Box{4, 4, 6, 6}, found);
+    REQUIRE((found == Draws{1, 3}));
+    index.query(Box{100, 9, 101, 11}, found);
+    REQUIRE(found == Draws{1});
+    index.query(Box{-1e308, -1, 1e308, 11}, found);
+    REQUIRE((found == Draws{0, 1, 3, 4}));
+
+    DensityPyramid pyramid;
+    pyramid.build(interpreter.getDisplayList(), index);
+    REQUIRE(pyramid.levels() >= 1);
+    pyramid.large_draws(0, Box{-1, -1, 1e3, 11}, found);
+    REQUIRE(std::find(found.begin(), found.end(), 1) != found.end());
+}
+
+TEST_CASE("arcs tessellate within a tolerance of their circle", "[geometry]") {
+    const double pi = std::atan2(0, -1);
+    for (const double r: {0.1, 3., 100., 1e4, 1e7}) {
+        std::size_t last = 0;
+        for (const double angle: {0.25, pi / 2, -pi, 2 * pi}) {
+            const std::size_t segments = arc_segments(r, angle);
+            REQUIRE(segments >= 1);
+            REQUIRE(segments <= 1024);
+            REQUIRE(segments >= last); // more sweep, no fewer segments
+            last = segments;
+
+            std::vector<Point> vertices;
+            const Arc arc{Point{5, 7}, Point{5 + r, 7}, angle};
+            tessellate_arc(arc, segments, vertices);
+            REQUIRE(vertices.size() == segments + 1);
+            REQUIRE(vertices.front().x == arc.start.x);
+            for (std::size_t i = 0; i < segments; ++i) {
+                const Point a = vertices[i], b = vertices[i + 1];
+                REQUIRE(std::fabs(std::hypot(b.x - 5, b.y - 7) - r) <= 1e-9 * r);
+                const double sag = r - std::hypot((a.x + b.x) / 2 - 5, (a.y + b.y) / 2 - 7);
+                REQUIRE((segments == 1024 || sag <= 0.25 + 1e-9 * r));
+            }
+            // the sweep ends where bounds_of says it does
+            const Box box = bounds_of(arc);
+            REQUIRE(box.inflated(1e-6 * r).contains(vertices.back()));
+        }
+    }
+    REQUIRE(arc_segments(0.01, 2 * pi) <= 2); // a far zoomed out circle
+    REQUIRE(arc_segments(1000, 2 * pi) < arc_segments(4000, 2 * pi));
+}
+
+TEST_CASE("decimated paths keep every vertex within a tolerance", "[geometry]") {
+    std::uint32_t seed = 7;
+    const auto next = [&seed]() {
+        seed = seed * 1664525u + 1013904223u;
+        return static_cast<double>(seed >> 8) / (1u << 24) - 0.5;
+    };
+    std::vector<double> xs(10000), ys(10000);
+    for (std::size_t i = 1; i < xs.size(); ++i) {
+        xs[i] = xs[i - 1] + next();
+        ys[i] = ys[i - 1] + next();
+    }
+    std::vector<Point> kept;
+    decimate(xs.data(), ys.data(), static_cast<std::uint32_t>(xs.size()), 1, kept);
+    REQUIRE(kept.size() < xs.size() / 2);
+    REQUIRE(kept.back().x == xs.back());
+
+    // kept vertices in order, and each dropped one near the last kept
+    std::size_t k = 0;
+    for (std::size_t i = 0; i < xs.size(); ++i) {
+        if (k + 1 < kept.size() && kept[k + 1].x == xs[i] && kept[k + 1].y == ys[i]) {
+            ++k;
+        }
+        REQUIRE(std::hypot(xs[i] - kept[k].x, ys[i] - kept[k].y) <= 1);
+    }
+    REQUIRE(k + 1 == kept.size());
+
+    std::vector<Point> one;
+    decimate(xs.data(), ys.data(), 1, 1, one);
+    REQUIRE(one.size() == 1);
+}
+
+TEST_CASE("density pyramid keeps every draw's ink at every level", "[geometry]") {
+    DisplayList list;
+    std::uint32_t seed = 99;
+    const auto next = [&seed]() {
+        seed = seed * 1664525u + 1013904223u;
+        return static_cast<double>(seed >> 8) / (1u << 24) * 1000;
+    };
+    double length = 0, area = 0;
+    for (int i = 0; i < 5000; ++i) {
+        const Point a{next(), next()};
+        const double size = i % 50 == 0 ? 300 : 2;
+        const Point b{a.x + next() / 1000 * size, a.y + next() / 1000 * size};
+        Atom atom{LineType, Value()};
+        if (i % 5 == 0) {
+            atom = Atom{FillRectType, Value()};
+            atom.value.fill_rect_value = FillRect{Rect{a, b}, 255, 0, 0};
+            area += (b.x - a.x) * (b.y - a.y);
+        } else {
+            atom.value.line_value = Line{a, b};
+            length += std::hypot(b.x - a.x, b.y - a.y);
+        }
+        list.add(atom);
+    }
+    SpatialIndex index;
+    index.build(list);
+    DensityPyramid pyramid;
+    pyramid.build(list, index);
+    REQUIRE(pyramid.levels() > 3);
+    REQUIRE(pyramid.columns(pyramid.levels() - 1) == 1);
+
+    // at each level, the cells and the draws left whole hold everything
+    std::vector<SpatialIndex::Draw> large;
+    for (std::size_t l = 0; l < pyramid.levels(); ++l) {
+        double stroke = 0, filled = 0;
+        for (std::size_t row = 0; row < pyramid.rows(l); ++row) {
+            for (std::size_t column = 0; column < pyramid.columns(l); ++column) {
+                stroke += pyramid.cell(l, column, row).stroke;
+                filled += pyramid.cell(l, column, row).area;
+            }
+        }
+        pyramid.large_draws(l, pyramid.bounds(), large);
+        REQUIRE(std::is_sorted(large.begin(), large.end()));
+        for (const SpatialIndex::Draw d: large) {
+            const Box &box = index.bounds(d);
+            REQUIRE(std::max(box.x1 - box.x0, box.y1 - box.y0) > pyramid.cell_size(l));
+            const Atom atom = index.atom(d);
+            if (atom.type == LineType) {
+                stroke += std::hypot(box.x1 - box.x0, box.y1 - box.y0);
+            } else {
+                filled += (box.x1 - box.x0) * (box.y1 - box.y0);
+            }
+        }
+        REQUIRE(std::fabs(stroke - length) < 1e-4 * length);
+        REQUIRE(std::fabs(filled - area) < 1e-4 * area);
+    }
+    pyramid.large_draws(0, Box{0, 0, 100, 100}, large);
+    for (const SpatialIndex::Draw d: large) {
+        REQUIRE(index.bounds(d).intersects(Box{0, 0, 100, 100}));
+    }
+
+    // levels by pixel size
+    REQUIRE(pyramid.level_for(pyramid.cell_size(0) / 2) == pyramid.levels());
+    REQUIRE(pyramid.level_for(pyramid.cell_size(0)) == 0);
+    REQUIRE(pyramid.level_for(pyramid.cell_size(2)) == 2);
+    REQUIRE(pyramid.level_for(pyramid.cell_size(2) * 1.5) == 3);
+    REQUIRE(pyramid.level_for(1e9) == pyramid.levels() - 1);
+}
+
+TEST_CASE("density cells become premultiplied pixels", "[geometry]") {
+    // one 100 long line: cells of 25, 50 and 100, the line in the last
+    DisplayList lines;
+    Atom atom{LineType, Value()};
+    atom.value.line_value = Line{Point{0, 0}, Point{100, 0}};
+    lines.add(atom);
+    SpatialIndex index;
+    index.build(lines);
+    DensityPyramid pyramid;
+    pyramid.build(lines, index);
+    REQUIRE(pyramid.levels() == 3);
+    REQUIRE(pyramid.cell_size(2) == 100);
+    REQUIRE(pyramid.argb(0, 0, 0) == 0);
+    REQUIRE(pyramid.argb(2, 0, 0) == 0xff000000u);
+
+    // a red square filling the cell it lands in
+    DisplayList fills;
+    atom = Atom{FillRectType, Value()};
+    atom.value.fill_rect_value = FillRect{Rect{Point{0, 0}, Point{100, 100}}, 255, 0, 0};
+    fills.add(atom);
+    index.build(fills);
+    pyramid.build(fills, index);
+    REQUIRE(pyramid.cell_size(pyramid.levels() - 1) == 100);
+    REQUIRE(pyramid.argb(pyramid.levels() - 1, 0, 0) == 0xffff0000u);
+
+    // and partly under a black stroke, which darkens it
+    atom = Atom{LineType, Value()};
+    atom.value.line_value = Line{Point{0, 50}, Point{50, 50}};
+    fills.add(atom);
+    index.build(fills);
+    pyramid.build(fills, index);
+    const std::size_t top = pyramid.levels() - 1;
+    const double size = pyramid.cell_size(top), stroke = 50 / size, fill = 1e4 / (size * size);
+    const std::uint32_t pixel = pyramid.argb(top, 0, 0);
+    REQUIRE(pixel >> 24 == static_cast<std::uint32_t>((stroke + fill * (1 - stroke)) * 255 + 0.5));
+    REQUIRE((pixel >> 16 & 0xff) == static_cast<std::uint32_t>(255 * fill * (1 - stroke) + 0.5));
+    REQUIRE((pixel & 0xffff) == 0);
+}
+
+TEST_CASE("tiles cover a view at the next power of two scale", "[tiles]") {
+    REQUIRE(tile_level(1) == 0);
+    REQUIRE(tile_level(1.5) == 1);
+    REQUIRE(tile_level(4) == 2);
+    REQUIRE(tile_level(0.3) == -1);
+    REQUIRE(tile_level(0) == 0);
+
+    // 256 pixel tiles at level -1 are 512 units wide
+    REQUIRE(same_box(tile_box(TileKey{1, -1, 2, -1}, 256), Box{1024, -512, 1536, 0}));
+    std::vector<TileKey> keys;
+    tiles_covering(7, -1, 256, Box{-10, 0, 512, 600}, keys);
+    REQUIRE(keys.size() == 4); // the edge at 512 does not reach column 1
+    REQUIRE((keys.front() == TileKey{7, -1, -1, 0}));
+    REQUIRE((keys.back() == TileKey{7, -1, 0, 1}));
+
+    // at the finest level, tiles of far out areas are clamped, not overflowed
+    keys.clear();
+    tiles_covering(7, 30, 256, Box{1e6, -1e6, 1e6 + 1e-7, -1e6 + 1e-7}, keys);
+    REQUIRE(keys.size() == 1);
+    REQUIRE(keys.front().column == std::numeric_limits<int>::max() / 2);
+    REQUIRE(keys.front().row == -(std::numeric_limits<int>::max() / 2));
+
+    // parents cover their children, negative ones too
+    for (const TileKey &key: {TileKey{1, 3, 5, -3}, TileKey{1, 3, -8, 0}, TileKey{1, 3, -1, 9}}) {
+        for (int up = 1; up <= 3; ++up) {
+            const Box child = tile_box(key, 256), parent = tile_box(tile_parent(key, up), 256);
+            REQUIRE(parent.x0 <= child.x0);
+            REQUIRE(parent.y0 <= child.y0);
+            REQUIRE(parent.x1 >= child.x1);
+            REQUIRE(parent.y1 >= child.y1);
+            REQUIRE(tile_parent(key, up).level == key.level - up);
+        }
+    }
+}
+
+TEST_CASE("tile cache evicts the least recently used past its budget", "[tiles]") {
+    TileCache<std::string> cache(300);
+    const auto key = [](int column) { return TileKey{1, 0, column, 0}; };
+    cache.insert(key(0), "a", 100);
+    cache.insert(key(1), "b", 100);
+    cache.insert(key(2), "c", 100);
+    REQUIRE(cache.bytes() == 300);
+    REQUIRE(*cache.find(key(0)) == "a"); // now the most recent
+
+    cache.insert(key(3), "d", 100);
+    REQUIRE(cache.find(key(1)) == nullptr);
+    REQUIRE(cache.contains(key(0)));
+    REQUIRE(cache.bytes() == 300);
+
+    cache.insert(key(0), "e", 50); // replaces
+    REQUIRE(*cache.find(key(0)) == "e");
+    REQUIRE(cache.size() == 3);
+    REQUIRE(cache.bytes() == 250);
+
+    cache.insert(key(4), "too large", 400);
+    REQUIRE(cache.size() == 0);
+    REQUIRE(cache.bytes() == 0);
+
+    cache.insert(key(5), "f", 100);
+    cache.insert(TileKey{2, 0, 5, 0}, "g", 100);
+    cache.erase_layer(1);
+    REQUIRE(cache.size() == 1);
+    REQUIRE(cache.contains(TileKey{2, 0, 5, 0}));
+    cache.set_budget(50);
+    REQUIRE(cache.size() == 0);
+}
+
+TEST_CASE("transform kernels agree on every length", "[geometry]") {
+    const Affine m{0.5, -1.25, 2., 0.75, 3., -7.};
+    const std::size_t max = 37; // covers every tail length of the vector kernels
+    std::vector<Number> xs(max), ys(max);
+    for (std::size_t i = 0; i < max; ++i) {
+        xs[i] = i * 1.5 - 10;
+        ys[i] = 100. / (i + 1);
+    }
+
+    const TransformKernel kernels[] = {ScalarKernel, Sse2Kernel, Avx2Kernel};
+    for (std::size_t count = 0; count <= max; ++count) {
+        std::vector<Number> expect_x(count), expect_y(count);
+        transform_points(ScalarKernel, m, xs.data(), ys.data(), expect_x.data(), expect_y.data(), count);
+        for (std::size_t i = 0; i < count; ++i) {
+            const Point p = transform_point(m, Point{xs[i], ys[i]});
+            REQUIRE(expect_x[i] == p.x);
+            REQUIRE(expect_y[i] == p.y);
+        }
+        for (const TransformKernel kernel: kernels) {
+            if (!kernel_available(kernel)) {
+                continue;
+            }
+            INFO("kernel " << kernel << ", " << count << " points");
+            std::vector<Number> out_x(xs.begin(), xs.begin() + count), out_y(ys.begin(), ys.begin() + count);
+            transform_points(kernel, m, out_x.data(), out_y.data(), out_x.data(), out_y.data(), count);
+            REQUIRE(out_x == expect_x);
+            REQUIRE(out_y == expect_y);
+        }
+    }
+    REQUIRE(kernel_available(best_transform_kernel()));
+}
+
+TEST_CASE("transform builtins map every drawable", "[interpreter]") {
+    const char *cases[][2] = {
+        {"((1 2 point) 10 20 translate)", "(11,22)"},
+        {"((1 2 point) 3 -1 scale)", "(3,-2)"},
+        {"(((1 0 point) (0 1 point) line) (pi 2 /) rotate)", "((6.12323e-17,1),(-1,6.12323e-17))"},
+        {"(((0 0 point) (1 1 point) rect) 2 2 scale)", "((0,0),(2,2))"},
+        {"((((0 0 point) (1 1 point) rect) 1 2 3 fill_rect) 5 0 translate)", "(((5,0),(6,1)) (1,2,3))"},
+        {"((((0 0 point) (1 1 point) rect) ellipse) 1 0 0 1 -1 -1 transform)", "(((-1,-1),(0,0)))"},
+        {"(((0 0 point) (1 0 point) 1 arc) -1 1 scale)", "((0,0),(-1,0) -1)"},
+        {"((0 0 1 1 2 0 polyline) 1 1 translate)", "(polyline (1,1) (2,2) (3,1))"},
+        {"(((0 0 1 0 0 1 polygon) 2 2 scale) 1 0 translate)", "(polygon (1,0) (3,0) (1,2))"},
+        // a quarter turn keeps axes, so a rect stays a rect
+        {"(((0 0 point) (2 1 point) rect) 0 -1 1 0 0 0 transform)", "((0,0),(-1,2))"},
+        // a turned rect is the polygon through its corners
+        {"(((0 0 point) (2 1 point) rect) 1 1 0 1 0 0 transform)", "(polygon (0,0) (2,0) (3,1) (1,1))"},
+    };
+    for (const auto &c: cases) {
+        INFO(c[0]);
+        for (const EvalMode mode: {TreeWalkEval, BytecodeEval, FlatEval}) {
+            REQUIRE(run_with(mode, c[0]) == c[1]);
+        }
+        REQUIRE(run_with(TreeWalkEval, c[0], true) == c[1]);
+    }
+
+    // curves that lose their shape become sampled batches on their image:
+    // a quarter of the unit circle scaled 2 by 1, the unit circle sheared
+    const struct {
+        const char *program;
+        Number (*level)(Number x, Number y); // zero on the image
+    } curves[] = {
+        {"(((0 0 point) (1 0 point) (pi 2 /) arc) 2 1 scale)", [](Number x, Number y) { return x * x / 4 + y * y; }},
+        {"((((-1 -1 point) (1 1 point) rect) ellipse) 1 1 0 1 0 0 transform)",
+         [](Number x, Number y) { return (x - y) * (x - y) + y * y; }},
+    };
+    for (const auto &curve: curves) {
+        INFO(curve.program);
+        Interpreter interp;
+        REQUIRE(interp.parse(curve.program, std::strlen(curve.program)));
+        const Expression result = interp.eval();
+        REQUIRE(result.headType() == BatchType);
+        const Batch &batch = result.getHead().value.batch_value;
+        REQUIRE(batch.count > 8);
+        for (std::uint32_t i = 0; i < batch.count; ++i) {
+            REQUIRE(std::fabs(curve.level(batch.xs[i], batch.ys[i]) - 1) < 1e-9);
+        }
+    }
+    REQUIRE(run_with(TreeWalkEval, "(((0 0 point) (1 0 point) (pi 2 /) arc) 2 1 scale)").find("(polyline (2,0) ") == 0);
+
+    // a fill_rect has no batch form that keeps its fill
+    REQUIRE(run_with(TreeWalkEval, "((((0 0 point) (1 1 point) rect) 1 2 3 fill_rect) 1 rotate)") ==
+            "Error: rotate: a fill_rect can only be scaled, translated or turned by quarter turns");
+
+    // a transformed batch is a new batch; the original is unchanged
+    Interpreter interp;
+    const std::string program = "((b (0 0 1 1 points) define) (b 5 5 translate) b begin)";
+    REQUIRE(interp.parse(program.data(), program.size()));
+    std::ostringstream out;
+    out << interp.eval();
+    REQUIRE(out.str() == "(points (0,0) (1,1))");
+    REQUIRE(interp.getBatches().size() == 2);
+}
+
+TEST_CASE("procedures take a span of arguments", "[environment]") {
+    std::vector<Atom> args(3);
+    for (std::size_t i = 0; i < args.size(); ++i) {
+        args[i] = Expression(static_cast<double>(i + 1)).getHead();
+    }
+
+    const ArgSpan span(args.data() + 1, 2);
+    REQUIRE(span.size() == 2);
+    REQUIRE(span[0].value.num_value == 2.);
+
+    Environment env;
+    REQUIRE(env.get_procedure(SymAdd)(args) == Expression(6.));
+    REQUIRE(env.get_procedure(SymMul)(span) == Expression(6.));
+
+    // the original vector convention still works through the adapter
+    const Procedure adapted = &vector_procedure<&legacy_sum>;
+    REQUIRE(adapted(span) == Expression(5.));
+}
+
+static Expression call(const std::string &op, Expression::Tail args) {
+    Expression exp(op);
+    exp.getTail() = std::move(args);
+    return exp;
+}
+
+static std::size_t count_ops(const Program &program, OpCode op) {
+    std::size_t count = 0;
+    for (const auto &ins: program.code) {
+        count += ins.op == op;
+    }
+    return count;
+}
+
+TEST_CASE("builtin registry", "[environment]") {
+    Environment env;
+    for (const Builtin *b = builtins_begin(); b != builtins_end(); ++b) {
+        INFO(b->name);
+        REQUIRE(SymbolRef::fromId(b->symbol).str() == b->name);
+        REQUIRE(env.lookup_builtin(b->symbol) == b);
+        REQUIRE(b->min_args >= 1);
+    }
+    REQUIRE(builtins_end() - builtins_begin() == SymTransform - SymAdd + 1);
+
+    // the checked call enforces the signature, the implementation does not
+    const Builtin &sqrt = env.get_procedure(SymSqrt);
+    std::vector<Atom> args{Expression(4.).getHead(), Expression(9.).getHead()};
+    REQUIRE_THROWS_WITH(sqrt(args), "sqrt: wrong number of arguments");
+    REQUIRE(sqrt(ArgSpan(args.data(), 1)) == Expression(2.));
+    REQUIRE_THROWS_WITH(env.get_procedure(SymAdd)(ArgSpan(args.data(), 0)), "+: requires at least one argument");
+
+    // calls on arguments of known types skip the check in the VM
+    const Program typed = compile(call("*", {call("+", {Expression(1.), Expression(2.)}), Expression(std::string("pi"))}), env);
+    REQUIRE(count_ops(typed, OpCallUnchecked) == 2);
+    REQUIRE(count_ops(typed, OpCall) == 0);
+
+    const Program mixed = compile(call("+", {Expression(std::string("user_value")), Expression(1.)}), env);
+    REQUIRE(count_ops(mixed, OpCall) == 1);
+    const Program wrong = compile(call("+", {Expression(true), Expression(1.)}), env);
+    REQUIRE(count_ops(wrong, OpCall) == 1);
+
+    // both branches of an if must agree for its type to be known
+    const Program branches = compile(call("sqrt", {call("if", {Expression(true), Expression(1.), Expression(2.)})}), env);
+    REQUIRE(count_ops(branches, OpCallUnchecked) == 1);
+    const Program differing = compile(call("sqrt", {call("if", {Expression(true), Expression(1.), Expression(false)})}), env);
+    REQUIRE(count_ops(differing, OpCall) == 1);
+}
+
+TEST_CASE("builtin error messages", "[environment]") {
+    const char *cases[][2] = {
+        {"(1 True +)", "Error: +: argument must be Number"},
+        {"(True 2 -)", "Error: -: argument must be Number"},
+        {"(1 2 3 -)", "Error: -: wrong number of arguments"},
+        {"(1 2 sqrt)", "Error: sqrt: wrong number of arguments"},
+        {"(1 0 /)", "Error: /: division by zero"},
+        {"(1 not)", "Error: not: argument must be Boolean"},
+        {"(1 True or)", "Error: or: argument must be Boolean"},
+        {"(1 True ==)", "Error: ==: argument must be Number"},
+        {"(-1 sqrt)", "Error: sqrt: domain error"},
+        {"(0 log2)", "Error: log2: domain error"},
+        {"(1 True arctan)", "Error: arctan: argument must be Number"},
+        {"(1 True point)", "Error: point: argument must be Number"},
+        {"(1 (0 0 point) line)", "Error: line: argument must be Point"},
+        {"((0 0 point) 1 2 3 fill_rect)", "Error: fill_rect: argument must be Rect"},
+        {"((0 0 point) ellipse)", "Error: ellipse: argument must be Rect"},
+        {"(0 points)", "Error: points: requires at least 2 arguments"},
+        {"(0 0 1 polyline)", "Error: polyline: requires at least 4 arguments"},
+        {"(0 0 1 1 2 polyline)", "Error: polyline: requires x y pairs"},
+        {"(0 0 1 1 2 2 lines)", "Error: lines: requires two x y pairs per segment"},
+        {"(0 0 1 1 polygon)", "Error: polygon: requires at least 6 arguments"},
+        {"(0 0 True 1 points)", "Error: points: argument must be Number"},
+        {"(1 2 3 translate)", "Error: translate: argument must be Graphic"},
+        {"((0 0 point) True rotate)", "Error: rotate: argument must be Number"},
+    };
+    for (const auto &c: cases) {
+        INFO(c[0]);
+        REQUIRE(run_with(TreeWalkEval, c[0]) == c[1]);
+        REQUIRE(run_with(BytecodeEval, c[0]) == c[1]);
+    }
+}
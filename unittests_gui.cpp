@@ -1,9 +1,99 @@
 // TODO: add more function, varoiable, class, struct, module, Qt library, C++ standard library as you need.
+// Runs headless with QT_QPA_PLATFORM=offscreen.
 
 #include <QDebug>
 #include <QtTest/QtTest>
 #include <QtWidgets>
 
+#include <cmath>
+#include <cstdint>
+
+#include "canvas_widget.hpp"
+#include "display_list.hpp"
+#include "display_list_item.hpp"
+#include "qt_interpreter.hpp"
+#include "tile_renderer.hpp"
+
+// 'count' short lines and arcs scattered over a 1000 x 1000 square by a
+// fixed linear congruential walk, with a filled rect every 50 draws
+static DisplayList scattered(int count) {
+    DisplayList list;
+    std::uint32_t seed = 5;
+    const auto next = [&seed]() {
+        seed = seed * 1664525u + 1013904223u;
+        return static_cast<double>(seed >> 8) / (1u << 24) * 1000;
+    };
+    for (int i = 0; i < count; ++i) {
+        const Point a{next(), next()};
+        const Point b{a.x + next() / 50 - 10, a.y + next() / 50 - 10};
+        Atom atom{LineType, Value()};
+        if (i % 50 == 0) {
+            atom = Atom{FillRectType, Value()};
+            atom.value.fill_rect_value = FillRect{Rect{a, b}, 200, 40, 40};
+        } else if (i % 3 == 0) {
+            atom = Atom{ArcType, Value()};
+            atom.value.arc_value = Arc{a, b, 2};
+        } else {
+            atom.value.line_value = Line{a, b};
+        }
+        list.add(atom);
+    }
+    return list;
+}
+
+// 'scene' rendered into a 600 x 600 image showing 'view'
+static QImage render(QGraphicsScene &scene, const QRectF &view) {
+    QImage image(600, 600, QImage::Format_ARGB32_Premultiplied);
+    image.fill(Qt::white);
+    QPainter painter(&image);
+    scene.render(&painter, QRectF(image.rect()), view);
+    return image;
+}
+
+// A hidden 600 x 600 view of its scene, without frame or scroll bars, and
+// 'tiles' painting its viewport, as CanvasWidget's does. Grabbing it once
+// lays it out, before 'tiles' serves it.
+static void set_up_view(QGraphicsView &view, TileRenderer &tiles) {
+    view.setFrameShape(QFrame::NoFrame);
+    view.setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+    view.setVerticalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+    view.resize(600, 600);
+    view.grab();
+    tiles.setViewport(view.viewport());
+}
+
+// 'view' painted into a 600 x 600 image showing 'area', through its
+// viewport as on screen
+static QImage render(QGraphicsView &view, const QRectF &area) {
+    view.setSceneRect(area);
+    view.setTransform(QTransform::fromScale(600 / area.width(), 600 / area.height()));
+    QImage image(600, 600, QImage::Format_ARGB32_Premultiplied);
+    image.fill(Qt::white);
+    view.viewport()->render(&image);
+    return image;
+}
+
+// Fraction of the pixels of 'a' and 'b' that differ
+static double difference(const QImage &a, const QImage &b) {
+    int differ = 0;
+    for (int y = 0; y < a.height(); ++y) {
+        for (int x = 0; x < a.width(); ++x) {
+            differ += a.pixel(x, y) != b.pixel(x, y);
+        }
+    }
+    return static_cast<double>(differ) / (a.width() * a.height());
+}
+
+// Mean darkness of 'image', 0 for white to 1 for black
+static double ink(const QImage &image) {
+    double sum = 0;
+    for (int y = 0; y < image.height(); ++y) {
+        for (int x = 0; x < image.width(); ++x) {
+            sum += 255 - qGray(image.pixel(x, y));
+        }
+    }
+    return sum / 255 / (image.width() * image.height());
+}
 
 class unittests_gui : public QObject {
     Q_OBJECT
@@ -11,13 +101,212 @@ class unittests_gui : public QObject {
 public:
 
 private slots:
-    // # TODO: add tests
+    void testTilesPaintWhatTheItemPaints();
+
+    void testTilesInFlightShowPlaceholders();
+
+    void testTileCacheKeepsToItsBudget();
+
+    void testRemovedItemsDropTheirTiles();
+
+    void testRendererDestroyedWithTilesInFlight();
+
+    void testCanvasTilesPackedItems();
+
+    void testOneShotRendersPaintDirectly();
+
+    void testOneDrawSignalPerEval();
 
 private:
 };
 
-// #TODO add Qt unit tests
+void unittests_gui::testTilesPaintWhatTheItemPaints() {
+    QGraphicsScene scene;
+    DisplayListItem *item = new DisplayListItem(scattered(20000));
+    scene.addItem(item);
+    TileRenderer tiles;
+    QGraphicsView view(&scene);
+    set_up_view(view, tiles);
+
+    // at 1x, 0.5x (a tile level of its own) and 0.75x (tiles of 1x shrunk)
+    for (const qreal zoom: {1.0, 0.5, 0.75}) {
+        const QRectF area(100, 100, 600 / zoom, 600 / zoom);
+        item->setTileRenderer(nullptr);
+        const QImage direct = render(view, area);
+        item->setTileRenderer(&tiles);
+        render(view, area);
+        tiles.waitForIdle();
+        QCOMPARE(tiles.pending(), std::size_t(0));
+        const QImage tiled = render(view, area);
+        if (zoom == 0.75) {
+            // shrunk tiles are resampled, which keeps the ink, not the pixels
+            QVERIFY(std::fabs(ink(direct) - ink(tiled)) < 0.1 * ink(direct));
+        } else {
+            // tiles only cut strokes at their edges
+            QVERIFY(difference(direct, tiled) < 0.02);
+        }
+    }
+}
+
+void unittests_gui::testTilesInFlightShowPlaceholders() {
+    QGraphicsScene scene;
+    DisplayListItem *item = new DisplayListItem(scattered(20000));
+    scene.addItem(item);
+    TileRenderer tiles;
+    QGraphicsView view(&scene);
+    set_up_view(view, tiles);
+    item->setTileRenderer(&tiles);
+
+    // nothing cached: every tile is requested and shown as a placeholder
+    const QImage first = render(view, QRectF(0, 0, 600, 600));
+    QVERIFY(tiles.pending() > 0);
+    const QRgb placeholder = first.pixel(300, 300);
+    QVERIFY(qAlpha(placeholder) == 255 && qRed(placeholder) < 255 && qRed(placeholder) > 200);
+    tiles.waitForIdle();
+
+    // zoomed in, the cached coarser tiles stand in, scaled up
+    const QImage zoomed = render(view, QRectF(0, 0, 300, 300));
+    QVERIFY(tiles.pending() > 0);
+    tiles.waitForIdle();
+    const QImage sharp = render(view, QRectF(0, 0, 300, 300));
+    QVERIFY(std::fabs(ink(zoomed) - ink(sharp)) < 0.2 * ink(sharp));
+    QVERIFY(difference(zoomed, first) > 0.5);
+}
+
+void unittests_gui::testTileCacheKeepsToItsBudget() {
+    QGraphicsScene scene;
+    DisplayListItem *item = new DisplayListItem(scattered(20000));
+    scene.addItem(item);
+    TileRenderer tiles;
+    QGraphicsView view(&scene);
+    set_up_view(view, tiles);
+    const std::size_t tile = TileRenderer::TileSize * TileRenderer::TileSize * 4;
+    tiles.setBudget(3 * tile);
+    item->setTileRenderer(&tiles);
+
+    render(view, QRectF(0, 0, 600, 600));
+    tiles.waitForIdle();
+    QVERIFY(tiles.cachedBytes() <= 3 * tile);
+    QVERIFY(tiles.cachedBytes() > 0);
+    tiles.setBudget(tile);
+    QVERIFY(tiles.cachedBytes() <= tile);
+}
+
+void unittests_gui::testRemovedItemsDropTheirTiles() {
+    QGraphicsScene scene;
+    DisplayListItem *item = new DisplayListItem(scattered(20000));
+    scene.addItem(item);
+    TileRenderer tiles;
+    QGraphicsView view(&scene);
+    set_up_view(view, tiles);
+    tiles.setThreads(2);
+    item->setTileRenderer(&tiles);
+
+    // tiles in flight outlive the item, and are dropped as they finish
+    render(view, QRectF(0, 0, 1000, 1000));
+    QVERIFY(tiles.pending() > 0);
+    delete item;
+    tiles.waitForIdle();
+    QCOMPARE(tiles.cachedBytes(), std::size_t(0));
+}
+
+void unittests_gui::testRendererDestroyedWithTilesInFlight() {
+    QGraphicsScene scene;
+    DisplayListItem *item = new DisplayListItem(scattered(20000));
+    scene.addItem(item);
+    QGraphicsView view(&scene);
+    {
+        TileRenderer tiles;
+        set_up_view(view, tiles);
+        tiles.setThreads(2);
+        item->setTileRenderer(&tiles);
+        render(view, QRectF(0, 0, 1000, 1000));
+        QVERIFY(tiles.pending() > 0);
+    }
+
+    // the tiles it was painting went nowhere, and the item paints directly
+    QCoreApplication::processEvents();
+    QVERIFY(item->tileRenderer() == nullptr);
+    QVERIFY(ink(render(view, QRectF(0, 0, 1000, 1000))) > 0);
+}
+
+void unittests_gui::testCanvasTilesPackedItems() {
+    CanvasWidget canvas;
+    DisplayListItem *item = new DisplayListItem(scattered(100));
+    canvas.addGraphics(QList<QGraphicsItem *>{item, new QGraphicsLineItem(0, 0, 10, 10)});
+    QVERIFY(canvas.tileRenderer() != nullptr);
+    QCOMPARE(item->tileRenderer(), canvas.tileRenderer());
+}
+
+void unittests_gui::testOneShotRendersPaintDirectly() {
+    QGraphicsScene scene;
+    DisplayListItem *item = new DisplayListItem(scattered(20000));
+    scene.addItem(item);
+    TileRenderer tiles;
+    QGraphicsView view(&scene);
+    set_up_view(view, tiles);
+    item->setTileRenderer(&tiles);
+
+    // rendering the scene elsewhere, e.g. to print it, neither requests
+    // tiles nor shows placeholders
+    const QRectF area(0, 0, 600, 600);
+    const QImage rendered = render(scene, area);
+    QCOMPARE(tiles.pending(), std::size_t(0));
+    item->setTileRenderer(nullptr);
+    QVERIFY(difference(rendered, render(scene, area)) == 0);
+
+    // nor does a renderer serving no view
+    TileRenderer unshown;
+    item->setTileRenderer(&unshown);
+    render(view, area);
+    QCOMPARE(unshown.pending(), std::size_t(0));
+}
+
+void unittests_gui::testOneDrawSignalPerEval() {
+    QtInterpreter interp;
+    QList<QGraphicsItem *> each, all;
+    connect(&interp, &QtInterpreter::drawGraphic, [&each](QGraphicsItem *item) { each.append(item); });
+    connect(&interp, &QtInterpreter::drawGraphics, [&all](QList<QGraphicsItem *> items) { all = items; });
+    const QString program = "((0 0 point) ((10 0 point) (0 10 point) line) draw)";
+
+    // an item per primitive, in drawGraphics only by default
+    interp.parseAndEvaluate(program);
+    QCOMPARE(all.size(), 2);
+    QVERIFY(each.isEmpty());
+    QList<int> types;
+    for (QGraphicsItem *item: all) {
+        types.append(item->type());
+    }
+    qDeleteAll(all);
+
+    // in drawGraphic only when asked for, the same items in the same order
+    all.clear();
+    interp.setPerItemSignals(true);
+    interp.parseAndEvaluate(program);
+    QVERIFY(all.isEmpty());
+    QCOMPARE(each.size(), types.size());
+    for (int i = 0; i < each.size(); ++i) {
+        QCOMPARE(each[i]->type(), types[i]);
+    }
+    qDeleteAll(each);
+
+    // one DisplayListItem for all of them, either way
+    each.clear();
+    interp.setPackedThreshold(1);
+    interp.parseAndEvaluate(program);
+    QCOMPARE(each.size(), 1);
+    QCOMPARE(each.front()->type(), int(DisplayListItem::Type));
+    QVERIFY(all.isEmpty());
+    qDeleteAll(each);
 
+    each.clear();
+    interp.setPerItemSignals(false);
+    interp.parseAndEvaluate(program);
+    QCOMPARE(all.size(), 1);
+    QCOMPARE(all.front()->type(), int(DisplayListItem::Type));
+    QVERIFY(each.isEmpty());
+    qDeleteAll(all);
+}
 
 QTEST_MAIN(unittests_gui)
 #include "unittests_gui.moc"